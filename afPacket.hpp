@@ -0,0 +1,251 @@
+/*
+ * afPacket: Linux AF_PACKET TPACKET_V3 memory-mapped capture ring
+ *
+ * The kernel fills fixed size blocks of a ring shared with dlyloc and
+ * hands over a whole block at a time (when it's full or after a short
+ * timeout) so there's one wakeup per block rather than per packet and
+ * the headers are read in place. Optionally joins a PACKET_FANOUT group
+ * so several dlyloc processes can split one interface's traffic. Fanout
+ * uses the kernel's flow hash, which is symmetric, so both directions of
+ * a flow go to the same member.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef AFPACKET_HPP
+#define AFPACKET_HPP
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+struct afPacketRing {
+    static constexpr unsigned blockSize = 1 << 22;  // bytes per block
+    static constexpr unsigned blockCnt = 64;        // blocks in the ring
+    static constexpr unsigned frameSize = 2048;     // (only used to size the request)
+    static constexpr unsigned blockTmo = 100;       // ms until kernel retires a partial block
+
+    int _fd{-1};
+    int _ifindex{};
+    uint8_t* _map{};
+    size_t _mapLen{};
+    unsigned _curBlk{};
+    int _dlt{1};            // link type of the frames (DLT_EN10MB or DLT_RAW)
+    uint64_t _drops{};      // kernel drops (accumulated from PACKET_STATISTICS)
+    std::string _err;
+
+    ~afPacketRing() { close(); }
+
+    /*
+     * Open a packet socket on interface 'ifname' and find its link type
+     * (_dlt) so the caller can compile a filter for it. Returns false with
+     * _err set on failure.
+     */
+    bool open(const std::string& ifname) {
+        _fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        if (_fd < 0) {
+            return fail("socket");
+        }
+        struct ifreq ifr{};
+        strncpy(ifr.ifr_name, ifname.c_str(), sizeof(ifr.ifr_name) - 1);
+        if (ioctl(_fd, SIOCGIFINDEX, &ifr) < 0) {
+            return fail("SIOCGIFINDEX");
+        }
+        _ifindex = ifr.ifr_ifindex;
+        if (ioctl(_fd, SIOCGIFHWADDR, &ifr) < 0) {
+            return fail("SIOCGIFHWADDR");
+        }
+        switch (ifr.ifr_hwaddr.sa_family) {
+        case ARPHRD_ETHER: case ARPHRD_LOOPBACK:
+            _dlt = 1;   // DLT_EN10MB
+            break;
+        case ARPHRD_NONE:
+#ifdef ARPHRD_RAWIP
+        case ARPHRD_RAWIP:
+#endif
+            _dlt = 12;  // DLT_RAW
+            break;
+        default:
+            _err = ifname + ": unsupported link type for tpacket capture";
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * Set up the ring with the given compiled bpf filter (which also sets
+     * the snap length) and start capture. 'fanout' > 0 joins that fanout
+     * group id. Returns false with _err set on failure.
+     */
+    bool start(const struct sock_fprog* filt, int fanout = 0) {
+        int ver = TPACKET_V3;
+        if (setsockopt(_fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) {
+            return fail("PACKET_VERSION");
+        }
+        // attach the filter before the ring so nothing unfiltered gets queued
+        if (filt && setsockopt(_fd, SOL_SOCKET, SO_ATTACH_FILTER, filt, sizeof(*filt)) < 0) {
+            return fail("SO_ATTACH_FILTER");
+        }
+        struct tpacket_req3 req{};
+        req.tp_block_size = blockSize;
+        req.tp_block_nr = blockCnt;
+        req.tp_frame_size = frameSize;
+        req.tp_frame_nr = (blockSize / frameSize) * blockCnt;
+        req.tp_retire_blk_tov = blockTmo;
+        if (setsockopt(_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+            return fail("PACKET_RX_RING");
+        }
+        _mapLen = size_t(blockSize) * blockCnt;
+        void* m = mmap(nullptr, _mapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, _fd, 0);
+        if (m == MAP_FAILED) {
+            m = mmap(nullptr, _mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);  // no mlock rights
+        }
+        if (m == MAP_FAILED) {
+            _mapLen = 0;
+            return fail("mmap");
+        }
+        _map = (uint8_t*)m;
+        struct sockaddr_ll sll{};
+        sll.sll_family = AF_PACKET;
+        sll.sll_protocol = htons(ETH_P_ALL);
+        sll.sll_ifindex = _ifindex;
+        if (bind(_fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+            return fail("bind");
+        }
+        if (fanout > 0) {
+            int arg = (fanout & 0xffff) | (PACKET_FANOUT_HASH << 16);
+            if (setsockopt(_fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+                return fail("PACKET_FANOUT");
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Wait up to 'tmo' ms for a block then call f(frame, caplen, len, sec, usec)
+     * for each frame of every ready block. f returns false to stop early.
+     * Returns false if f asked to stop or on a poll error.
+     */
+    template<typename F>
+    bool dispatch(F&& f, int tmo = 250) {
+        auto* bd = blockDesc(_curBlk);
+        if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+            struct pollfd pfd{_fd, POLLIN | POLLERR, 0};
+            if (poll(&pfd, 1, tmo) < 0 && errno != EINTR) {
+                _err = std::string("poll: ") + strerror(errno);
+                return false;
+            }
+        }
+        while ((bd->hdr.bh1.block_status & TP_STATUS_USER) != 0) {
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            bool more = true;
+            auto* h = (struct tpacket3_hdr*)((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+            for (unsigned i = 0; i < bd->hdr.bh1.num_pkts && more; i++) {
+                more = f((const uint8_t*)h + h->tp_mac, h->tp_snaplen, h->tp_len,
+                         int64_t(h->tp_sec), int64_t(h->tp_nsec / 1000));
+                h = (struct tpacket3_hdr*)((uint8_t*)h + h->tp_next_offset);
+            }
+            // give the block back to the kernel
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+            _curBlk = (_curBlk + 1) % blockCnt;
+            if (!more) {
+                return false;
+            }
+            bd = blockDesc(_curBlk);
+        }
+        return true;
+    }
+
+    // replace the bpf filter while capturing. Returns false with _err set
+    // (but still capturing with the old one) on failure.
+    bool setFilter(const struct sock_fprog* filt) {
+        if (setsockopt(_fd, SOL_SOCKET, SO_ATTACH_FILTER, filt, sizeof(*filt)) < 0) {
+            _err = std::string("SO_ATTACH_FILTER: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // kernel drop count since open (reading the statistics resets the kernel's)
+    uint64_t drops() {
+        struct tpacket_stats_v3 st{};
+        socklen_t len = sizeof(st);
+        if (_fd >= 0 && getsockopt(_fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+            _drops += st.tp_drops;
+        }
+        return _drops;
+    }
+
+    void close() {
+        if (_map) {
+            munmap(_map, _mapLen);
+            _map = nullptr;
+        }
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+  private:
+    struct tpacket_block_desc* blockDesc(unsigned i) {
+        return (struct tpacket_block_desc*)(_map + size_t(i) * blockSize);
+    }
+    bool fail(const char* what) {
+        _err = std::string(what) + ": " + strerror(errno);
+        close();
+        return false;
+    }
+};
+
+#endif // __linux__
+#endif // AFPACKET_HPP
@@ -0,0 +1,125 @@
+/*
+ * clockModel: TCP timestamp clock rates and the fit used to pick one
+ *
+ * A flow's TSval clock is fit over the (ts, tm) points of its lower hull
+ * by least squares and the slope (seconds per tick) is matched to the
+ * nearest of the tick rates hosts use: 1us and 10us (Linux usec TCP
+ * timestamps, data center stacks), 1ms, 4ms and 10ms. Any other whole
+ * number of ms is also accepted. The fit is only done when a flow's hull
+ * changes (at most once per movingMin interval) and is written as a
+ * branch-free batch loop over flat arrays with independent accumulators
+ * so the compiler can vectorize it.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef CLOCKMODEL_HPP
+#define CLOCKMODEL_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+constexpr double tickRates[] = { 1e-6, 1e-5, 1e-3, 4e-3, 1e-2 };   //sec per tick
+constexpr double maxSkew = 0.005;   //max relative difference of fit and tick rate
+
+/*
+ * slope of the least squares line through (x[i], y[i]), i < n (n >= 2).
+ * x is centered on x[0] (the products of raw extended TSvals would lose
+ * precision) and each sum is spread over 4 lanes.
+ */
+static inline double fitSlope(const double* x, const double* y, size_t n)
+{
+    constexpr size_t L = 4;
+    double sx[L]{}, sy[L]{}, sxx[L]{}, sxy[L]{};
+    size_t i = 0;
+    for (; i + L <= n; i += L) {
+        for (size_t j = 0; j < L; j++) {
+            double dx = x[i + j] - x[0], dy = y[i + j] - y[0];
+            sx[j] += dx;
+            sy[j] += dy;
+            sxx[j] += dx * dx;
+            sxy[j] += dx * dy;
+        }
+    }
+    for (; i < n; i++) {
+        double dx = x[i] - x[0], dy = y[i] - y[0];
+        sx[0] += dx;
+        sy[0] += dy;
+        sxx[0] += dx * dx;
+        sxy[0] += dx * dy;
+    }
+    double Sx = 0., Sy = 0., Sxx = 0., Sxy = 0.;
+    for (size_t j = 0; j < L; j++) {
+        Sx += sx[j];
+        Sy += sy[j];
+        Sxx += sxx[j];
+        Sxy += sxy[j];
+    }
+    double d = n * Sxx - Sx * Sx;
+    return d > 0. ? (n * Sxy - Sx * Sy) / d : 0.;
+}
+
+// the tick rate (sec per tick) within maxSkew of slope m, 0 if none
+static inline double matchTick(double m)
+{
+    if (!(m > 0.)) {
+        return 0.;
+    }
+    for (double r : tickRates) {
+        if (fabs(m - r) <= maxSkew * r) {
+            return r;
+        }
+    }
+    double r = round(m * 1000.) / 1000.;    //other whole ms rates
+    return r > 0. && fabs(m - r) <= maxSkew * r ? r : 0.;
+}
+
+/*
+ * Scale for the movingMin interval (set for 1ms ticks) to make it about
+ * the same length of time for a clock with finer ticks, from the capture
+ * time tm elapsed over the first ts ticks of a flow. Clocks of 100us or
+ * more per tick keep their tick based interval.
+ */
+static inline int64_t tickScale(double tm, int64_t ts)
+{
+    if (ts <= 0 || tm >= 1e-4 * ts) {
+        return 1;
+    }
+    return tm > 1e-7 * ts ? llround(1e-3 * ts / tm) : 10000;
+}
+
+#endif // CLOCKMODEL_HPP
@@ -0,0 +1,256 @@
+/*
+ * colWriter: chunked columnar output file for long running captures
+ *
+ * Records are accumulated column by column and written as a chunk every
+ * chunkRows records (or chunkSecs of capture time). The file is only
+ * appended to: each chunk goes out in one write together with a footer
+ * indexing it and linking to the previous footer, so the file always
+ * ends with a valid trailer and a crash loses at most the chunk being
+ * built (a failed write is truncated away). close() appends a footer
+ * indexing every chunk so a finished file's index is one read. All
+ * integers are little-endian.
+ *
+ *  file:   "DLYC" u16 version (2) u16 0 | footer | (chunk footer) ...
+ *          [footer]
+ *  chunk:  "DLYK" u32 rows u32 columns (8) u32 flows i64 first capture
+ *          time (us since epoch), then each column as u32 byte length +
+ *          data, then the chunk's flow dictionary (flows x 36 bytes:
+ *          16 byte src addr, 16 byte dst addr, u16 sport, u16 dport)
+ *  columns (in order):
+ *      time    zigzag varint us delta from the previous row's time
+ *      rtt     float (-1 if none)
+ *      minRtt  float (-1 if none)
+ *      bytes   varint bytes sent
+ *      dv0..2  float (-1 if not computed)
+ *      flow    varint index into the chunk's flow dictionary
+ *  footer: "DLYI" u32 chunks, then per chunk u64 offset, u32 rows, u32 0,
+ *          i64 first and i64 last capture time (us), then u64 offset of
+ *          the previous footer (0 if none) | u64 this footer's offset
+ *          "DLYF"
+ *  A reader starts at the footer named by the file's last 12 bytes and
+ *  follows the previous footer links to 0.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef COLWRITER_HPP
+#define COLWRITER_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "./pktRec.hpp"
+
+struct colWriter {
+    static constexpr uint32_t chunkRows = 1 << 16;
+    static constexpr double chunkSecs = 60.;
+    static constexpr int nCols = 8;
+    std::string _err;
+
+    ~colWriter() { close(); }
+
+    bool open(const char* fname) {
+        _fd = ::open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0) {
+            _err = std::string(fname) + ": " + strerror(errno);
+            return false;
+        }
+        std::vector<char> b;
+        b.insert(b.end(), {'D', 'L', 'Y', 'C'});
+        put(b, 2, 2);
+        put(b, 0, 2);
+        _end = 0;
+        footer(b, 0, 0);
+        append(b);
+        return _err.empty();
+    }
+
+    void add(const outRec& o, int64_t offTm) {
+        int64_t t = llround((o.tm + double(offTm)) * 1e6);
+        if (_rows == 0) {
+            _firstTm = _prevTm = t;
+            _chunkTm = o.tm;
+        }
+        putVarint(_col[0], zigzag(t - _prevTm));
+        _prevTm = t;
+        putFloat(_col[1], o.rtt);
+        putFloat(_col[2], o.rtt < 0. ? -1. : o.minPP);
+        putVarint(_col[3], uint64_t(o.bytesSnt));
+        for (int i = 0; i < 3; i++) {
+            putFloat(_col[4 + i], o.dv[i]);
+        }
+        auto [it, isNew] = _dict.try_emplace(o.fk, uint32_t(_dictKeys.size()));
+        if (isNew) {
+            _dictKeys.push_back(o.fk);
+        }
+        putVarint(_col[7], it->second);
+        if (++_rows >= chunkRows || o.tm - _chunkTm >= chunkSecs) {
+            flush();
+        }
+    }
+
+    // write out the chunk being built (if any) and its footer
+    void flush() {
+        if (_rows == 0 || _fd < 0) {
+            return;
+        }
+        std::vector<char> b;
+        b.insert(b.end(), {'D', 'L', 'Y', 'K'});
+        put(b, _rows, 4);
+        put(b, nCols, 4);
+        put(b, _dictKeys.size(), 4);
+        put(b, uint64_t(_firstTm), 8);
+        for (auto& c : _col) {
+            put(b, c.size(), 4);
+            b.insert(b.end(), c.begin(), c.end());
+            c.clear();
+        }
+        for (const auto& k : _dictKeys) {
+            b.insert(b.end(), k.src.bytes(), k.src.bytes() + 16);
+            b.insert(b.end(), k.dst.bytes(), k.dst.bytes() + 16);
+            put(b, k.sport, 2);
+            put(b, k.dport, 2);
+        }
+        _index.push_back({_end, _rows, _firstTm, _prevTm});
+        footer(b, _index.size() - 1, _lastFooter);
+        if (!append(b)) {
+            _index.pop_back();      // (the chunk is lost, the file's still readable)
+        }
+        _rows = 0;
+        _dict.clear();
+        _dictKeys.clear();
+    }
+
+    void close() {
+        if (_fd >= 0) {
+            flush();
+            if (!_index.empty()) {
+                std::vector<char> b;
+                footer(b, 0, 0);    // (the whole index)
+                append(b);
+            }
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+  private:
+    struct chunkIdx {
+        uint64_t off;
+        uint32_t rows;
+        int64_t first, last;
+    };
+    int _fd{-1};
+    uint64_t _end{};            // end of the file
+    uint64_t _lastFooter{};     // offset of the latest footer
+    uint64_t _nextFooter{};     // ... of the footer in the buffer being appended
+    std::vector<char> _col[nCols];
+    std::unordered_map<flowKey, uint32_t, flowKeyHash> _dict;
+    std::vector<flowKey> _dictKeys;
+    std::vector<chunkIdx> _index;
+    uint32_t _rows{};
+    int64_t _firstTm{}, _prevTm{};
+    double _chunkTm{};
+
+    static void put(std::vector<char>& b, uint64_t v, int n) {
+        for (int i = 0; i < n; i++) {
+            b.push_back(char(v >> (8 * i)));
+        }
+    }
+    static uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+    static void putVarint(std::vector<char>& b, uint64_t v) {
+        while (v >= 0x80) {
+            b.push_back(char(v | 0x80));
+            v >>= 7;
+        }
+        b.push_back(char(v));
+    }
+    static void putFloat(std::vector<char>& b, double v) {
+        float f = float(v);
+        uint32_t u;
+        memcpy(&u, &f, sizeof(u));
+        put(b, u, 4);
+    }
+
+    // append a footer to 'b' (which will be written at _end) indexing
+    // the chunks from 'first' on and linking to the footer at 'prev'
+    void footer(std::vector<char>& b, size_t first, uint64_t prev) {
+        uint64_t off = _end + b.size();
+        b.insert(b.end(), {'D', 'L', 'Y', 'I'});
+        put(b, _index.size() - first, 4);
+        for (size_t i = first; i < _index.size(); i++) {
+            put(b, _index[i].off, 8);
+            put(b, _index[i].rows, 4);
+            put(b, 0, 4);
+            put(b, uint64_t(_index[i].first), 8);
+            put(b, uint64_t(_index[i].last), 8);
+        }
+        put(b, prev, 8);
+        put(b, off, 8);
+        b.insert(b.end(), {'D', 'L', 'Y', 'F'});
+        _nextFooter = off;
+    }
+    // write 'b' at the end of the file. If it can't all be written the
+    // file is cut back so it still ends with the previous footer.
+    bool append(const std::vector<char>& b) {
+        size_t n = 0;
+        while (n < b.size()) {
+            ssize_t w = pwrite(_fd, b.data() + n, b.size() - n, _end + n);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                _err = strerror(errno);
+                if (ftruncate(_fd, _end) < 0) {
+                    _err += std::string(", ") + strerror(errno);
+                }
+                return false;
+            }
+            n += w;
+        }
+        _end += b.size();
+        _lastFooter = _nextFooter;
+        return true;
+    }
+};
+
+#endif // COLWRITER_HPP
@@ -0,0 +1,150 @@
+/*
+ * ctlSocket: a UNIX domain stream socket taking line commands (--control)
+ *
+ * serve() accepts one connection at a time and hands each line it reads
+ * to a command function whose reply (text ending in a newline) is
+ * written back, so it works with, e.g.,
+ *     echo 'top 10' | nc -U /tmp/dlyloc.ctl
+ * It's run by its own thread; commands only reach the rest of dlyloc
+ * through what the command function does.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef CTLSOCKET_HPP
+#define CTLSOCKET_HPP
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+struct ctlSocket {
+    int _fd{-1};
+    std::string _path;
+    std::string _err;
+
+    bool fail(const char* what) {
+        _err = std::string(what) + ": " + strerror(errno);
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+        return false;
+    }
+
+    // listen at 'path' (replacing a stale socket left there, not anything else)
+    bool open(const std::string& path) {
+        struct sockaddr_un a{};
+        if (path.size() >= sizeof(a.sun_path)) {
+            errno = ENAMETOOLONG;
+            return fail(path.c_str());
+        }
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path.c_str());
+        }
+        a.sun_family = AF_UNIX;
+        memcpy(a.sun_path, path.c_str(), path.size());
+        if ((_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            return fail("socket");
+        }
+        if (bind(_fd, (struct sockaddr*)&a, sizeof(a)) < 0) {
+            return fail(path.c_str());
+        }
+        if (listen(_fd, 4) < 0) {
+            return fail("listen");
+        }
+        _path = path;
+        return true;
+    }
+
+    // reply to each command line of each connection (doesn't return)
+    template<typename F>
+    void serve(F&& cmd) {
+        for (;;) {
+            int c = accept(_fd, nullptr, nullptr);
+            if (c < 0) {
+                continue;
+            }
+            struct timeval tmo{30, 0};      // (an idle client doesn't block others forever)
+            setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+            std::string buf;
+            char b[512];
+            for (ssize_t n; (n = read(c, b, sizeof(b))) > 0; ) {
+                buf.append(b, n);
+                for (size_t e; (e = buf.find('\n')) != std::string::npos; ) {
+                    std::string ln = buf.substr(0, e);
+                    buf.erase(0, e + 1);
+                    if (!ln.empty() && ln.back() == '\r') {
+                        ln.pop_back();
+                    }
+                    if (!ln.empty() && !writeAll(c, cmd(ln))) {
+                        break;
+                    }
+                }
+            }
+            if (!buf.empty()) {
+                writeAll(c, cmd(buf));  // (last line without a newline)
+            }
+            ::close(c);
+        }
+    }
+
+    static bool writeAll(int fd, const std::string& s) {
+        for (size_t o = 0; o < s.size(); ) {
+            ssize_t n = send(fd, s.data() + o, s.size() - o, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            o += n;
+        }
+        return true;
+    }
+
+    void close() {
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+            unlink(_path.c_str());
+        }
+    }
+};
+
+#endif // CTLSOCKET_HPP
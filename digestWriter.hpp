@@ -0,0 +1,183 @@
+/*
+ * digestWriter: periodic per-flow and per-prefix delay percentiles
+ *
+ * Rather than a line per packet, the rtt, min rtt and delay variations of
+ * each flow's output records go into t-digests (see tDigest.hpp) and once
+ * an interval a line per flow (and/or per src/dst prefix pair) and metric
+ * gives the sample count, min, p10, p50, p90, p99 and max, e.g.
+ *
+ *   machine: <interval end> <metric> <n> <min> <p10> .. <max> <flow or prefixes>
+ *   human:   <interval end> <metric> <n> min <v> p10 <v> .. max <v> <flow or prefixes>
+ *
+ * Prefix summaries are made when the interval ends by merging the digests
+ * of the flows in it. State only covers flows seen in the current interval.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef DIGESTWRITER_HPP
+#define DIGESTWRITER_HPP
+
+#include <array>
+#include <vector>
+#include "./outWriter.hpp"
+#include "./tDigest.hpp"
+
+struct digestWriter {
+    static constexpr int nMetrics = 5;
+    using digests = std::array<tDigest, nMetrics>;
+
+    digestWriter(outWriter& o, double interval) : _out{o}, _clk{interval} {}
+
+    void byFlow(bool b) { _byFlow = b; }
+    void byPrefix(int v4len, int v6len) {
+        _byPfx = true;
+        _v4len = std::clamp(v4len, 0, 32);
+        _v6len = std::clamp(v6len, 0, 128);
+    }
+
+    // add an output record. 'offTm' is the offset of o.tm (as for outWriter)
+    void add(const outRec& o, int64_t offTm) {
+        _clk.tick(o.tm, [&] { flush(offTm); });
+        _offTm = offTm;
+        auto [it, added] = _idx.try_emplace(o.fk, uint32_t(_flows.size()));
+        if (added) {
+            _flows.emplace_back(o.fk, digests{});
+        }
+        auto& d = _flows[it->second].second;
+        if (o.rtt >= 0.) {
+            d[0].add(o.rtt);
+            d[1].add(o.minPP);
+        }
+        for (int i = 0; i < 3; i++) {
+            if (o.dv[i] >= 0.) {
+                d[2 + i].add(o.dv[i]);
+            }
+        }
+    }
+
+    // write the summaries of the current interval then start a new one
+    void flush(int64_t offTm) {
+        if (_flows.empty()) {
+            return;
+        }
+        double tm = _clk.stamp();
+        if (_byFlow) {
+            for (auto& [fk, d] : _flows) {
+                lines(tm, offTm, fk, false, d);
+            }
+        }
+        if (_byPfx) {
+            std::vector<std::pair<flowKey, digests>> pfx;
+            std::unordered_map<flowKey, uint32_t, flowKeyHash> idx;
+            for (auto& [fk, d] : _flows) {
+                flowKey pk{};
+                pk.src = fk.src.masked(_v4len, _v6len);
+                pk.dst = fk.dst.masked(_v4len, _v6len);
+                auto [it, added] = idx.try_emplace(pk, uint32_t(pfx.size()));
+                if (added) {
+                    pfx.emplace_back(pk, digests{});
+                }
+                for (int i = 0; i < nMetrics; i++) {
+                    pfx[it->second].second[i].merge(d[i]);
+                }
+            }
+            for (auto& [pk, d] : pfx) {
+                lines(tm, offTm, pk, true, d);
+            }
+        }
+        _flows.clear();
+        _idx.clear();
+    }
+
+    // end of input: summarize the partial interval
+    void close() { flush(_offTm); }
+
+  private:
+    outWriter& _out;
+    sumClock _clk;          // summary intervals
+    int64_t _offTm{};
+    bool _byFlow{true};
+    bool _byPfx{};
+    int _v4len{24}, _v6len{48};
+    std::vector<std::pair<flowKey, digests>> _flows;    // in order first seen
+    std::unordered_map<flowKey, uint32_t, flowKeyHash> _idx;
+
+    void lines(double tm, int64_t offTm, const flowKey& k, bool pfx, digests& d) {
+        static const char* const names[nMetrics] = {"rtt", "minrtt", "dv0", "dv1", "dv2"};
+        static const double qs[] = {0.1, 0.5, 0.9, 0.99};
+        static const char* const qNames[] = {"p10 ", "p50 ", "p90 ", "p99 "};
+        bool human = _out.format() != outFmt::machine;
+        char tmStr[32];
+        size_t tmLen = fmtSumTm(tmStr, tm, offTm, human) - tmStr;
+        for (int m = 0; m < nMetrics; m++) {
+            if (d[m].empty()) {
+                continue;
+            }
+            char buf[outWriter::maxRec];
+            char* p = buf;
+            memcpy(p, tmStr, tmLen);
+            p += tmLen;
+            *p++ = ' ';
+            p = fmtStr(p, names[m]);
+            *p++ = ' ';
+            p = fmtUInt(p, uint64_t(d[m].count()));
+            *p++ = ' ';
+            if (human) {
+                p = fmtStr(p, "min ");
+            }
+            p = fmtSumVal(p, d[m].min(), human);
+            for (int i = 0; i < 4; i++) {
+                *p++ = ' ';
+                if (human) {
+                    p = fmtStr(p, qNames[i]);
+                }
+                p = fmtSumVal(p, d[m].quantile(qs[i]), human);
+            }
+            *p++ = ' ';
+            if (human) {
+                p = fmtStr(p, "max ");
+            }
+            p = fmtSumVal(p, d[m].max(), human);
+            *p++ = ' ';
+            p = pfx ? fmtPrefixes(p, k, _v4len, _v6len) : fmtFlow(p, k);
+            *p++ = '\n';
+            _out.text(buf, p - buf);
+        }
+    }
+};
+
+#endif // DIGESTWRITER_HPP
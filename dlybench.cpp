@@ -0,0 +1,364 @@
+/*
+ * dlybench - microbenchmarks of dlyloc's per-packet paths and an end to
+ * end throughput run
+ *
+ *  dlybench [-n scale]                 run the microbenchmarks
+ *  dlybench -e dlyloc file.pcap [args] time 'dlyloc -q -m -r file.pcap args'
+ *
+ * Each microbenchmark runs 5 times over the same (seeded) inputs and
+ * reports the median and minimum ns per operation. The end to end run
+ * counts the file's packets, runs dlyloc 3 times with output to /dev/null
+ * and reports packets/sec and ns/packet of elapsed and of CPU time for the
+ * fastest run. 'make bench' builds everything with optimization, makes
+ * a capture with dlygen and runs both.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "./flowKey.hpp"
+#include "./tsvalTable.hpp"
+#include "./pktRec.hpp"
+#include "./rawParse.hpp"
+#include "./pcapFile.hpp"
+#include "./movingmin.hpp"
+#include "./clockModel.hpp"
+#include "./segRing.hpp"
+#include "./dvBatch.hpp"
+#include "./flowDelay.hpp"
+
+// keep the compiler from optimizing away a result
+template <typename T>
+static inline void keep(const T& v) { asm volatile("" : : "r"(&v) : "memory"); }
+
+static double scale = 1.;       // -n: multiplies every benchmark's op count
+
+/*
+ * Run 'f' (which does 'ops' operations) 5 times and print the median and
+ * minimum ns/op. 'setup' (run untimed before each repetition) resets state.
+ */
+template <typename S, typename F>
+static void bench(const char* name, uint64_t ops, S&& setup, F&& f)
+{
+    using clk = std::chrono::steady_clock;
+    ops = std::max<uint64_t>(1, uint64_t(double(ops) * scale));
+    std::vector<double> ns;
+    for (int r = 0; r < 5; r++) {
+        setup();
+        auto t0 = clk::now();
+        f(ops);
+        std::chrono::duration<double, std::nano> dt = clk::now() - t0;
+        ns.push_back(dt.count() / double(ops));
+    }
+    std::sort(ns.begin(), ns.end());
+    printf("%-28s %10.2f ns/op  (min %.2f, %" PRIu64 " ops)\n", name, ns[2], ns[0], ops);
+}
+
+static std::mt19937_64 rng{1};
+static double uniform() { return double(rng() >> 11) * 0x1.0p-53; }
+
+// a ms tick TSval clock with queueing noise: capture time and TSval of packet i
+struct clockSamp {
+    double tm;
+    uint32_t ts;
+};
+static std::vector<clockSamp> clockSamps(size_t n, double pps, double hz, uint32_t base)
+{
+    std::vector<clockSamp> v(n);
+    double t = 0.;
+    for (auto& s : v) {
+        t += (0.5 + uniform()) / pps;
+        s.tm = t + 0.005 + 0.002 * uniform() * uniform();
+        s.ts = base + uint32_t(uint64_t(t * hz));
+    }
+    return v;
+}
+
+static void put16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v >> 8); p[1] = uint8_t(v); }
+static void put32(uint8_t* p, uint32_t v) { put16(p, uint16_t(v >> 16)); put16(p + 2, uint16_t(v)); }
+
+// Ethernet + IPv4 or v6 + TCP with a timestamp option
+static std::vector<uint8_t> mkFrame(bool v6, uint32_t src, uint32_t dst, uint16_t sp, uint16_t dp)
+{
+    std::vector<uint8_t> f(14 + (v6 ? 40 : 20) + 32);
+    uint8_t* p = f.data();
+    put16(p + 12, v6 ? 0x86dd : 0x0800);
+    p += 14;
+    if (v6) {
+        p[0] = 0x60;
+        put16(p + 4, 32);
+        p[6] = 6;
+        p[7] = 64;
+        p[8] = 0x20;
+        p[9] = 0x01;
+        put32(p + 20, src);
+        p[24] = 0x20;
+        p[25] = 0x01;
+        put32(p + 36, dst);
+        p += 40;
+    } else {
+        p[0] = 0x45;
+        put16(p + 2, 52);
+        p[8] = 64;
+        p[9] = 6;
+        put32(p + 12, src);
+        put32(p + 16, dst);
+        p += 20;
+    }
+    put16(p, sp);
+    put16(p + 2, dp);
+    p[12] = (32 / 4) << 4;
+    p[13] = 0x10;
+    p[20] = p[21] = 1;
+    p[22] = 8;
+    p[23] = 10;
+    put32(p + 24, uint32_t(rng()) | 1);
+    put32(p + 28, uint32_t(rng()) | 1);
+    return f;
+}
+
+static void microBenches()
+{
+    const size_t nSamp = 1 << 20;
+
+    auto ms = clockSamps(nSamp, 1000., 1e3, 12345);
+    bench("movingMin::addSample", nSamp, [] {}, [&](uint64_t n) {
+        movingMin mm{5.0, 50};
+        for (uint64_t i = 0; i < n; i++) {
+            const auto& s = ms[i & (nSamp - 1)];
+            mm.addSample(s.tm, int64_t(i));
+            keep(mm._minList.front());
+        }
+    });
+    {
+        std::vector<uint32_t> ts(nSamp);
+        uint32_t t = 0xfff00000u;
+        for (auto& v : ts) {
+            t += uint32_t(rng() % 64);
+            v = t;
+        }
+        tsWrap w{};
+        bench("extendTS", 8 * nSamp, [&] { w = tsWrap{}; }, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                int64_t x = extendTS(ts[i & (nSamp - 1)], &w);
+                keep(x);
+            }
+        });
+    }
+    {
+        // a flow with a 1ms clock from the start; computeTicks then the
+        // full computeDV (with the flow standing in as its own clocked
+        // reverse flow: computeDV only reads the reverse flow's clock),
+        // then computeDV for a 1us clock, then the batched form (gatherDV
+        // per packet and dvBatch::compute per 64)
+        flowKey k{};
+        auto us = clockSamps(nSamp, 1000., 1e6, 12345);
+        dvBatch db;
+        auto run = [&](const std::vector<clockSamp>& cs, double hz, bool dv, uint64_t n, dvBatch* b = nullptr) {
+            flowDly f{k};
+            f.revFlow = true;
+            tsWrap tw{}, ew{};
+            for (uint64_t i = 0; i < n; i++) {
+                const auto& s = cs[i % nSamp];
+                pktInfo pi;
+                pi.tm = s.tm + double(i / nSamp) * cs.back().tm;
+                pi.ts = extendTS(s.ts + uint32_t(i / nSamp * uint64_t(cs.back().tm * hz)), &tw);
+                pi.ecr = extendTS(s.ts, &ew);
+                pi.dv[0] = pi.dv[1] = pi.dv[2] = -1.;
+                if (i == 0) {
+                    f.startTm = pi.tm;
+                    f.startTS = pi.ts;
+                }
+                if (b) {
+                    f.gatherDV(pi, &f, *b, i % dvBatch::N);
+                    if (i % dvBatch::N == dvBatch::N - 1) {
+                        b->compute(dvBatch::N);
+                        keep(b->dv2[0]);
+                    }
+                } else {
+                    bool r = dv ? f.computeDV(pi, &f) : f.computeTicks(pi.tm, pi.ts);
+                    keep(r);
+                }
+                if (f.pktCnt < UINT16_MAX) {
+                    f.pktCnt++;
+                }
+            }
+        };
+        bench("flowDly::computeTicks", nSamp, [] {}, [&](uint64_t n) { run(ms, 1e3, false, n); });
+        bench("flowDly::computeDV", nSamp, [] {}, [&](uint64_t n) { run(ms, 1e3, true, n); });
+        bench("flowDly::computeDV (1us)", nSamp, [] {}, [&](uint64_t n) { run(us, 1e6, true, n); });
+        bench("flowDly::gatherDV + dvBatch", nSamp, [] {}, [&](uint64_t n) { run(ms, 1e3, true, n, &db); });
+    }
+    {
+        std::vector<std::vector<uint8_t>> frames;
+        for (int i = 0; i < 1024; i++) {
+            frames.push_back(mkFrame(i % 5 == 4, 0x0a000000 + uint32_t(rng() % 100000),
+                                     0xc0a80000 + uint32_t(rng() % 65536),
+                                     uint16_t(rng()), 443));
+        }
+        bench("rawParse + symHash", 8 * nSamp, [] {}, [&](uint64_t n) {
+            pktRec pr;
+            for (uint64_t i = 0; i < n; i++) {
+                const auto& f = frames[i & 1023];
+                parseRes r = rawParse(rawDltEN10MB, f.data(), uint32_t(f.size()), pr);
+                uint64_t h = pr.fk.symHash();
+                keep(r);
+                keep(h);
+            }
+        });
+        std::vector<flowKey> keys(1024);
+        for (size_t i = 0; i < keys.size(); i++) {
+            pktRec pr;
+            rawParse(rawDltEN10MB, frames[i].data(), uint32_t(frames[i].size()), pr);
+            keys[i] = pr.fk;
+        }
+        bench("flowKey::hash", 8 * nSamp, [] {}, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                uint64_t h = keys[i & 1023].hash();
+                keep(h);
+            }
+        });
+    }
+    {
+        // 1000 flows at 10k packets/sec, TSvals looked up (as ECRs) 2000 packets after they're added
+        const uint32_t nFlow = 1000;
+        const size_t lag = 2000;
+        std::vector<std::pair<uint32_t, uint32_t>> ft(nSamp);
+        for (size_t i = 0; i < nSamp; i++) {
+            ft[i] = {uint32_t(rng() % nFlow) + 1, uint32_t(i)};
+        }
+        tsvalTable tbl;
+        bench("tsvalTable add + getUnused", nSamp, [&] { tbl = tsvalTable{}; }, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                double tm = double(i) * 1e-4;     // 10k packets/sec
+                tbl.advance(tm);
+                const auto& [f, t] = ft[i & (nSamp - 1)];
+                tbl.add(f, t + uint32_t(i / nSamp) * uint32_t(nSamp), tm);
+                if (i >= lag) {
+                    const auto& [g, u] = ft[(i - lag) & (nSamp - 1)];
+                    double v = tbl.getUnused(g, u + uint32_t((i - lag) / nSamp) * uint32_t(nSamp));
+                    keep(v);
+                }
+            }
+        });
+    }
+}
+
+// run dlyloc on a capture 3 times and report the fastest
+static int endToEnd(int argc, char* const* argv)
+{
+    const char* prog = argv[0];
+    const char* fname = argv[1];
+    pcapFile pf;
+    if (!pf.open(fname)) {
+        fprintf(stderr, "can't read %s: %s\n", fname, pf._err.c_str());
+        return 1;
+    }
+    uint64_t pkts = 0;
+    pf.walk(pf.first(), pf.size(), [&pkts](const uint8_t*, uint32_t, uint32_t, int64_t, int64_t) {
+        pkts++;
+        return true;
+    });
+    pf.close();
+
+    std::vector<const char*> args{prog, "-q", "-m", "-r", fname};
+    for (int i = 2; i < argc; i++) {
+        args.push_back(argv[i]);
+    }
+    args.push_back(nullptr);
+    double best = 1e30, bestCpu = 0.;
+    for (int r = 0; r < 3; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int fd = open("/dev/null", O_WRONLY);
+            dup2(fd, STDOUT_FILENO);
+            execv(prog, (char* const*)args.data());
+            perror(prog);
+            _exit(127);
+        }
+        int st;
+        struct rusage ru;
+        if (pid < 0 || wait4(pid, &st, 0, &ru) < 0 || !WIFEXITED(st) || WEXITSTATUS(st) != 0) {
+            fprintf(stderr, "%s failed\n", prog);
+            return 1;
+        }
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+        double cpu = double(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+                     double(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+        if (dt.count() < best) {
+            best = dt.count();
+            bestCpu = cpu;
+        }
+    }
+    printf("end to end: %" PRIu64 " packets in %.3fs: %.0f pkts/s, %.1f ns/pkt (cpu %.1f ns/pkt)\n",
+           pkts, best, double(pkts) / best, best * 1e9 / double(pkts), bestCpu * 1e9 / double(pkts));
+    return 0;
+}
+
+int main(int argc, char* const* argv)
+{
+    for (int c; (c = getopt(argc, argv, "+n:e")) != -1; ) {
+        switch (c) {
+        case 'n': scale = atof(optarg); break;
+        case 'e':
+            if (argc - optind < 2) {
+                fprintf(stderr, "usage: %s -e dlyloc file.pcap [dlyloc args]\n", argv[0]);
+                return 1;
+            }
+            return endToEnd(argc - optind, argv + optind);
+        default:
+            fprintf(stderr, "usage: %s [-n scale] | -e dlyloc file.pcap [dlyloc args]\n", argv[0]);
+            return 1;
+        }
+    }
+    microBenches();
+    return 0;
+}
@@ -0,0 +1,618 @@
+/*
+ * dlycollect - combine the output of dlyloc at several capture points (CPs)
+ *
+ * Each dlyloc sends its binary records (dlyloc --send tcp:host:port or
+ * udp:host:port, see outWriter.hpp) to the collector, or the collector
+ * reads files of them (dlyloc -b) merged in capture time order. A
+ * packet carries the same TSval past every CP so records are lined up
+ * per flow on TSval, not on the CPs' clocks: the first record of each
+ * (flow, TSval) from each CP goes into a group that's put out once every
+ * CP that has reported the flow is in it or once it's -w seconds old
+ * (groups seen by one CP are dropped).
+ *
+ * A record's rtt is from its CP to the flow's source and back, so a
+ * flow's CPs are put in path order (outward from the source) by their
+ * min rtt. Each group becomes a line attributing delay to the path
+ * segments between the source and the CPs:
+ *
+ *   <capture time> <flow> src><cp1> <dv1> <rtt> <cp1>><cp2> <ddv> <drtt> ...
+ *
+ * dv1 and rtt are cp1's (source to cp1 delay variation, cp1 to source
+ * round trip), then for each following CP the change in dv1 and rtt from
+ * the previous one: the delay variation and the round trip time of that
+ * segment. Values are seconds, '-' when not computed at both ends.
+ * Groups are keyed in a hash table and expire from a timer wheel driven
+ * by the latest capture time seen, so state is only kept for TSvals not
+ * yet reported by all of a flow's CPs.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#include <getopt.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <algorithm>
+#include <bit>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "./flowKey.hpp"
+#include "./pktRec.hpp"
+#include "./outWriter.hpp"
+#include "./timerWheel.hpp"
+
+static constexpr size_t recSize = outWriter::binRecSize;
+static constexpr int maxCPs = 64;
+static double window = 2.;          // seconds to wait for all of a flow's CPs
+static bool quiet;
+
+static inline uint64_t getLE(const uint8_t* p, int n)
+{
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static std::vector<std::string> cpNames;
+static std::unordered_map<std::string, int> cpIdx;
+
+// index of the CP called 'name' (-1 if there are too many)
+static int cpOf(const std::string& name)
+{
+    if (auto it = cpIdx.find(name); it != cpIdx.end()) {
+        return it->second;
+    }
+    if (cpNames.size() == maxCPs) {
+        std::cerr << "more than " << maxCPs << " capture points, ignoring " << name << "\n";
+        return -1;
+    }
+    cpNames.push_back(name);
+    return cpIdx[name] = int(cpNames.size() - 1);
+}
+
+struct collector {
+    struct sample {
+        uint8_t cp;
+        int64_t tm;         // capture time (us since epoch)
+        int32_t rtt, dv1;   // us or -1
+    };
+    struct flowSt {
+        flowKey fk;
+        uint64_t cps{};     // CPs that have reported the flow
+        std::vector<std::pair<uint8_t, int32_t>> minRtt;    // (cp, us)
+    };
+    struct group {
+        uint64_t gen;
+        uint64_t cps{};
+        std::vector<sample> s;
+    };
+
+    std::unordered_map<flowKey, uint32_t, flowKeyHash> _flowIdx;
+    std::vector<flowSt> _flows;
+    std::unordered_map<uint64_t, group> _groups;    // by flow index << 32 | TSval
+    timerWheel<std::pair<uint64_t, uint64_t>> _due{1. / 64};   // (key, gen)
+    uint64_t _gen{};
+    int64_t _now{-1};       // latest capture time seen (us)
+    outWriter _out;
+    uint64_t nRecs{}, nFull{}, nPartial{}, nSingle{};
+
+    uint32_t flow(const flowKey& fk) {
+        auto [it, isNew] = _flowIdx.try_emplace(fk, uint32_t(_flows.size()));
+        if (isNew) {
+            _flows.push_back({fk});
+        }
+        return it->second;
+    }
+
+    void add(int cp, uint32_t fi, int64_t tm, uint32_t tsval, int32_t rtt, int32_t dv1) {
+        nRecs++;
+        advance(tm);
+        flowSt& f = _flows[fi];
+        uint64_t bit = uint64_t(1) << cp;
+        f.cps |= bit;
+        if (rtt >= 0) {
+            auto m = std::find_if(f.minRtt.begin(), f.minRtt.end(), [cp](auto& e) { return e.first == cp; });
+            if (m == f.minRtt.end()) {
+                f.minRtt.emplace_back(uint8_t(cp), rtt);
+            } else if (rtt < m->second) {
+                m->second = rtt;
+            }
+        }
+        uint64_t key = uint64_t(fi) << 32 | tsval;
+        auto [it, isNew] = _groups.try_emplace(key);
+        group& g = it->second;
+        if (isNew) {
+            g.gen = ++_gen;
+            _due.add(double(tm) * 1e-6 + window, {key, g.gen});
+        }
+        if (g.cps & bit) {
+            return;         // (only a TSval's first record at each CP)
+        }
+        g.cps |= bit;
+        g.s.push_back({uint8_t(cp), tm, rtt, dv1});
+        if (std::popcount(g.cps) >= 2 && g.cps == f.cps) {
+            nFull++;
+            emit(f, g);
+            _groups.erase(it);
+        }
+    }
+
+    // move to capture time 'tm' (us), putting out groups that are due
+    void advance(int64_t tm) {
+        if (_now < 0) {
+            _due.start(double(tm) * 1e-6);
+        }
+        if (tm <= _now) {
+            return;
+        }
+        _now = tm;
+        _due.advance(double(tm) * 1e-6, [this](const std::pair<uint64_t, uint64_t>& e) { expire(e); });
+    }
+
+    // end of input: put out everything left
+    void finish() {
+        std::vector<std::pair<uint64_t, uint64_t>> left;
+        for (const auto& [k, g] : _groups) {
+            left.emplace_back(k, g.gen);
+        }
+        std::sort(left.begin(), left.end(), [](auto& a, auto& b) { return a.second < b.second; });
+        for (const auto& e : left) {
+            expire(e);
+        }
+        _out.flush();
+    }
+
+    void flush() { _out.flush(); }
+
+  private:
+    void expire(const std::pair<uint64_t, uint64_t>& e) {
+        auto it = _groups.find(e.first);
+        if (it == _groups.end() || it->second.gen != e.second) {
+            return;         // (put out when complete)
+        }
+        if (std::popcount(it->second.cps) >= 2) {
+            nPartial++;
+            emit(_flows[e.first >> 32], it->second);
+        } else {
+            nSingle++;
+        }
+        _groups.erase(it);
+    }
+
+    static char* fmtUs(char* p, int64_t v, bool ok) {
+        if (!ok) {
+            *p++ = '-';
+            return p;
+        }
+        return fmtFixed(p, double(v) * 1e-6, 6);
+    }
+
+    void emit(const flowSt& f, group& g) {
+        auto rttOf = [&f](int cp) {
+            for (const auto& [c, r] : f.minRtt) {
+                if (c == cp) {
+                    return int64_t(r);
+                }
+            }
+            return int64_t(INT32_MAX) + cp;     // (no rtt yet: last, in CP order)
+        };
+        std::sort(g.s.begin(), g.s.end(), [&](const sample& a, const sample& b) {
+            return rttOf(a.cp) < rttOf(b.cp) || (rttOf(a.cp) == rttOf(b.cp) && a.cp < b.cp);
+        });
+        char b[outWriter::maxRec];
+        char* p = fmtUInt(b, uint64_t(g.s[0].tm / 1000000));
+        *p++ = '.';
+        int us = int(g.s[0].tm % 1000000);
+        for (int i = 5; i >= 0; i--) {
+            p[i] = char('0' + us % 10);
+            us /= 10;
+        }
+        p += 6;
+        *p++ = ' ';
+        p = fmtFlow(p, f.fk);
+        _out.text(b, p - b);
+        for (size_t i = 0; i < g.s.size(); i++) {
+            const sample& s = g.s[i];
+            const std::string& to = cpNames[s.cp];
+            const std::string& from = i ? cpNames[g.s[i - 1].cp] : "src";
+            p = b;
+            *p++ = ' ';
+            size_t n = std::min<size_t>(from.size(), 48);
+            memcpy(p, from.data(), n);
+            p += n;
+            *p++ = '>';
+            n = std::min<size_t>(to.size(), 48);
+            memcpy(p, to.data(), n);
+            p += n;
+            *p++ = ' ';
+            if (i == 0) {
+                p = fmtUs(p, s.dv1, s.dv1 >= 0);
+                *p++ = ' ';
+                p = fmtUs(p, s.rtt, s.rtt >= 0);
+            } else {
+                const sample& r = g.s[i - 1];
+                p = fmtUs(p, int64_t(s.dv1) - r.dv1, s.dv1 >= 0 && r.dv1 >= 0);
+                *p++ = ' ';
+                p = fmtUs(p, int64_t(s.rtt) - r.rtt, s.rtt >= 0 && r.rtt >= 0);
+            }
+            _out.text(b, p - b);
+        }
+        _out.text("\n", 1);
+    }
+};
+static collector coll;
+
+/*
+ * Decoding of a sender's records. A source is a TCP connection, a UDP
+ * sender or a file. Flow ids are the sender's own so each source maps
+ * them to the collector's flows.
+ */
+struct source {
+    std::string name;           // CP name until the sender names itself
+    int cp{-1};
+    bool hdr{};                 // file header seen
+    std::vector<uint32_t> fids; // sender's flow id -> collector flow index + 1
+    bool badId{};               // (warned about an out of range flow id)
+    std::string part;           // (stream) bytes of an incomplete record
+
+    explicit source(std::string n) : name{std::move(n)} {}
+
+    // the records at p (n bytes)
+    void records(const uint8_t* p, size_t n) {
+        for (; n >= recSize; p += recSize, n -= recSize) {
+            record(p);
+        }
+    }
+
+    // a file header if there's one at p. Returns its size or 0 if bad.
+    static size_t header(const uint8_t* p, size_t n) {
+        return n >= 8 && memcmp(p, "DLYB", 4) == 0 && getLE(p + 6, 2) == recSize ? 8 : 0;
+    }
+
+    // one datagram: a header then records. Returns false if it isn't dlyloc's.
+    bool block(const uint8_t* p, size_t n) {
+        size_t h = header(p, n);
+        if (h == 0) {
+            return false;
+        }
+        records(p + h, n - h);
+        return true;
+    }
+
+    // the next bytes of a stream. Returns false if they aren't dlyloc's.
+    bool stream(const uint8_t* p, size_t n) {
+        part.append((const char*)p, n);
+        size_t o = 0;
+        if (!hdr) {
+            if (part.size() < 8) {
+                return true;
+            }
+            if ((o = header((const uint8_t*)part.data(), part.size())) == 0) {
+                return false;
+            }
+            hdr = true;
+        }
+        size_t e = o + (part.size() - o) / recSize * recSize;
+        records((const uint8_t*)part.data() + o, e - o);
+        part.erase(0, e);
+        return true;
+    }
+
+    void record(const uint8_t* p) {
+        uint32_t id = uint32_t(getLE(p + 4, 4));
+        switch (p[0]) {
+        case 1: {
+            flowKey fk;
+            fk.src.setV6(p + 8);
+            fk.dst.setV6(p + 24);
+            fk.sport = uint16_t(getLE(p + 40, 2));
+            fk.dport = uint16_t(getLE(p + 42, 2));
+            if (id == 0 || id > outWriter::maxFlowId) {
+                if (!badId) {
+                    std::cerr << name << ": flow id " << id << " out of range, dropping its records\n";
+                    badId = true;
+                }
+                break;
+            }
+            if (id >= fids.size()) {
+                fids.resize(id + 1);
+            }
+            fids[id] = coll.flow(fk) + 1;
+            break;
+        }
+        case 2: {
+            if (id >= fids.size() || fids[id] == 0) {
+                break;      // (flow record lost)
+            }
+            if (cp < 0 && (cp = cpOf(name)) < 0) {
+                break;
+            }
+            bool rttOk = p[1] & 1;
+            coll.add(cp, fids[id] - 1, int64_t(getLE(p + 8, 8)), uint32_t(getLE(p + 44, 4)),
+                     rttOk ? int32_t(getLE(p + 16, 4)) : -1, int32_t(getLE(p + 36, 4)));
+            break;
+        }
+        case 3:
+            name = std::string((const char*)p + 4, strnlen((const char*)p + 4, 44));
+            cp = cpOf(name);
+            break;
+        }
+    }
+};
+
+/*
+ * Files are mapped and their records fed to the collector merged in
+ * capture time order (as if they were arriving live).
+ */
+struct fileSrc {
+    source src;
+    const uint8_t* base{};
+    size_t size{}, off{};
+
+    explicit fileSrc(const std::string& fname) : src{fname} {}
+
+    // process records up to the next data record; its capture time or INT64_MAX at the end
+    int64_t next() {
+        while (off + recSize <= size && base[off] != 2) {
+            src.record(base + off);
+            off += recSize;
+        }
+        return off + recSize <= size ? int64_t(getLE(base + off + 8, 8)) : INT64_MAX;
+    }
+};
+
+static void runFiles(const std::vector<std::string>& names)
+{
+    std::vector<std::unique_ptr<fileSrc>> files;
+    for (const auto& n : names) {
+        auto f = std::make_unique<fileSrc>(n);
+        int fd = open(n.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            std::cerr << "Couldn't open " << n << ": " << strerror(errno) << "\n";
+            exit(1);
+        }
+        f->size = st.st_size;
+        void* m = f->size ? mmap(nullptr, f->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (m == MAP_FAILED || (f->off = source::header((const uint8_t*)m, f->size)) == 0) {
+            std::cerr << n << " isn't a dlyloc binary (-b) file\n";
+            exit(1);
+        }
+        f->base = (const uint8_t*)m;
+        madvise(m, f->size, MADV_SEQUENTIAL);
+        files.push_back(std::move(f));
+    }
+    using ent = std::pair<int64_t, size_t>;
+    std::priority_queue<ent, std::vector<ent>, std::greater<ent>> q;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (int64_t t = files[i]->next(); t != INT64_MAX) {
+            q.emplace(t, i);
+        }
+    }
+    while (!q.empty()) {
+        size_t i = q.top().second;
+        q.pop();
+        fileSrc& f = *files[i];
+        f.src.record(f.base + f.off);
+        f.off += recSize;
+        if (int64_t t = f.next(); t != INT64_MAX) {
+            q.emplace(t, i);
+        }
+    }
+    for (auto& f : files) {
+        munmap((void*)f->base, f->size);
+    }
+}
+
+/*
+ * Live: TCP connections and UDP datagrams on one port. When no records
+ * arrive, capture time is moved on by wall clock time so groups still
+ * expire.
+ */
+static volatile sig_atomic_t stop;
+
+static int listenOn(const char* port, int type)
+{
+    struct addrinfo hints{}, *res;
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = type;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(nullptr, port, &hints, &res) != 0) {
+        hints.ai_family = AF_INET;
+        if (int e = getaddrinfo(nullptr, port, &hints, &res); e != 0) {
+            std::cerr << "port " << port << ": " << gai_strerror(e) << "\n";
+            exit(1);
+        }
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    int on = 1, off = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (res->ai_family == AF_INET6) {
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    }
+    if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
+        (type == SOCK_STREAM && listen(fd, 64) < 0)) {
+        std::cerr << "Couldn't listen on port " << port << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    if (type == SOCK_DGRAM) {
+        int sz = 8 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static std::string peerName(const struct sockaddr_storage& a)
+{
+    char h[NI_MAXHOST], s[NI_MAXSERV];
+    if (getnameinfo((const struct sockaddr*)&a, sizeof(a), h, sizeof(h), s, sizeof(s),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        return "?";
+    }
+    return std::string(h) + ":" + s;
+}
+
+static int64_t wallUs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return int64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static void runLive(const char* port)
+{
+    int tl = listenOn(port, SOCK_STREAM);
+    int ul = listenOn(port, SOCK_DGRAM);
+    std::vector<struct pollfd> pfd{{tl, POLLIN, 0}, {ul, POLLIN, 0}};
+    std::vector<std::unique_ptr<source>> conns(2);      // (parallel to pfd)
+    std::unordered_map<std::string, std::unique_ptr<source>> udpSrcs;
+    std::vector<uint8_t> buf(1 << 16);
+    int64_t lastRec = -1, lastWall = 0;
+    while (!stop) {
+        if (poll(pfd.data(), pfd.size(), 100) < 0 && errno != EINTR) {
+            break;
+        }
+        uint64_t n0 = coll.nRecs;
+        if (pfd[0].revents & POLLIN) {
+            struct sockaddr_storage a;
+            socklen_t al = sizeof(a);
+            if (int fd = accept(tl, (struct sockaddr*)&a, &al); fd >= 0) {
+                pfd.push_back({fd, POLLIN, 0});
+                conns.push_back(std::make_unique<source>(peerName(a)));
+            }
+        }
+        if (pfd[1].revents & POLLIN) {
+            struct sockaddr_storage a;
+            socklen_t al;
+            ssize_t n;
+            while (al = sizeof(a), (n = recvfrom(ul, buf.data(), buf.size(), MSG_DONTWAIT,
+                                                 (struct sockaddr*)&a, &al)) > 0) {
+                std::string pn = peerName(a);
+                auto& s = udpSrcs[pn];
+                if (!s) {
+                    s = std::make_unique<source>(pn);
+                }
+                s->block(buf.data(), size_t(n));
+            }
+        }
+        for (size_t i = 2; i < pfd.size(); i++) {
+            if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t n = read(pfd[i].fd, buf.data(), buf.size());
+            if (n > 0 && conns[i]->stream(buf.data(), size_t(n))) {
+                continue;
+            }
+            if (n != 0 && !quiet) {
+                std::cerr << conns[i]->name << ": " << (n < 0 ? strerror(errno) : "not dlyloc records") << "\n";
+            }
+            close(pfd[i].fd);
+            pfd.erase(pfd.begin() + i);
+            conns.erase(conns.begin() + i);
+            i--;
+        }
+        int64_t w = wallUs();
+        if (coll.nRecs != n0) {
+            lastRec = coll._now;
+            lastWall = w;
+        } else if (lastRec >= 0) {
+            coll.advance(lastRec + (w - lastWall));
+        }
+        coll.flush();
+    }
+}
+
+static void usage(const char* pname)
+{
+    std::cerr << "usage: " << pname << " [-w secs] [-q] -l port | file.dlyb ...\n"
+"  -l port        receive records from dlyloc --send on this TCP and UDP port\n"
+"  file.dlyb ...  read records from dlyloc -b output files\n"
+"  -w secs        how long to wait for all of a flow's CPs to report a TSval\n"
+"                 (default 2). Should cover the differences in CP clocks and\n"
+"                 in the delay to the collector.\n"
+"  -q             no summary on stderr\n";
+}
+
+int main(int argc, char* const* argv)
+{
+    const char* port = nullptr;
+    for (int c; (c = getopt(argc, argv, "l:w:qh")) != -1; ) {
+        switch (c) {
+        case 'l': port = optarg; break;
+        case 'w': window = atof(optarg); break;
+        case 'q': quiet = true; break;
+        default: usage(argv[0]); exit(c != 'h');
+        }
+    }
+    std::vector<std::string> files(argv + optind, argv + argc);
+    if ((port == nullptr) == files.empty() || window <= 0.) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (port) {
+        signal(SIGINT, [](int) { stop = 1; });
+        signal(SIGTERM, [](int) { stop = 1; });
+        signal(SIGPIPE, SIG_IGN);
+        runLive(port);
+    } else {
+        runFiles(files);
+    }
+    coll.finish();
+    if (!quiet) {
+        std::cerr << coll.nRecs << " records from " << cpNames.size() << " capture points, "
+                  << coll._flows.size() << " flows, " << coll.nFull << " complete and "
+                  << coll.nPartial << " partial TSval groups, " << coll.nSingle
+                  << " seen at one CP\n";
+    }
+}
@@ -0,0 +1,325 @@
+/*
+ * dlygen - synthetic TCP timestamp traffic for testing and benchmarking dlyloc
+ *
+ * Writes a pcap file of N bi-directional flows as seen from a capture
+ * point (CP) between clients and servers. Per flow:
+ *  - each endpoint's TSval clock ticks at 1ms or 1us (-u sets the fraction
+ *    of endpoints with us ticks) from a random start, or (-w) from just
+ *    below 2^32 so it wraps early in the capture
+ *  - the CP to server and back RTT is drawn from the -R range and the
+ *    client to CP delay is a fraction of it
+ *  - queueing episodes (-q) build a client to CP queue up to the given
+ *    max over a couple of seconds and then drain it
+ *  - clients send data at about -p packets/sec; the server acks each one
+ *    (or every -a'th, echoing the first unacked segment's TSval)
+ * Frames are Ethernet + IPv4 (IPv6 for every 5th flow) + TCP with only a
+ * timestamp option, captured without payload. Output is the same for the
+ * same arguments and seed.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static int nFlows = 100;
+static double duration = 60.;       // seconds
+static double pktRate = 100.;       // data packets/sec per flow
+static double usFrac = 0.;          // fraction of endpoints with us TSval ticks
+static double wrapFrac = 0.;        // fraction of endpoints whose TSval wraps
+static double rttMin = 0.010, rttMax = 0.100;
+static double queueMax = 0.;        // max queueing delay (0 = no queueing episodes)
+static int ackEvery = 1;            // server acks every n data segments
+static uint64_t seed = 1;
+
+static std::mt19937_64 rng;
+static double uniform(double lo = 0., double hi = 1.)     // (same on every platform)
+{
+    return lo + (hi - lo) * double(rng() >> 11) * 0x1.0p-53;
+}
+
+struct endpt {
+    uint32_t base;      // TSval at time 0
+    double hz;          // TSval ticks per second
+    uint32_t tsval(double t) const { return base + uint32_t(uint64_t(t * hz)); }
+};
+
+struct flowSpec {
+    bool v6;
+    uint32_t cAddr, sAddr;
+    uint16_t cPort, sPort;
+    endpt cli, srv;
+    double dCli;        // client to CP
+    double dSrv;        // CP to server (and the same back)
+    double qPeriod, qPhase;
+};
+
+struct event {
+    double tm;          // capture time
+    uint32_t flow;
+    bool fromSrv;
+    bool syn;
+    uint32_t tsval, ecr;
+    uint32_t seq, ack;
+};
+
+// queueing delay for a packet leaving the client at 't'
+static double queueDly(const flowSpec& f, double t)
+{
+    if (queueMax <= 0.) {
+        return 0.;
+    }
+    // a 3 second episode (2s build, 1s drain) once a period
+    double p = fmod(t + f.qPhase, f.qPeriod);
+    if (p < 2.) {
+        return queueMax * p / 2.;
+    }
+    if (p < 3.) {
+        return queueMax * (3. - p);
+    }
+    return 0.;
+}
+
+static endpt mkEndpt()
+{
+    endpt e;
+    e.hz = uniform() < usFrac ? 1e6 : 1e3;
+    if (uniform() < wrapFrac) {
+        // wrap 1 to 5 seconds in
+        e.base = uint32_t(0x100000000ull - uint64_t(uniform(1., 5.) * e.hz));
+    } else {
+        e.base = uint32_t(rng());
+    }
+    return e;
+}
+
+static void genFlow(uint32_t fi, const flowSpec& f, std::vector<event>& ev)
+{
+    std::deque<std::pair<double, uint32_t>> acks;   // (arrival at client, server TSval)
+    uint32_t ecr = 0;
+    uint32_t cseq = fi * 2654435761u, sseq = ~cseq;
+    int unacked = 0;
+    uint32_t recent = 0;        // TSval the server echoes
+    double t = uniform(0., 1. / pktRate);
+    for (bool first = true; t < duration; first = false) {
+        while (!acks.empty() && acks.front().first <= t) {
+            ecr = acks.front().second;
+            acks.pop_front();
+        }
+        uint32_t tsc = f.cli.tsval(t);
+        double cp1 = t + f.dCli + queueDly(f, t);
+        ev.push_back({cp1, fi, false, first, tsc, first ? 0 : ecr, cseq, first ? 0 : sseq});
+        cseq += first ? 1 : 1448;
+        if (unacked++ == 0) {
+            recent = tsc;
+        }
+        if (first || unacked >= ackEvery) {
+            double atSrv = cp1 + f.dSrv;
+            uint32_t tss = f.srv.tsval(atSrv);
+            double cp2 = atSrv + f.dSrv + uniform(0., 0.0002);
+            ev.push_back({cp2, fi, true, false, tss, recent, sseq, cseq});
+            acks.emplace_back(cp2 + f.dCli, tss);
+            unacked = 0;
+        }
+        t += uniform(0.5, 1.5) / pktRate;
+    }
+}
+
+static void put16(uint8_t*& p, uint16_t v) { v = htons(v); memcpy(p, &v, 2); p += 2; }
+static void put32(uint8_t*& p, uint32_t v) { v = htonl(v); memcpy(p, &v, 4); p += 4; }
+
+// build the frame for 'e' in 'b', returning the captured length
+static size_t frame(const flowSpec& f, const event& e, uint8_t* b, uint32_t& wireLen)
+{
+    static const uint8_t v6pfx[12] = {0x20, 0x01, 0x0d, 0xb8};
+    uint32_t payload = e.fromSrv || e.syn ? 0 : 1448;
+    uint8_t* p = b;
+    memset(p, 0, 6);
+    memset(p + 6, 1, 6);
+    p += 12;
+    put16(p, f.v6 ? 0x86dd : 0x0800);
+    uint32_t src = e.fromSrv ? f.sAddr : f.cAddr;
+    uint32_t dst = e.fromSrv ? f.cAddr : f.sAddr;
+    const uint16_t tcpLen = 32;
+    if (f.v6) {
+        put32(p, 6u << 28);
+        put16(p, tcpLen + payload);
+        *p++ = 6;       // next header
+        *p++ = 64;      // hop limit
+        memcpy(p, v6pfx, 12);
+        p += 12;
+        put32(p, src);
+        memcpy(p, v6pfx, 12);
+        p += 12;
+        put32(p, dst);
+    } else {
+        *p++ = 0x45;
+        *p++ = 0;
+        put16(p, 20 + tcpLen + payload);
+        put32(p, 0);
+        *p++ = 64;
+        *p++ = 6;
+        put16(p, 0);
+        put32(p, src);
+        put32(p, dst);
+    }
+    put16(p, e.fromSrv ? f.sPort : f.cPort);
+    put16(p, e.fromSrv ? f.cPort : f.sPort);
+    put32(p, e.seq);
+    put32(p, e.ack);
+    *p++ = (tcpLen / 4) << 4;
+    *p++ = e.syn ? 0x02 : 0x10;
+    put16(p, 65535);
+    put32(p, 0);        // checksum, urgent pointer
+    *p++ = 1;           // NOP, NOP, timestamp
+    *p++ = 1;
+    *p++ = 8;
+    *p++ = 10;
+    put32(p, e.tsval);
+    put32(p, e.ecr);
+    wireLen = uint32_t(p - b) + payload;
+    return p - b;
+}
+
+static void usage(const char* pname)
+{
+    std::cerr << "usage: " << pname << " [flags] -o file.pcap\n"
+"  -n flows       number of bi-directional flows (default 100)\n"
+"  -d secs        capture duration (default 60)\n"
+"  -p rate        data packets/sec per flow (default 100)\n"
+"  -u frac        fraction of endpoints with 1us TSval ticks (default 0: all 1ms)\n"
+"  -w frac        fraction of endpoints whose TSval wraps in the first seconds\n"
+"  -R min,max     CP to server RTT range in ms (default 10,100)\n"
+"  -q ms          max queueing delay of periodic episodes (default 0: none)\n"
+"  -a n           server acks every n data segments (default 1)\n"
+"  -s seed        random seed (default 1)\n";
+}
+
+int main(int argc, char* const* argv)
+{
+    std::string fname;
+    for (int c; (c = getopt(argc, argv, "n:d:p:u:w:R:q:a:s:o:h")) != -1; ) {
+        switch (c) {
+        case 'n': nFlows = atoi(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'p': pktRate = atof(optarg); break;
+        case 'u': usFrac = atof(optarg); break;
+        case 'w': wrapFrac = atof(optarg); break;
+        case 'R':
+            if (sscanf(optarg, "%lf,%lf", &rttMin, &rttMax) != 2 || rttMin > rttMax) {
+                usage(argv[0]);
+                exit(1);
+            }
+            rttMin *= 1e-3;
+            rttMax *= 1e-3;
+            break;
+        case 'q': queueMax = atof(optarg) * 1e-3; break;
+        case 'a': ackEvery = std::max(1, atoi(optarg)); break;
+        case 's': seed = strtoull(optarg, nullptr, 0); break;
+        case 'o': fname = optarg; break;
+        default: usage(argv[0]); exit(c != 'h');
+        }
+    }
+    if (fname.empty() || nFlows < 1 || pktRate <= 0.) {
+        usage(argv[0]);
+        exit(1);
+    }
+    rng.seed(seed);
+
+    std::vector<flowSpec> flows(nFlows);
+    std::vector<event> ev;
+    ev.reserve(size_t(2. * nFlows * pktRate * duration * 1.05));
+    for (int i = 0; i < nFlows; i++) {
+        flowSpec& f = flows[i];
+        f.v6 = i % 5 == 4;
+        f.cAddr = (10u << 24) + i + 1;
+        f.sAddr = (192u << 24) + (168u << 16) + i + 1;
+        f.cPort = uint16_t(32768 + i % 28000);
+        f.sPort = 443;
+        f.cli = mkEndpt();
+        f.srv = mkEndpt();
+        double rtt = uniform(rttMin, rttMax);
+        f.dSrv = rtt / 2.;
+        f.dCli = rtt * uniform(0.05, 0.5);
+        f.qPeriod = uniform(10., 30.);
+        f.qPhase = uniform(0., f.qPeriod);
+        genFlow(i, f, ev);
+    }
+    std::sort(ev.begin(), ev.end(), [](const event& a, const event& b) {
+        return a.tm < b.tm || (a.tm == b.tm && a.flow < b.flow);
+    });
+
+    FILE* fo = fopen(fname.c_str(), "wb");
+    if (fo == nullptr) {
+        perror(fname.c_str());
+        exit(1);
+    }
+    // little-endian pcap, us timestamps, Ethernet
+    const uint32_t hdr[6] = {0xa1b2c3d4, 2 | (4 << 16), 0, 0, 65535, 1};
+    uint8_t buf[16 + 128];
+    fwrite(hdr, sizeof(hdr), 1, fo);
+    const double t0 = 1700000000.;
+    for (const auto& e : ev) {
+        uint32_t wl;
+        size_t cl = frame(flows[e.flow], e, buf + 16, wl);
+        double ts = t0 + e.tm;
+        uint32_t rh[4] = {uint32_t(ts), uint32_t(llround((ts - floor(ts)) * 1e6)),
+                          uint32_t(cl), wl};
+        if (rh[1] >= 1000000) {
+            rh[0]++;
+            rh[1] -= 1000000;
+        }
+        memcpy(buf, rh, sizeof(rh));
+        fwrite(buf, 16 + cl, 1, fo);
+    }
+    if (fclose(fo) != 0) {
+        perror(fname.c_str());
+        exit(1);
+    }
+    std::cerr << ev.size() << " packets in " << nFlows << " flows\n";
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * dlyloc.bpf.c: XDP pre-filter for dlyloc
+ *
+ * Runs on every frame received by the interface, extracts what dlyloc
+ * uses from TCP packets with the timestamp option and pushes a compact
+ * xdpRec to userspace through a BPF ring buffer. Packets that repeat
+ * their flow's last TSval and ECR carry no new information for dlyloc
+ * (computeTicks ignores repeat TSvals and only the first ECR match
+ * counts) so they're only counted. Every frame is passed on to the
+ * stack untouched (XDP_PASS) so this is purely an observer.
+ *
+ * Build with 'make xdp' (needs clang with the bpf target and libbpf
+ * headers).
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "xdpRec.h"
+
+#define MAX_VLANS 2
+#define MAX_OPTS 20     // tcp options examined looking for TS
+
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 1 << 24);
+} records SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 1 << 18);
+    __type(key, struct xdpFlowKey);
+    __type(value, struct xdpFlowVal);
+} flows SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, xdpStatCnt);
+    __type(key, __u32);
+    __type(value, __u64);
+} stats SEC(".maps");
+
+static __always_inline void count(__u32 i)
+{
+    __u64* c = bpf_map_lookup_elem(&stats, &i);
+    if (c) {
+        (*c)++;
+    }
+}
+
+// find the TS option. Returns 0 and sets tsval/ecr if found.
+static __always_inline int findTS(__u8* p, __u8* end, void* data_end, __u32* tsval, __u32* ecr)
+{
+    for (int i = 0; i < MAX_OPTS; i++) {
+        if (p + 1 > end || (void*)(p + 1) > data_end) {
+            return -1;
+        }
+        __u8 kind = p[0];
+        if (kind == 0) {
+            return -1;
+        }
+        if (kind == 1) {
+            p++;
+            continue;
+        }
+        if (p + 2 > end || (void*)(p + 2) > data_end) {
+            return -1;
+        }
+        __u8 len = p[1];
+        if (len < 2) {
+            return -1;
+        }
+        if (kind == 8 && len == 10) {
+            if (p + 10 > end || (void*)(p + 10) > data_end) {
+                return -1;
+            }
+            *tsval = bpf_ntohl(*(__u32*)(p + 2));
+            *ecr = bpf_ntohl(*(__u32*)(p + 6));
+            return 0;
+        }
+        p += len;
+    }
+    return -1;
+}
+
+SEC("xdp")
+int dlyloc_xdp(struct xdp_md* ctx)
+{
+    void* data = (void*)(long)ctx->data;
+    void* data_end = (void*)(long)ctx->data_end;
+    __u32 flen = data_end - data;
+    struct xdpFlowKey k = {};
+    struct tcphdr* th;
+
+    count(xdpStatPkts);
+    struct ethhdr* eth = data;
+    if ((void*)(eth + 1) > data_end) {
+        return XDP_PASS;
+    }
+    __u16 proto = eth->h_proto;
+    void* l3 = eth + 1;
+#pragma unroll
+    for (int i = 0; i < MAX_VLANS; i++) {
+        if (proto != bpf_htons(ETH_P_8021Q) && proto != bpf_htons(ETH_P_8021AD)) {
+            break;
+        }
+        if (l3 + 4 > data_end) {
+            return XDP_PASS;
+        }
+        proto = *(__u16*)(l3 + 2);
+        l3 += 4;
+    }
+    if (proto == bpf_htons(ETH_P_IP)) {
+        struct iphdr* ip = l3;
+        if ((void*)(ip + 1) > data_end) {
+            return XDP_PASS;
+        }
+        if (ip->protocol != IPPROTO_TCP || (ip->frag_off & bpf_htons(0x1fff))) {
+            count(xdpStatNotTCP);
+            return XDP_PASS;
+        }
+        k.src[10] = k.src[11] = k.dst[10] = k.dst[11] = 0xff;
+        __builtin_memcpy(k.src + 12, &ip->saddr, 4);
+        __builtin_memcpy(k.dst + 12, &ip->daddr, 4);
+        th = l3 + ip->ihl * 4;
+    } else if (proto == bpf_htons(ETH_P_IPV6)) {
+        struct ipv6hdr* ip6 = l3;
+        if ((void*)(ip6 + 1) > data_end) {
+            return XDP_PASS;
+        }
+        if (ip6->nexthdr != IPPROTO_TCP) {     // (extension headers not followed here)
+            count(xdpStatNotTCP);
+            return XDP_PASS;
+        }
+        __builtin_memcpy(k.src, &ip6->saddr, 16);
+        __builtin_memcpy(k.dst, &ip6->daddr, 16);
+        th = (void*)(ip6 + 1);
+    } else {
+        count(xdpStatNotTCP);
+        return XDP_PASS;
+    }
+    if ((void*)(th + 1) > data_end) {
+        return XDP_PASS;
+    }
+    __u32 tsval, ecr;
+    __u8* opts = (__u8*)(th + 1);
+    if (findTS(opts, (__u8*)th + th->doff * 4, data_end, &tsval, &ecr) < 0) {
+        count(xdpStatNoTS);
+        return XDP_PASS;
+    }
+    k.sport = bpf_ntohs(th->source);
+    k.dport = bpf_ntohs(th->dest);
+
+    __u32 len = flen, pkts = 1;
+    struct xdpFlowVal* fv = bpf_map_lookup_elem(&flows, &k);
+    if (fv) {
+        if (fv->tsval == tsval && fv->ecr == ecr) {
+            __sync_fetch_and_add(&fv->len, flen);   // repeat - just count it
+            __sync_fetch_and_add(&fv->pkts, 1);
+            count(xdpStatDups);
+            return XDP_PASS;
+        }
+        len += fv->len;
+        pkts += fv->pkts;
+    }
+    struct xdpRec* r = bpf_ringbuf_reserve(&records, sizeof(*r), 0);
+    if (!r) {
+        count(xdpStatRbFull);       // userspace is behind
+        return XDP_PASS;            // (state left alone so this pair is sent next time)
+    }
+    r->tstamp = bpf_ktime_get_ns();
+    __builtin_memcpy(r->src, k.src, 16);
+    __builtin_memcpy(r->dst, k.dst, 16);
+    r->sport = k.sport;
+    r->dport = k.dport;
+    r->tsval = tsval;
+    r->ecr = ecr;
+    r->len = len;
+    r->pkts = pkts > 0xffff ? 0xffff : pkts;
+    r->flags = ((__u8*)th)[13];
+    r->pad = 0;
+    bpf_ringbuf_submit(r, 0);
+
+    struct xdpFlowVal nv = { tsval, ecr, 0, 0 };
+    bpf_map_update_elem(&flows, &k, &nv, BPF_ANY);
+    return XDP_PASS;
+}
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
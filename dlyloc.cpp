@@ -94,17 +94,53 @@
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <ifaddrs.h>
+#include <netdb.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <pcap.h>
+#include <csignal>
 #include <ctime>
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <cmath>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
 #include "tins/tins.h"
 
+#include "./flowKey.hpp"
+#include "./tsvalTable.hpp"
+#include "./pktRec.hpp"
+#include "./rawParse.hpp"
+#include "./pcapFile.hpp"
+#include "./afPacket.hpp"
+#include "./xdpCapture.hpp"
+#include "./spscRing.hpp"
+#include "./hugeArena.hpp"
+#include "./slabPool.hpp"
+#include "./timerWheel.hpp"
+#include "./outWriter.hpp"
+#include "./colWriter.hpp"
+#include "./digestWriter.hpp"
+#include "./topK.hpp"
 #include "./movingmin.hpp"
+#include "./clockModel.hpp"
+#include "./segRing.hpp"
+#include "./flowTier.hpp"
+#include "./rcu.hpp"
+#include "./ctlSocket.hpp"
+#include "./dvBatch.hpp"
 #include "./flowDelay.hpp"
+#include "./stateFile.hpp"
+#include "./stats.hpp"
 
 using namespace Tins;
 
@@ -113,91 +149,195 @@ static double tsvalMaxAge = 10.;    // limit age of TSvals to use
 static double flowMaxIdle = 300.;   // flow idle time until flow forgotten
 static double sumInt = 10.;         // how often (sec) to print summary line
 static int maxFlows = 10000;
-static int flowCnt;
-static std::unordered_map<std::string, flowDly*> flows;
+static size_t flowMem;          // flow state budget in bytes (0 = use maxFlows)
+static int shardMaxFlows;       // flows per shard from maxFlows or flowMem
 static double time_to_run;      // how many seconds to capture (0=no limit)
 static int maxPackets;          // max packets to capture (0=no limit)
 static int64_t offTm = -1;      // first packet capture time (used to
                                 // avoid precision loss when 52 bit timestamp
                                 // normalized into FP double 47 bit mantissa)
 static bool machineReadable = false; // machine or human readable output
+static bool binaryOut = false;  // binary records instead of text lines
+static outWriter out;           // (stdout)
+static colWriter* colOut;       // columnar output file (--columnar)
+static digestWriter* digOut;    // percentile summaries instead of lines (--digest, --prefix)
+static topkWriter* topOut;      // queueing delay top-K instead of lines (--topk)
+static std::string statsFile;   // Prometheus text file (--stats, STATS=1 builds)
+static std::string sendTo;      // collector to send binary records to (--send)
+static std::string cpName;      // capture point name in binary output (--cpName)
 static double capTm, startm;        // (in seconds)
-static int pktCnt, not_tcp, no_TS, not_v4or6, uniDir;
-static std::string localIP;         // ignore pp through this address
+static int pktCnt, not_tcp, no_TS, not_v4or6;
+static uint64_t pktSeq;             // sequence number of last usable packet
+static ipAddr localIP;              // ignore pp through this address
 static bool filtLocal = true;
 static std::string filter("tcp");    // default bpf filter
 static int64_t flushInt = 1 << 20;  // stdout flush interval (~uS)
 static int64_t nextFlush;       // next stdout flush time (~uS)
+static bool wallFlush = true;   // flush output on wall clock time (not for -r)
+static int nThreads = 1;        // number of flow processing threads (shards)
+static bool seqAck;             // match acks to segments by seq too (--seqack)
+static bool tiered;             // only promoted flows get dv estimation (--tiered, --watch)
+static tierCfg tier;            // promotion thresholds and watch list
+static std::string ctlPath;     // control socket (--control)
+static std::string statePath;   // flow state snapshot file (--state)
+static double stateInt = 60.;   // (wall clock) seconds between snapshots
+static double stateMaxAge = 300.;   // don't restore a snapshot older than this (0 = any age)
+static bool warmStart;          // flow state was restored from a snapshot
+static volatile sig_atomic_t stopReq;   // SIGTERM or SIGINT with --state
 
-// save capture time of packet using its flow + TSval as key.  If key
-// exists, don't change it.  The same TSval may appear on multiple
-// packets so this retains the first (oldest) appearance which may
-// overestimate RTT but won't underestimate. This slight bias may be
-// reduced by adding additional fields to the key (such as packet's
-// ending tcp_seq to match against returned tcp_ack) but this can
-// substantially increase the state burden for a small improvement.
+// single-writer counter increment for counters that are read by the
+// summary from another thread
+template<typename T>
+static inline void bump(std::atomic<T>& c, T n = 1)
+{
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
 
-static std::unordered_map<std::string, double> tsTbl;
+/*
+ * The settings that can be changed through the control socket while
+ * running (--control). The current runCfg is published in an rcuCell
+ * (see rcu.hpp): packet processing reads it with a single load per
+ * packet and the control thread swaps in a changed copy, so neither
+ * ever waits for the other. A change that needs more than reading the
+ * new values is made by the thread that owns the state: the capture
+ * thread sets the filter and summary interval, each shard's thread its
+ * TSval table age and the promotion of existing flows, and the output
+ * thread the output format.
+ */
+struct runCfg {
+    uint64_t gen{};         // changes with every update
+    std::string filter;
+    double tsvalMaxAge;
+    double flowMaxIdle;
+    double sumInt;
+    int shardMaxFlows;
+    outFmt fmt;
+    bool tiered;
+    tierCfg tier;
+};
+static rcuCell<runCfg> cfg;
+static int capRcu = -1, outRcu = -1;    // rcu reader ids of the capture and output threads
 
-static inline void addTS(const std::string& key, double t)
+static inline void quiesce(int r)
 {
-#ifdef __cpp_lib_unordered_map_try_emplace
-    tsTbl.try_emplace(key, t);
-#else
-    if (tsTbl.count(key) == 0) {
-        tsTbl.emplace(key, t);
+    if (r >= 0) {
+        cfg.quiesce(r);
     }
-#endif
 }
 
-// A packet's ECR (timestamp echo reply) should match the TSval of some
-// packet seen earlier in the flow's reverse direction so lookup the
-// capture time recorded above using the reversed flow + ECR as key. If
-// found, the difference between now and capture time of that packet is
-// >= the current RTT. Multiple packets may have the same ECR but the
-// first packet's capture time gives the best RTT estimate so the time
-// in the entry is negated after retrieval to prevent reuse.  The entry
-// can't be deleted yet because TSvals may change on time scales longer
-// than the RTT so a deleted entry could be recreated by a later packet
-// with the same TSval which could match an ECR from an earlier
-// incarnation resulting in a large RTT underestimate.  Table entries
-// are deleted after a time interval (tsvalMaxAge) that should be:
-//  a) longer than the largest time between TSval ticks
-//  b) longer than longest queue wait packets are expected to experience
+// a flow's state as reported through the control socket
+struct flowSum {
+    flowKey fk;
+    double minPP;
+    double qdly;        // latest rtt less minPP (queueing delay), -1 if none
+    double bytes;
+    double lastTm;
+    uint16_t pkts;      // (saturates at UINT16_MAX, shown as "65535+")
+    bool clkSet;
+};
+
+/*
+ * All the flow state lives in a flowShard. With multiple threads each
+ * worker owns one shard and packets are assigned to shards by a hash of
+ * their direction-independent 5-tuple so both directions of a flow are
+ * always in the same shard and shards never need to share anything.
+ */
+#ifdef DLYLOC_STATS
+// instrumented stages. parse and output are timed by the capture and
+// output threads (stageHist), the others by the shard's thread.
+enum statStage { stParse, stExpire, stLookup, stDelay, stTsval, stOutput, nStages };
+static const char* const stageNames[nStages] = {
+    "parse", "expire", "lookup", "delay", "tsval", "output"
+};
+static latHist stageHist[nStages];
+static uint64_t cntTotal[4];    // pktCnt, not_tcp, no_TS, not_v4or6 as of the last reset
+#endif
 
-static inline double getTStm(const std::string& key)
-{
-    try {
-        auto d = tsTbl.at(key);
-        tsTbl[key] = -d;     //mark it negative to indicate it's been used
-        return d;
-    } catch (std::out_of_range) {
-        return -1.;
-    }
-}
-
-static std::string fmtTimeDiff(double dt)
-{
-    const char* SIprefix = "";
-    if (dt < 1e-3) {
-        dt *= 1e6;
-        SIprefix = "u";
-    } else if (dt < 1) {
-        dt *= 1e3;
-        SIprefix = "m";
-    } 
-    const char* fmt;
-    if (dt < 10.) {
-        fmt = "%.2lf%ss";
-    } else if (dt < 100.) {
-        fmt = "%.1lf%ss";
-    } else {
-        fmt = " %.0lf%ss";
+using flowMap = std::unordered_map<flowKey, uint32_t, flowKeyHash, std::equal_to<flowKey>,
+                                   arenaAlloc<std::pair<const flowKey, uint32_t>>>;
+
+struct flowShard {
+    // the shard's tables are in its arena (--hugepages or --numa, see hugeArena.hpp)
+    std::unique_ptr<hugeArena> arena;
+    dvBatch dvb;                    // (a worker's batch of packets, see processBatch)
+    slabPool<flowDly> pool;
+    flowMap flows;                  // (index in pool)
+
+    // save capture time of packet using its flow id + TSval as key.  If key
+    // exists, don't change it.  The same TSval may appear on multiple
+    // packets so this retains the first (oldest) appearance which may
+    // overestimate RTT but won't underestimate. This slight bias may be
+    // reduced by adding additional fields to the key (such as packet's
+    // ending tcp_seq to match against returned tcp_ack) but this can
+    // substantially increase the state burden for a small improvement.
+    tsvalTable tsTbl;
+    uint32_t lastFlowId{};          // flow ids key the tsval table
+    // each flow has an entry (pool index, flow id) that comes due when it
+    // could have been idle for flowMaxIdle
+    timerWheel<std::pair<uint32_t, uint32_t>> idle;
+    uint32_t clockHand{1};          // next pool slot the eviction clock looks at
+    std::atomic<int> flowCnt{};
+    std::atomic<int> uniDir{};
+    std::atomic<int> evicted[3]{};  // by class: uni-directional, unclocked, clocked
+    std::atomic<uint64_t> segMatched{}; // ppings timed by a SEQ/ACK matched segment
+    std::atomic<uint64_t> promoted{};   // flows promoted to dv estimation (--tiered)
+    rttGate rtts;                   // recent pping RTTs (--tiered rtt=P)
+    const runCfg* cfg{};            // settings for the packet being processed
+    uint64_t cfgGen{};              // settings version applied to the shard's state
+    int rcuId{-1};                  // rcu reader id of the shard's thread (-1 = none needed)
+    // flow state dumps for the control socket: the control thread bumps
+    // dumpWant and waits for the shard's thread to fill in 'dump' and set
+    // dumpDone to match
+    std::atomic<uint32_t> dumpWant{}, dumpDone{};
+    std::vector<flowSum> dump;
+    // the same for state snapshots (see stateFile.hpp), 'pts' and 'flow'
+    // indices local to the shard
+    std::atomic<uint32_t> snapWant{}, snapDone{};
+    std::vector<flowState> snapFlows;
+    std::vector<statePt> snapPts;
+    std::vector<tsState> snapTs;
+    int64_t snapOffTm{-1};
+#ifdef DLYLOC_STATS
+    latHist hist[nStages];
+    latHist hullPts;                // lower hull size after each bi-directional packet
+    std::atomic<uint64_t> biPkts{}, clkPkts{};  // packets of bi-directional and of clocked flows
+    // table sizes published by the shard's thread every statPubPkts packets
+    static constexpr uint32_t statPubPkts = 4096;
+    uint32_t statPkts{};
+    std::atomic<size_t> flowBuckets{}, tsEntries{}, tsCap{}, poolBytes{};
+#endif
+
+    explicit flowShard(int node = -1)
+        : arena(hugeArena::on ? new hugeArena(node) : nullptr), pool(arena.get()),
+          flows(flowMap::allocator_type(arena.get())), tsTbl(1 << 16, 10., arena.get()) {}
+
+    void addTS(uint32_t fid, uint32_t tsv, double t) { tsTbl.add(fid, tsv, t); }
+
+    // A packet's ECR (timestamp echo reply) should match the TSval of some
+    // packet seen earlier in the flow's reverse direction so lookup the
+    // capture time recorded above using the reverse flow's id + ECR as key. If
+    // found, the difference between now and capture time of that packet is
+    // >= the current RTT. Multiple packets may have the same ECR but the
+    // first packet's capture time gives the best RTT estimate so the entry
+    // is marked used after retrieval to prevent reuse.  The entry
+    // can't be deleted yet because TSvals may change on time scales longer
+    // than the RTT so a deleted entry could be recreated by a later packet
+    // with the same TSval which could match an ECR from an earlier
+    // incarnation resulting in a large RTT underestimate.  Table entries
+    // expire after a time interval (tsvalMaxAge) that should be:
+    //  a) longer than the largest time between TSval ticks
+    //  b) longer than longest queue wait packets are expected to experience
+    double getTStm(uint32_t fid, uint32_t ecr) { return tsTbl.getUnused(fid, ecr); }
+
+    uint32_t newFlowId() {
+        lastFlowId = (lastFlowId + 1) & tsvalTable::idMask;
+        if (lastFlowId == 0) {
+            lastFlowId = 1;
+        }
+        return lastFlowId;
     }
-    char buf[10];
-    snprintf(buf, sizeof(buf), fmt, dt, SIprefix);
-    return buf;
-}
+};
+static std::vector<std::unique_ptr<flowShard>> shards;
 
 /*
  * return (approximate) time in a 64bit fixed point integer with the
@@ -211,235 +351,2185 @@ static int64_t clock_now(void) {
     return (int64_t(tv.tv_sec) << 20) | tv.tv_usec;
 }
 
-static void processPacket(const Packet& pkt)
+/*
+ * Set pr's capture time from the packet's timestamp and give it the next
+ * sequence number. Capture times are offset by the first packet's time.
+ */
+static void setCapTm(int64_t sec, int64_t usec, pktRec& pr)
+{
+    if (offTm < 0) {
+        std::time_t result = sec;
+        offTm = sec;
+        // fractional part of first usable packet time
+        startm = double(usec) * 1e-6;
+        capTm = startm;
+        if (sumInt) {
+            std::cerr << "First packet at " << std::asctime(std::localtime(&result)) << "\n";
+        }
+    } else {
+        // offset capture time
+        int64_t tt = sec - offTm;
+        capTm = double(tt) + double(usec) * 1e-6;
+        if (warmStart) {
+            // first packet after restoring a snapshot
+            warmStart = false;
+            startm = capTm;
+        }
+    }
+    pr.tm = capTm;
+    pr.seq = ++pktSeq;
+}
+
+/*
+ * Extract the fields dlyloc uses from a packet into a pktRec. Returns
+ * false if the packet isn't usable (it's counted as to why).
+ */
+static bool parsePacket(const Packet& pkt, pktRec& pr)
 {
     pktCnt++;
     // all packets should be TCP since that's in config
     const TCP* t_tcp;
     if ((t_tcp = pkt.pdu()->find_pdu<TCP>()) == nullptr) {
         not_tcp++;
-        return;
+        return false;
     }
-    std::string tsVal, ecrVal;
     uint32_t ts, ecr;
     try {
         std::pair<uint32_t, uint32_t> tts = t_tcp->timestamp();
-        tsVal = std::to_string(tts.first);
-        ecrVal = std::to_string(tts.second);
         ts = tts.first;
         ecr = tts.second;
     } catch (std::exception&) {
         no_TS++;
-        return;
+        return false;
     }
     if (ts == 0 || (ecr == 0 && (t_tcp->flags() != TCP::SYN))) {
-        return;
+        return false;
     }
 
     const IP* ip;
-    pktInfo pi;
-    std::string dstHst;
+    flowKey& fk = pr.fk;    // could add DSCP field to key
     const IPv6* ipv6;
     if ((ip = pkt.pdu()->find_pdu<IP>()) != nullptr) {
-        pi.IPsrc = ip->src_addr().to_string() + ":" + std::to_string(t_tcp->sport());
-        dstHst = ip->dst_addr().to_string();
-        pi.IPdst = dstHst + ":" + std::to_string(t_tcp->dport());
+        fk.src.setV4(uint32_t(ip->src_addr()));
+        fk.dst.setV4(uint32_t(ip->dst_addr()));
     } else if ((ipv6 = pkt.pdu()->find_pdu<IPv6>()) != nullptr) {
-        pi.IPsrc = ipv6->src_addr().to_string() + ":" + std::to_string(t_tcp->sport());
-        dstHst = ipv6->dst_addr().to_string();
-        pi.IPdst = dstHst + ":" + std::to_string(t_tcp->dport());
+        fk.src.setV6(&*ipv6->src_addr().begin());
+        fk.dst.setV6(&*ipv6->dst_addr().begin());
     } else {
         not_v4or6++;
+        return false;
+    }
+    fk.sport = t_tcp->sport();
+    fk.dport = t_tcp->dport();
+    fk.pad = 0;
+    pr.tsval = ts;
+    pr.ecr = ecr;
+    pr.flags = t_tcp->flags();
+    // data length from the IP header (the payload isn't all captured)
+    int dlen = ip ? int(ip->tot_len()) - ip->head_len() * 4 - int(t_tcp->header_size()) :
+                    int(ipv6->payload_length()) + 40 - int(ipv6->header_size()) - int(t_tcp->header_size());
+    pr.segLen = std::max(dlen, 0) + (pr.flags & tcpSYN ? 1 : 0) + (pr.flags & tcpFIN ? 1 : 0);
+    pr.endSeq = t_tcp->seq() + pr.segLen;
+    pr.ack = t_tcp->ack_seq();
+    // frame length on the wire, as the fast path gets it from the pcap
+    // header: the link header plus the IP header's length (the PDUs only
+    // have the captured bytes)
+    const PDU* l3 = ip ? static_cast<const PDU*>(ip) : ipv6;
+    pr.sz = pkt.pdu()->size() - l3->size() + (ip ? uint32_t(ip->tot_len()) : uint32_t(ipv6->payload_length()) + 40);
+    setCapTm(pkt.timestamp().seconds(), pkt.timestamp().microseconds(), pr);
+    return true;
+}
+
+/*
+ * libpcap fast path: frames are parsed in place in libpcap's buffer
+ * (see rawParse.hpp) so no libtins PDUs get built. libtins is the
+ * fallback for link types rawParse doesn't handle (or when --libtins
+ * is given).
+ */
+static pcap_t* pcapHndl;
+#ifdef __linux__
+static afPacketRing* afRing;        // TPACKET_V3 live capture (--tpacket)
+#endif
+#ifdef HAVE_LIBBPF
+static xdpCapture* xdpCap;          // XDP pre-filtered live capture (--xdp)
+static uint64_t xdpStatsLast[xdpStatCnt];
+#endif
+static int rawDlt;                  // link type of frames given to parseRawPacket
+static std::atomic<int> ctlDlt{DLT_EN10MB}; // (rawDlt for the control thread's filter checks)
+
+static void setRawDlt(int dlt)
+{
+    rawDlt = dlt;
+    ctlDlt.store(dlt, std::memory_order_relaxed);
+}
+
+/*
+ * parse a frame of 'caplen' captured bytes ('len' on the wire) into 'pr'
+ * (all but its capture time and seq). Packets without a usable TSval/ECR
+ * come back as parseRes::skip.
+ */
+static parseRes rawParsePkt(const uint8_t* bytes, uint32_t caplen, uint32_t len, pktRec& pr)
+{
+    parseRes r = rawParse(rawDlt, bytes, caplen, pr);
+    if (r == parseRes::ok && (pr.tsval == 0 || (pr.ecr == 0 && (pr.flags != tcpSYN)))) {
+        r = parseRes::skip;
+    }
+    pr.sz = len;        // original (not captured) length
+    return r;
+}
+
+/*
+ * parse a frame with the given capture time. Returns false if it isn't
+ * usable.
+ */
+static bool parseRawPacket(const uint8_t* bytes, uint32_t caplen, uint32_t len,
+                           int64_t sec, int64_t usec, pktRec& pr)
+{
+    pktCnt++;
+    STATS_START(st);
+    parseRes r = rawParsePkt(bytes, caplen, len, pr);
+    STATS_LAP(stageHist[stParse], st);
+    switch (r) {
+    case parseRes::ok:
+        break;
+    case parseRes::notTCP:
+        not_tcp++;
+        return false;
+    case parseRes::noTS:
+        no_TS++;
+        return false;
+    case parseRes::notV4or6:
+        not_v4or6++;
+        return false;
+    default:
+        return false;
+    }
+    setCapTm(sec, usec, pr);
+    return true;
+}
+
+/*
+ * Update the state of the packet's flow in shard 'sh' and compute its
+ * metrics. Returns true (with 'o' filled in) if there's a line to output.
+ */
+// memory charged to a flow: its pool slot and hash table node and bucket
+static constexpr size_t flowBytes = sizeof(flowDly) + sizeof(flowKey) + 4 * sizeof(void*);
+
+// unlink flow 'fi' from its reverse flow and free it (the caller removes
+// its flows map entry)
+static void freeFlow(flowShard& sh, uint32_t fi)
+{
+    flowDly& fr = sh.pool[fi];
+    if (fr.revFlow) {
+        flowDly& rfr = sh.pool[fr.rfi];
+        rfr.revFlow = false;
+        rfr.rfi = 0;
+    }
+    sh.pool.free(fi);
+    bump(sh.flowCnt, -1);
+}
+
+/*
+ * Make room for a new flow in a full shard by evicting one chosen by a
+ * Clock sweep over the pool. Each packet gives its flow 1 (uni-directional),
+ * 2 (bi-directional but no clock yet) or 3 (clocked) chances and the hand
+ * takes one from each flow it passes, evicting the first with none left,
+ * so flows that can't yield measurements (scans, floods, flows too short
+ * to clock) are the first to go.
+ */
+static void evictFlow(flowShard& sh)
+{
+    for (;;) {
+        uint32_t i = sh.clockHand++;
+        if (i >= sh.pool.end()) {
+            sh.clockHand = 1;
+            continue;
+        }
+        if (!sh.pool.used(i)) {
+            continue;
+        }
+        flowDly& fr = sh.pool[i];
+        if (fr.clkRef > 0) {
+            fr.clkRef--;
+            continue;
+        }
+        bump(sh.evicted[!fr.revFlow ? 0 : !fr.clkSet ? 1 : 2]);
+        sh.flows.erase(fr._key);
+        freeFlow(sh, i);
+        return;
+    }
+}
+
+// start dv estimation for a flow and its reverse (whose clock it needs)
+static void promoteFlow(flowShard& sh, flowDly& fr)
+{
+    fr.promote();
+    bump(sh.promoted);
+    if (fr.revFlow && !sh.pool[fr.rfi].full) {
+        sh.pool[fr.rfi].promote();
+        bump(sh.promoted);
+    }
+}
+
+/*
+ * The per-packet path is specialized at compile time for the options that
+ * are fixed for a run (--seqack, whether there's a local address to leave
+ * out, and where output goes) and main picks the instantiations once (see
+ * pickPaths) so the disabled code isn't even branched around.
+ *
+ * Batched, the packet is lane 'lane' of the shard's dvBatch: its dvs are
+ * left for dvBatch::compute and whether it has output is only settled
+ * then (see processBatch), so this just fills in 'o'.
+ */
+template <bool SeqAck, bool FiltLocal, bool Batched>
+static bool processPacket(flowShard& sh, const pktRec& pr, outRec& o, size_t lane = 0)
+{
+    const flowKey& fk = pr.fk;
+    double capTm = pr.tm;
+    pktInfo pi;
+    STATS_START(st);
+    sh.tsTbl.advance(capTm);
+
+    // Creates a flowDly entry whenever needed
+    flowDly* fr;
+    auto fit = sh.flows.find(fk);
+    if (fit == sh.flows.end()) {
+        if (sh.flowCnt.load(std::memory_order_relaxed) >= sh.cfg->shardMaxFlows) {
+            evictFlow(sh);
+        }
+        uint32_t fi = sh.pool.alloc(fk);
+        fr = &sh.pool[fi];
+        fr->_id = sh.newFlowId();
+        fr->startTm =  capTm;
+        fr->startTS = pi.ts = extendTS(pr.tsval, &(fr->twrap));
+        fr->startTS = pi.ts;
+        bump(sh.flowCnt);
+        sh.flows.emplace(fk, fi);
+        sh.idle.add(capTm + sh.cfg->flowMaxIdle, {fi, uint32_t(fr->_id)});
+        fr->full = !sh.cfg->tiered || sh.cfg->tier.watch.match(fk);
+        // only record tsvals when capturing both directions of a flow
+        // if this flow is the reverse of a known flow, mark both as bi-directional
+        if (auto rit = sh.flows.find(fk.reverse()); rit != sh.flows.end()) {
+            flowDly* rfr = &sh.pool[rit->second];
+            rfr->revFlow = true;
+            rfr->rfi = fi;
+            rfr->_rid = fr->_id;
+            fr->revFlow = true;
+            fr->rfi = rit->second;
+            fr->_rid = rfr->_id;
+            if (fr->full != rfr->full) {
+                (fr->full ? rfr : fr)->promote();
+                bump(sh.promoted);
+            }
+        }
+    } else {
+        fr = &sh.pool[fit->second];
+        pi.ts = extendTS(pr.tsval, &(fr->twrap));
+    }
+    STATS_LAP(sh.hist[stLookup], st);
+    pi.tm = fr->_lastTm = capTm;
+    pi.sz = pr.sz;
+    pi.ecr = extendTS(pr.ecr, &(fr->ewrap));
+    pi.dv[0] = pi.dv[1] = pi.dv[2] = -1.;
+    fr->bytesSnt += (double)pi.sz;
+    if (fr->pktCnt < UINT16_MAX) {
+        fr->pktCnt++;
+    }
+    if (!fr->full && sh.cfg->tier.due(fr->bytesSnt, capTm - fr->startTm)) {
+        promoteFlow(sh, *fr);
+    }
+    bool dvs = false;
+    if (fr->full) {
+        if constexpr (Batched) {
+            fr->gatherDV(pi, fr->revFlow ? &sh.pool[fr->rfi] : nullptr, sh.dvb, lane);
+        } else {
+            dvs = fr->computeDV(pi, fr->revFlow ? &sh.pool[fr->rfi] : nullptr);
+        }
+    } else {
+        fr->retain(capTm, pi.ts);
+        if constexpr (Batched) {
+            sh.dvb.none(lane);
+        }
+    }
+    fr->clkRef = fr->revFlow ? (fr->clkSet ? 3 : 2) : 1;
+    STATS_LAP(sh.hist[stDelay], st);
+    double outTm = -1.;   //time of outbound pping match packet
+    if(fr->revFlow) {
+        outTm = sh.getTStm(fr->_rid, pr.ecr);
+        if constexpr (SeqAck) {
+            // the segment this acks (if recorded) gives a tighter time than
+            // the TSval's first appearance (though that's consumed either way)
+            flowDly& rf = sh.pool[fr->rfi];
+            double segTm;
+            if ((pr.flags & tcpACK) && rf.segs && (segTm = rf.segs->match(pr.ack, pr.ecr)) >= 0.) {
+                outTm = segTm;
+                bump(sh.segMatched);
+            }
+            if (pr.segLen && (!FiltLocal || !(localIP == fk.dst))) {
+                if (!fr->segs) {
+                    fr->segs = std::make_unique<segRing>();
+                }
+                fr->segs->add(pr.tsval, pr.endSeq, capTm);
+            }
+        }
+        if (!FiltLocal || !(localIP == fk.dst)) {    //track for ppings
+            sh.addTS(fr->_id, pr.tsval, capTm);
+        }
+    } else
+        bump(sh.uniDir);
+    STATS_LAP(sh.hist[stTsval], st);
+#ifdef DLYLOC_STATS
+    if (fr->revFlow) {
+        sh.hullPts.record(fr->lhPts.size());
+        bump(sh.biPkts);
+        if (fr->clkSet) {
+            bump(sh.clkPkts);
+        }
+    }
+#endif
+
+    if constexpr (Batched) {
+        sh.dvb.outTm[lane] = outTm;
+        sh.dvb.rev[lane] = fr->revFlow;
+        sh.dvb.rtt[lane] = outTm > 0.;  // (then there's output whatever the dvs)
+    }
+    if (!Batched && dvs && (!fr->revFlow || outTm < 0.)) { //check for no pping for this sample
+        o.rtt = -1.;
+    } else if(outTm > 0.) {    //this is a return pping
+        // this packet is a return "pping" -- process it for packet's src
+        double rtt = capTm - outTm;
+        if (fr->_minPP > rtt)  {
+            fr->_minPP = rtt; // reset minimum
+            fr->_minTS = pi.ts - fr->startTS;
+            fr->_minTm = capTm;
+        }
+        fr->_lastPP = rtt;
+        o.rtt = rtt;
+        o.minPP = fr->_minPP;
+        if (sh.cfg->tier.rttQ > 0. && sh.rtts.above(rtt, sh.cfg->tier.rttQ) && !fr->full) {
+            promoteFlow(sh, *fr);
+        }
+    } else if (!Batched)
+        return false; //no metrics to print
+
+    o.fk = fk;
+    o.seq = pr.seq;
+    o.tm = capTm;
+    o.tsval = pr.tsval;
+    o.bytesSnt = fr->bytesSnt;
+    o.dv[0] = pi.dv[0];
+    o.dv[1] = pi.dv[1];
+    o.dv[2] = pi.dv[2];
+    return true;
+}
+
+enum class outPath { lines, digest, topk, columnar };
+
+template <outPath P, bool WallFlush>
+static void printRec(const outRec& o)
+{
+    STATS_START(st);
+    if constexpr (P == outPath::columnar) {
+        colOut->add(o, offTm);
+        STATS_LAP(stageHist[stOutput], st);
+        return;
+    }
+    if (const runCfg* c = cfg.read(); c->fmt != out.format()) {
+        out.flush();
+        out.setFormat(c->fmt);      // (changed by the control socket)
+    }
+    if constexpr (P == outPath::digest) {
+        digOut->add(o, offTm);
+    } else if constexpr (P == outPath::topk) {
+        topOut->add(o, offTm);
+    } else {
+        out.put(o, offTm);
+    }
+    if constexpr (WallFlush) {
+        int64_t now = clock_now();
+        if (now - nextFlush >= 0) {
+            nextFlush = now + flushInt;
+            out.flush();
+        }
+    }
+    STATS_LAP(stageHist[stOutput], st);
+}
+
+/*
+ * Delete the flows that have been idle longer than flowMaxIdle as of
+ * capture time 'n'. A flow's timer is only set when it's created; when it
+ * comes due a flow that has seen packets since is put back for flowMaxIdle
+ * after its last packet, so this is O(flows due) and packets never touch
+ * the wheel. (Entries of flows evicted in the meantime are stale and
+ * ignored.) tsTbl entries expire on their own (see tsvalTable.hpp).
+ */
+static inline void expireFlows(flowShard& sh, double n)
+{
+    double maxIdle = sh.cfg->flowMaxIdle;
+    sh.idle.advance(n, [&sh, n, maxIdle](const std::pair<uint32_t, uint32_t>& e) {
+        auto [fi, id] = e;
+        if (!sh.pool.used(fi) || sh.pool[fi]._id != id) {
+            return;
+        }
+        flowDly& fr = sh.pool[fi];
+        if (n - fr._lastTm > maxIdle) {
+            sh.flows.erase(fr._key);
+            freeFlow(sh, fi);
+        } else {
+            sh.idle.add(fr._lastTm + maxIdle, e);
+        }
+    });
+}
+
+/*
+ * Bring the shard's state up to a new version of the settings: the TSval
+ * table's max age and, for --tiered and --watch changes, promote any
+ * existing flows that new flows like them would now start out promoted.
+ * (Demoting isn't done; a promoted flow keeps its clock.)
+ */
+static void applyCfg(flowShard& sh)
+{
+    const runCfg& c = *sh.cfg;
+    sh.tsTbl.setMaxAge(c.tsvalMaxAge);
+    for (const auto& [k, fi] : sh.flows) {
+        flowDly& fr = sh.pool[fi];
+        if (!fr.full && (!c.tiered || c.tier.watch.match(k))) {
+            promoteFlow(sh, fr);
+        }
+    }
+    sh.cfgGen = c.gen;
+}
+
+// fill in a flow state dump asked for by the control socket
+static void serveDump(flowShard& sh)
+{
+    uint32_t w = sh.dumpWant.load(std::memory_order_acquire);
+    sh.dump.clear();
+    for (const auto& [k, fi] : sh.flows) {
+        const flowDly& fr = sh.pool[fi];
+        double q = fr._lastPP >= 0. ? fr._lastPP - fr._minPP : -1.;
+        sh.dump.push_back({k, fr._minPP, q, fr.bytesSnt, fr._lastTm, fr.pktCnt, fr.clkSet});
+    }
+    sh.dumpDone.store(w, std::memory_order_release);
+}
+
+// fill in a state snapshot of the shard's flows and TSval table
+static void serveSnap(flowShard& sh)
+{
+    uint32_t w = sh.snapWant.load(std::memory_order_acquire);
+    sh.snapFlows.clear();
+    sh.snapPts.clear();
+    sh.snapTs.clear();
+    std::unordered_map<uint32_t, uint32_t> idx;     // flow id to index in snapFlows
+    for (const auto& [k, fi] : sh.flows) {
+        idx.emplace(uint32_t(sh.pool[fi]._id), sh.snapFlows.size());
+        saveFlow(sh.pool[fi], sh.snapFlows, sh.snapPts);
+    }
+    sh.tsTbl.forEach([&sh, &idx](uint32_t fid, uint32_t tsv, double tm, bool used) {
+        if (auto it = idx.find(fid); it != idx.end()) {
+            sh.snapTs.push_back({it->second | (used ? tsvalTable::usedBit : 0), tsv, tm});
+        }
+    });
+    sh.snapOffTm = offTm;
+    sh.snapDone.store(w, std::memory_order_release);
+}
+
+// (the shard's thread) pick up the current settings and any dump request
+static inline void shardCtl(flowShard& sh)
+{
+    quiesce(sh.rcuId);
+    sh.cfg = cfg.read();
+    if (sh.cfg->gen != sh.cfgGen) {
+        applyCfg(sh);
+    }
+    if (sh.dumpWant.load(std::memory_order_relaxed) != sh.dumpDone.load(std::memory_order_relaxed)) {
+        serveDump(sh);
+    }
+    if (sh.snapWant.load(std::memory_order_relaxed) != sh.snapDone.load(std::memory_order_relaxed)) {
+        serveSnap(sh);
+    }
+}
+
+// get rid of stale flows (and publish table stats) before processing a record
+static inline void shardPrep(flowShard& sh, const pktRec& pr)
+{
+    STATS_START(st);
+    expireFlows(sh, pr.tm);
+    STATS_LAP(sh.hist[stExpire], st);
+#ifdef DLYLOC_STATS
+    if (++sh.statPkts >= flowShard::statPubPkts) {
+        sh.statPkts = 0;
+        sh.flowBuckets.store(sh.flows.bucket_count(), std::memory_order_relaxed);
+        sh.tsEntries.store(sh.tsTbl.size(), std::memory_order_relaxed);
+        sh.tsCap.store(sh.tsTbl.capacity(), std::memory_order_relaxed);
+        sh.poolBytes.store(sh.pool.bytes(), std::memory_order_relaxed);
+    }
+#endif
+}
+
+/*
+ * Process n packets (at most a dvBatch) of a shard, putting the output
+ * records in 'os' in order. Returns how many there are.
+ */
+template <bool SeqAck, bool FiltLocal>
+static size_t processBatch(flowShard& sh, const pktRec* prs, size_t n, outRec* os)
+{
+    dvBatch& b = sh.dvb;
+    for (size_t i = 0; i < n; i++) {
+        shardPrep(sh, prs[i]);
+        processPacket<SeqAck, FiltLocal, true>(sh, prs[i], os[i], i);
+    }
+    STATS_START(st);
+    b.compute(n);
+    STATS_LAP(sh.hist[stDelay], st);
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!b.rtt[i]) {
+            if (!b.set[i] || (b.rev[i] && b.outTm[i] >= 0.)) {
+                continue;   //no metrics to print
+            }
+            os[i].rtt = -1.;
+        }
+        outRec& o = os[k++];
+        if (&o != &os[i]) {
+            o = os[i];
+        }
+        o.dv[0] = b.dv0[i];
+        o.dv[1] = b.dv1[i];
+        o.dv[2] = b.dv2[i];
+    }
+    return k;
+}
+
+// the instantiations of processPacket and printRec for this run's options
+static bool (*processFn)(flowShard&, const pktRec&, outRec&, size_t) = processPacket<false, true, false>;
+static size_t (*batchFn)(flowShard&, const pktRec*, size_t, outRec*) = processBatch<false, true>;
+static void (*printFn)(const outRec&) = printRec<outPath::lines, true>;
+
+static void pickPaths()
+{
+    static bool (* const proc[2][2])(flowShard&, const pktRec&, outRec&, size_t) = {
+        {processPacket<false, false, false>, processPacket<false, true, false>},
+        {processPacket<true, false, false>, processPacket<true, true, false>}
+    };
+    static size_t (* const batch[2][2])(flowShard&, const pktRec*, size_t, outRec*) = {
+        {processBatch<false, false>, processBatch<false, true>},
+        {processBatch<true, false>, processBatch<true, true>}
+    };
+    // (offline there's no local address so nothing is left out)
+    bool fl = filtLocal && !localIP.empty();
+    processFn = proc[seqAck][fl];
+    batchFn = batch[seqAck][fl];
+    static void (* const prt[4][2])(const outRec&) = {
+        {printRec<outPath::lines, false>, printRec<outPath::lines, true>},
+        {printRec<outPath::digest, false>, printRec<outPath::digest, true>},
+        {printRec<outPath::topk, false>, printRec<outPath::topk, true>},
+        {printRec<outPath::columnar, false>, printRec<outPath::columnar, true>}
+    };
+    printFn = prt[colOut ? 3 : topOut ? 2 : digOut ? 1 : 0][wallFlush];
+}
+
+// process a record in its shard
+static inline bool shardPacket(flowShard& sh, const pktRec& pr, outRec& o)
+{
+    shardCtl(sh);
+    shardPrep(sh, pr);
+    return processFn(sh, pr, o, 0);
+}
+
+/*
+ * Pipelined processing (--pipeline or --threads N). The capture thread
+ * parses packets into pktRecs and pushes each onto the input ring of the
+ * worker owning the flow's shard. Workers push outRecs to their output
+ * ring and a single output thread merges those back into capture order.
+ * Every ring is a lock-free spscRing so nothing downstream can stall
+ * capture: for live capture a record that finds its ring full is dropped
+ * (and counted) rather than waited for.
+ *
+ * Each worker publishes a watermark ('mark'): every packet with seq <=
+ * mark has been processed and its output (if any) is on the output ring.
+ * That's what lets the output thread know when its next line is safe to
+ * print. A worker with an empty input ring can advance its mark to the
+ * capture thread's 'dispatched' seq since nothing up to there is coming.
+ */
+static constexpr size_t ringSize = 1 << 14;     // records per ring
+static bool pipelined;      // run capture, processing and output as separate threads
+static bool dropWhenFull;   // drop when a ring's full (live) rather than wait (offline)
+static std::atomic<uint64_t> dispatched;        // seq of last packet handed to a worker
+
+struct workerCtx {
+    flowShard* sh;
+    int node;                       // NUMA node the thread runs on (-1 = any, see --numa)
+    spscRing<pktRec> in;
+    spscRing<outRec> out;
+    std::atomic<uint64_t> mark{};
+
+    explicit workerCtx(flowShard* s)
+        : sh(s), node(s->arena ? s->arena->node() : -1),
+          in(ringSize, s->arena.get()), out(ringSize, s->arena.get()) {}
+};
+static std::vector<std::unique_ptr<workerCtx>> workers;
+static uint64_t inDropsLast, outDropsLast;      // drop counts at last summary
+
+template<typename T>
+static inline void ringPut(spscRing<T>& r, const T& v)
+{
+    if (r.push(v)) {
         return;
     }
-    /*
-     * Reach here with a TCP packet with timestamp option
-     * Process capture clock time
-     */
-    std::time_t result = pkt.timestamp().seconds();
-    if (offTm < 0) {
-        offTm = static_cast<int64_t>(pkt.timestamp().seconds());
-        // fractional part of first usable packet time
-        startm = double(pkt.timestamp().microseconds()) * 1e-6;
-        capTm = startm;
-        if (sumInt) {
-            std::cerr << "First packet at " << std::asctime(std::localtime(&result)) << "\n";
+    if (dropWhenFull) {
+        r.drop();
+        return;
+    }
+    backoff bo;
+    while (!r.push(v)) {
+        bo.pause();
+    }
+}
+
+template<typename T>
+static inline void ringPut(spscRing<T>& r, const T* v, size_t n)
+{
+    for (size_t k = r.push(v, n); k < n; k++) {
+        ringPut(r, v[k]);
+    }
+}
+
+/*
+ * Workers take packets off their input ring in batches of up to
+ * dvBatch::N (as many as are there) so the ring indices, the settings
+ * check and the delay variation arithmetic are done once per batch.
+ */
+static void workerLoop(workerCtx* w)
+{
+    pktRec prs[dvBatch::N];
+    outRec os[dvBatch::N];
+    backoff bo;
+    uint64_t mark = 0;
+    if (w->node >= 0 && !bindToNode(w->node)) {
+        std::cerr << "warning: couldn't bind a worker to NUMA node " << w->node << "\n";
+    }
+    for (;;) {
+        uint64_t d = dispatched.load(std::memory_order_acquire);
+        if (size_t n = w->in.pop(prs, dvBatch::N); n > 0) {
+            shardCtl(*w->sh);
+            ringPut(w->out, os, batchFn(*w->sh, prs, n, os));
+            mark = prs[n - 1].seq;
+            w->mark.store(mark, std::memory_order_release);
+            bo.reset();
+            continue;
+        }
+        if (w->in.finished()) {
+            break;
+        }
+        // input is empty so every packet dispatched up to 'd' is done
+        if (d > mark) {
+            mark = d;
+            w->mark.store(mark, std::memory_order_release);
+        }
+        shardCtl(*w->sh);
+        bo.pause();
+    }
+    if (w->sh->rcuId >= 0) {
+        cfg.offline(w->sh->rcuId);
+    }
+    w->mark.store(UINT64_MAX, std::memory_order_release);
+    w->out.close();
+}
+
+// merge the workers' output back into capture order
+static void outputLoop()
+{
+    size_t n = workers.size();
+    backoff bo;
+    for (;;) {
+        quiesce(outRcu);
+        outRec* best = nullptr;
+        size_t bw = 0;
+        for (size_t v = 0; v < n; v++) {
+            outRec* f = workers[v]->out.front();
+            if (f != nullptr && (best == nullptr || f->seq < best->seq)) {
+                best = f;
+                bw = v;
+            }
+        }
+        // a worker with nothing on its ring could still produce a line
+        // that comes before 'best' unless its watermark says otherwise
+        bool wait = false, live = false;
+        for (size_t v = 0; v < n && !wait; v++) {
+            auto& w = *workers[v];
+            uint64_t m = w.mark.load(std::memory_order_acquire);
+            if (outRec* f = w.out.front(); f != nullptr) {
+                live = true;
+                wait = (best == nullptr || f->seq < best->seq);    // arrived since the scan
+                continue;
+            }
+            if (m == UINT64_MAX) {
+                continue;   // worker finished
+            }
+            live = true;
+            wait = (best == nullptr || m < best->seq);
+        }
+        if (!live) {
+            break;          // all workers finished and drained
+        }
+        if (wait) {
+            bo.pause();
+            continue;
+        }
+        printFn(*best);
+        workers[bw]->out.pop();
+        bo.reset();
+    }
+    if (outRcu >= 0) {
+        cfg.offline(outRcu);
+    }
+    out.flush();
+}
+
+static void dispatch(const pktRec& pr)
+{
+    workerCtx* w = workers[pr.fk.symHash() % workers.size()].get();
+    ringPut(w->in, pr);
+    dispatched.store(pr.seq, std::memory_order_release);
+}
+
+// return the local ip address of 'ifname'
+// XXX since an interface can have multiple addresses, both IP4 and IP6,
+// this should really create a set of all of them and later test for
+// membership. But for now we just take the first IP4 address.
+static ipAddr localAddrOf(const std::string ifname)
+{
+    ipAddr local{};
+    struct ifaddrs* ifap;
+
+    if (getifaddrs(&ifap) == 0) {
+        for (auto ifp = ifap; ifp; ifp = ifp->ifa_next) {
+            if (ifname == ifp->ifa_name &&
+                  ifp->ifa_addr->sa_family == AF_INET) {
+                uint32_t ip = ((struct sockaddr_in*)
+                               ifp->ifa_addr)->sin_addr.s_addr;
+                local.setV4(ip);
+                break;
+            }
+        }
+        freeifaddrs(ifap);
+    }
+    return local;
+}
+
+static inline std::string printnz(int v, const char *s) {
+    return (v > 0? std::to_string(v) + s : "");
+}
+
+static int uniDirLast;      // uniDir count at last summary
+static int evictLast[3];    // evictions by class at last summary
+static uint64_t segMatchedLast; // SEQ/ACK matched ppings at last summary
+static uint64_t promotedLast;   // flows promoted at last summary
+static uint64_t kdropsLast; // capture drops at last summary
+
+// packets dropped by the kernel since capture started
+static uint64_t kernelDropTotal()
+{
+    uint64_t d = 0;
+    struct pcap_stat ps;
+    if (pcapHndl && pcap_stats(pcapHndl, &ps) == 0) {
+        d = uint64_t(ps.ps_drop) + ps.ps_ifdrop;
+    }
+#ifdef __linux__
+    if (afRing) {
+        d = afRing->drops();
+    }
+#endif
+#ifdef HAVE_LIBBPF
+    if (xdpCap) {
+        uint64_t st[xdpStatCnt];
+        xdpCap->stats(st);
+        d = st[xdpStatRbFull];      // records lost because userspace fell behind
+    }
+#endif
+    return d;
+}
+
+// packets dropped by the kernel since the last summary
+static int kernelDrops()
+{
+    uint64_t d = kernelDropTotal();
+    int n = int(d - kdropsLast);
+    kdropsLast = d;
+    return n;
+}
+
+static int uniDirTotal()
+{
+    int n = 0;
+    for (const auto& sh : shards) {
+        n += sh->uniDir.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+/*
+ * Flow sampling for overload. A flow is kept if the low 'sampleShift'
+ * bits of the top half of its symmetric hash are zero, so both directions
+ * are kept or dropped together, the choice is independent of the shard
+ * (which uses the hash mod nThreads) and the flows kept at a rate of 1/2N
+ * are a subset of the ones kept at 1/N. With --adaptive the rate halves
+ * when the capture falls behind (kernel or ring drops, or input rings
+ * more than half full) and doubles back, down to the --sample floor,
+ * after a run of calm intervals.
+ */
+static int sampleShift;     // keep 1 in 2^sampleShift flows
+static int sampleMinShift;  // floor set by --sample
+static bool sampleAdapt;    // --adaptive
+static int unsampled;       // packets skipped by sampling since last summary
+static constexpr int sampleMaxShift = 16;
+static constexpr int sampleCalmIntervals = 5;   // calm intervals before backing off
+
+static inline bool sampled(const flowKey& fk)
+{
+    return (uint32_t(fk.symHash() >> 32) & ((1u << sampleShift) - 1)) == 0;
+}
+
+// once a second of capture time see if the sampling rate should change
+static void adaptSampling()
+{
+    static double nxt;
+    static uint64_t kdrops, rdrops;
+    static int calm;
+    if (capTm < nxt) {
+        return;
+    }
+    bool first = nxt == 0.;
+    nxt = capTm + 1.;
+    uint64_t kd = kernelDropTotal(), rd = 0;
+    size_t fill = 0;
+    for (const auto& w : workers) {
+        rd += w->in.drops.load(std::memory_order_relaxed);
+        fill = std::max(fill, w->in.size());
+    }
+    bool dropped = kd != kdrops || rd != rdrops;
+    kdrops = kd;
+    rdrops = rd;
+    if (first) {
+        return;
+    }
+    if (dropped || fill > ringSize / 2) {
+        calm = 0;
+        if (sampleShift < sampleMaxShift) {
+            sampleShift++;
+        }
+    } else if (fill < ringSize / 10 && ++calm >= sampleCalmIntervals) {
+        calm = 0;
+        if (sampleShift > sampleMinShift) {
+            sampleShift--;
+        }
+    }
+}
+
+#ifdef DLYLOC_STATS
+// stage cycle counts summed over the threads that record them
+static void stageCounts(int stage, uint64_t* n)
+{
+    memset(n, 0, sizeof(uint64_t) * latHist::nBuckets);
+    stageHist[stage].addTo(n);
+    for (const auto& sh : shards) {
+        sh->hist[stage].addTo(n);
+    }
+}
+
+// one line per stage with its median and 99th percentile in ns
+static void printStageSummary()
+{
+    std::vector<uint64_t> n(latHist::nBuckets);
+    double ns = 1e9 / cycleHz();
+    std::cerr << "  stage ns p50/p99:";
+    for (int i = 0; i < nStages; i++) {
+        stageCounts(i, n.data());
+        std::cerr << " " << stageNames[i] << " " << llround(histQuantile(n.data(), .5) * ns)
+                  << "/" << llround(histQuantile(n.data(), .99) * ns);
+    }
+    std::cerr << "\n";
+}
+
+static void promHist(FILE* f, const char* name, const char* labels, const uint64_t* n,
+                     uint64_t sum, double scale)
+{
+    // cumulative counts at power-of-2 bucket group boundaries
+    uint64_t cum = 0, tot = 0;
+    int last = 0;
+    for (int i = 0; i < latHist::nBuckets; i++) {
+        tot += n[i];
+        if (n[i]) {
+            last = i;
+        }
+    }
+    for (int g = 1; g * latHist::nSub <= last + latHist::nSub; g++) {
+        for (int i = (g - 1) * latHist::nSub; i < g * latHist::nSub; i++) {
+            cum += n[i];
+        }
+        fprintf(f, "%s_bucket{%s%sle=\"%g\"} %" PRIu64 "\n", name, labels, *labels ? "," : "",
+                double(latHist::lowest(g * latHist::nSub)) * scale, cum);
+    }
+    fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, *labels ? "," : "", tot);
+    fprintf(f, "%s_sum%s%s%s %.10g\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+            double(sum) * scale);
+    fprintf(f, "%s_count%s%s%s %" PRIu64 "\n", name, *labels ? "{" : "", labels,
+            *labels ? "}" : "", tot);
+}
+
+/*
+ * Write the counters in Prometheus text format to statsFile (for
+ * node_exporter's textfile collector or anything else that can scrape a
+ * file). It's written to a temporary then renamed so readers never see
+ * a partial file.
+ */
+static void writeStats()
+{
+    std::string tmp = statsFile + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == nullptr) {
+        return;
+    }
+    auto counter = [f](const char* name, const char* help, uint64_t v) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name, v);
+    };
+    auto gauge = [f](const char* name, const char* help, double v) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s gauge\n%s %.10g\n", name, help, name, name, v);
+    };
+    counter("dlyloc_packets_total", "packets captured", cntTotal[0] + pktCnt);
+    counter("dlyloc_not_tcp_total", "packets that weren't TCP", cntTotal[1] + not_tcp);
+    counter("dlyloc_no_ts_total", "TCP packets without a timestamp option", cntTotal[2] + no_TS);
+    counter("dlyloc_not_v4or6_total", "packets that weren't IPv4 or IPv6", cntTotal[3] + not_v4or6);
+    counter("dlyloc_kernel_drops_total", "packets dropped by the kernel", kernelDropTotal());
+
+    uint64_t ev[3]{}, bi = 0, clk = 0;
+    size_t flows = 0, buckets = 0, tsEnt = 0, tsCap = 0, pool = 0;
+    std::vector<uint64_t> hull(latHist::nBuckets);
+    uint64_t hullSum = 0;
+    for (const auto& sh : shards) {
+        for (int i = 0; i < 3; i++) {
+            ev[i] += sh->evicted[i].load(std::memory_order_relaxed);
+        }
+        bi += sh->biPkts.load(std::memory_order_relaxed);
+        clk += sh->clkPkts.load(std::memory_order_relaxed);
+        flows += sh->flowCnt.load(std::memory_order_relaxed);
+        buckets += sh->flowBuckets.load(std::memory_order_relaxed);
+        tsEnt += sh->tsEntries.load(std::memory_order_relaxed);
+        tsCap += sh->tsCap.load(std::memory_order_relaxed);
+        pool += sh->poolBytes.load(std::memory_order_relaxed);
+        sh->hullPts.addTo(hull.data());
+        hullSum += sh->hullPts.sum.load(std::memory_order_relaxed);
+    }
+    fprintf(f, "# HELP dlyloc_evicted_total flows evicted to make room for new ones\n"
+               "# TYPE dlyloc_evicted_total counter\n");
+    static const char* const evClass[3] = {"unidir", "unclocked", "clocked"};
+    for (int i = 0; i < 3; i++) {
+        fprintf(f, "dlyloc_evicted_total{class=\"%s\"} %" PRIu64 "\n", evClass[i], ev[i]);
+    }
+    gauge("dlyloc_flows", "flows being tracked", flows);
+    gauge("dlyloc_flow_table_load_factor", "flow hash table entries per bucket",
+          buckets ? double(flows) / buckets : 0.);
+    gauge("dlyloc_tsval_entries", "TSvals waiting for a matching ECR", tsEnt);
+    gauge("dlyloc_tsval_table_load_factor", "TSval table entries per slot",
+          tsCap ? double(tsEnt) / tsCap : 0.);
+    gauge("dlyloc_flow_pool_bytes", "bytes allocated for flow state", pool);
+    if (hugeArena::on) {
+        fprintf(f, "# HELP dlyloc_arena_bytes bytes mapped for the shards' tables by NUMA node and page type\n"
+                   "# TYPE dlyloc_arena_bytes gauge\n");
+        for (int i = 0; i <= hugeArena::maxNodes; i++) {
+            const auto& s = hugeArena::stats[i];
+            if (s.regions.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            std::string n = i < hugeArena::maxNodes ? std::to_string(i) : "none";
+            fprintf(f, "dlyloc_arena_bytes{node=\"%s\",pages=\"hugetlb\"} %" PRIu64 "\n"
+                       "dlyloc_arena_bytes{node=\"%s\",pages=\"thp\"} %" PRIu64 "\n",
+                    n.c_str(), s.hugetlb.load(std::memory_order_relaxed),
+                    n.c_str(), s.thp.load(std::memory_order_relaxed));
+        }
+    }
+    gauge("dlyloc_clock_set_ratio", "fraction of bi-directional flow packets whose flow had a clock estimate",
+          bi ? double(clk) / bi : 0.);
+    if (!workers.empty()) {
+        uint64_t inDrops = 0, outDrops = 0;
+        for (const auto& w : workers) {
+            inDrops += w->in.drops.load(std::memory_order_relaxed);
+            outDrops += w->out.drops.load(std::memory_order_relaxed);
+        }
+        counter("dlyloc_process_queue_drops_total", "packets dropped at a full worker queue", inDrops);
+        counter("dlyloc_output_queue_drops_total", "lines dropped at a full output queue", outDrops);
+    }
+
+    fprintf(f, "# HELP dlyloc_hull_points lower hull points per flow (sampled per packet)\n"
+               "# TYPE dlyloc_hull_points histogram\n");
+    promHist(f, "dlyloc_hull_points", "", hull.data(), hullSum, 1.);
+    fprintf(f, "# HELP dlyloc_stage_seconds time per packet in each processing stage\n"
+               "# TYPE dlyloc_stage_seconds histogram\n");
+    double sec = 1. / cycleHz();
+    for (int i = 0; i < nStages; i++) {
+        stageCounts(i, hull.data());
+        uint64_t sum = stageHist[i].sum.load(std::memory_order_relaxed);
+        for (const auto& sh : shards) {
+            sum += sh->hist[i].sum.load(std::memory_order_relaxed);
+        }
+        std::string lbl = std::string("stage=\"") + stageNames[i] + "\"";
+        promHist(f, "dlyloc_stage_seconds", lbl.c_str(), hull.data(), sum, sec);
+    }
+    if (fclose(f) == 0) {
+        rename(tmp.c_str(), statsFile.c_str());
+    }
+}
+
+// rewrite the stats file about once a second (checked every 1024 packets)
+static void maybeWriteStats()
+{
+    static uint32_t n;
+    static int64_t nxt;
+    if ((++n & 1023) != 0) {
+        return;
+    }
+    int64_t now = clock_now();
+    if (now - nxt >= 0) {
+        nxt = now + (1 << 20);
+        writeStats();
+    }
+}
+#endif
+
+// memory of the shards' arenas by node (--hugepages, --numa)
+static void printArenas()
+{
+    constexpr int nn = hugeArena::maxNodes;
+    uint64_t remote[nn + 1]{};
+    for (const auto& sh : shards) {
+        if (sh->arena) {
+            int n = sh->arena->node();
+            remote[n >= 0 ? n : nn] += sh->arena->remoteBytes();
+        }
+    }
+    for (int i = 0; i <= nn; i++) {
+        const auto& s = hugeArena::stats[i];
+        if (s.regions.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        std::cerr << (i < nn ? "node " + std::to_string(i) : std::string("no node")) << ": "
+                  << s.regions.load(std::memory_order_relaxed) << " regions, "
+                  << (s.hugetlb.load(std::memory_order_relaxed) >> 20) << "MB hugetlb, "
+                  << (s.thp.load(std::memory_order_relaxed) >> 20) << "MB thp";
+        if (i < nn) {
+            std::cerr << ", " << (remote[i] >> 20) << "MB placed on another node";
+        }
+        std::cerr << "\n";
+    }
+}
+
+static void printSummary()
+{
+#ifdef HAVE_LIBBPF
+    if (xdpCap) {
+        // packets the XDP program didn't pass up are only counted in the kernel
+        uint64_t st[xdpStatCnt];
+        xdpCap->stats(st);
+        not_tcp += int(st[xdpStatNotTCP] - xdpStatsLast[xdpStatNotTCP]);
+        no_TS += int(st[xdpStatNoTS] - xdpStatsLast[xdpStatNoTS]);
+        pktCnt += int((st[xdpStatNotTCP] - xdpStatsLast[xdpStatNotTCP]) +
+                      (st[xdpStatNoTS] - xdpStatsLast[xdpStatNoTS]));
+        memcpy(xdpStatsLast, st, sizeof(st));
+    }
+#endif
+    int flowCnt = 0;
+    for (const auto& sh : shards) {
+        flowCnt += sh->flowCnt.load(std::memory_order_relaxed);
+    }
+    int uniDir = uniDirTotal() - uniDirLast;
+    int ev[3]{};
+    uint64_t segm = 0, prom = 0;
+    for (const auto& sh : shards) {
+        for (int i = 0; i < 3; i++) {
+            ev[i] += sh->evicted[i].load(std::memory_order_relaxed);
+        }
+        segm += sh->segMatched.load(std::memory_order_relaxed);
+        prom += sh->promoted.load(std::memory_order_relaxed);
+    }
+    std::cerr << flowCnt << " flows, "
+              << pktCnt << " packets, " +
+                 printnz(no_TS, " no TS opt, ") +
+                 printnz(uniDir, " uni-directional, ") +
+                 printnz(not_tcp, " not TCP, ") +
+                 printnz(not_v4or6, " not v4 or v6, ") +
+                 printnz(kernelDrops(), " kernel drops, ") +
+                 (sampleShift ? "1/" + std::to_string(1 << sampleShift) + " flows sampled (" +
+                                std::to_string(unsampled) + " pkts skipped), " : "") +
+                 printnz(ev[0] - evictLast[0], " uni-dir evicted, ") +
+                 printnz(ev[1] - evictLast[1], " unclocked evicted, ") +
+                 printnz(ev[2] - evictLast[2], " clocked evicted, ") +
+                 printnz(int(segm - segMatchedLast), " seq/ack matched, ") +
+                 printnz(int(prom - promotedLast), " promoted, ") +
+                 "\n";
+    memcpy(evictLast, ev, sizeof(ev));
+    segMatchedLast = segm;
+    promotedLast = prom;
+    STATS_ONLY(printStageSummary();)
+    if (workers.empty()) {
+        return;
+    }
+    // pipeline stage rings: current occupancy, high-water since last summary, drops
+    size_t inOcc = 0, inMax = 0, outOcc = 0, outMax = 0;
+    uint64_t inDrops = 0, outDrops = 0;
+    for (const auto& w : workers) {
+        inOcc += w->in.size();
+        inMax = std::max(inMax, w->in.hwm.exchange(0, std::memory_order_relaxed));
+        inDrops += w->in.drops.load(std::memory_order_relaxed);
+        outOcc += w->out.size();
+        outMax = std::max(outMax, w->out.hwm.exchange(0, std::memory_order_relaxed));
+        outDrops += w->out.drops.load(std::memory_order_relaxed);
+    }
+    size_t cap = ringSize * workers.size();
+    std::cerr << "  process queues " << inOcc << " of " << cap << " used (peak ring "
+              << inMax << ")" << printnz(inDrops - inDropsLast, " pkts dropped")
+              << ", output queues " << outOcc << " of " << cap << " used (peak ring "
+              << outMax << ")" << printnz(outDrops - outDropsLast, " lines dropped")
+              << "\n";
+    inDropsLast = inDrops;
+    outDropsLast = outDrops;
+}
+
+static bool limitHit;       // stopped by --count or --seconds
+static double nxtSum;       // capture time of next summary
+
+static void setFilter(const std::string& f);
+static uint64_t capGen;     // settings version the capture thread has applied
+
+// (the capture thread) pick up the current settings
+static inline void captureCtl()
+{
+    quiesce(capRcu);
+    const runCfg* c = cfg.read();
+    if (c->gen != capGen) {
+        capGen = c->gen;
+        if (c->sumInt != sumInt) {
+            sumInt = c->sumInt;
+            nxtSum = capTm + sumInt;
+        }
+        if (c->filter != filter) {
+            setFilter(c->filter);
+        }
+    }
+}
+
+// (the capture thread) between packets when capture may be idle
+static void captureIdle()
+{
+    captureCtl();
+    if (!pipelined) {
+        shardCtl(*shards[0]);
+    }
+}
+
+
+/*
+ * Hand a packet to flow processing then do any periodic work that's due.
+ * 'usable' is false if the packet couldn't be parsed. Returns false when
+ * it's time to stop.
+ */
+static bool handlePacket(bool usable, const pktRec& pr)
+{
+    captureCtl();
+    if (usable && sampleShift && !sampled(pr.fk)) {
+        unsampled++;
+        usable = false;
+    }
+    if (usable) {
+        outRec o;
+        if (pipelined) {
+            dispatch(pr);
+        } else if (shardPacket(*shards[0], pr, o)) {
+            printFn(o);
+        }
+    }
+
+    if ((time_to_run > 0. && capTm - startm >= time_to_run) ||
+        (maxPackets > 0 && pktCnt >= maxPackets)) {
+        limitHit = true;
+        return false;
+    }
+    if (stopReq) {
+        return false;
+    }
+    if (capTm >= nxtSum && sumInt) {
+        if (nxtSum > 0.) {
+            printSummary();
+            STATS_ONLY(cntTotal[0] += pktCnt; cntTotal[1] += not_tcp;
+                       cntTotal[2] += no_TS; cntTotal[3] += not_v4or6;)
+            pktCnt = 0;
+            no_TS = 0;
+            uniDirLast = uniDirTotal();
+            not_tcp = 0;
+            not_v4or6 = 0;
+            unsampled = 0;
+        }
+        nxtSum = capTm + sumInt;
+
+    }
+    if (sampleAdapt) {
+        adaptSampling();
+    }
+#ifdef DLYLOC_STATS
+    if (!statsFile.empty()) {
+        maybeWriteStats();
+    }
+#endif
+    return true;
+}
+
+static void pcapHandler(u_char*, const struct pcap_pkthdr* h, const u_char* bytes)
+{
+    pktRec pr;
+    bool ok = parseRawPacket(bytes, h->caplen, h->len, h->ts.tv_sec, h->ts.tv_usec, pr);
+    if (!handlePacket(ok, pr)) {
+        pcap_breakloop(pcapHndl);
+    }
+}
+
+static pcap_t* openPcap(const std::string& fname, bool live)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t* p;
+    if (live) {
+        p = pcap_create(fname.c_str(), errbuf);
+        if (p != nullptr) {
+            pcap_set_snaplen(p, SNAP_LEN);
+            pcap_set_promisc(p, 0);
+            pcap_set_timeout(p, 250);
+            if (pcap_activate(p) < 0) {
+                snprintf(errbuf, sizeof(errbuf), "%s", pcap_geterr(p));
+                pcap_close(p);
+                p = nullptr;
+            }
+        }
+    } else {
+        p = pcap_open_offline(fname.c_str(), errbuf);
+    }
+    if (p == nullptr) {
+        std::cerr << "Couldn't open " << fname << ": " << errbuf << "\n";
+        exit(EXIT_FAILURE);
+    }
+    struct bpf_program fp;
+    if (pcap_compile(p, &fp, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0 ||
+        pcap_setfilter(p, &fp) < 0) {
+        std::cerr << "Couldn't set filter '" << filter << "': " << pcap_geterr(p) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    pcap_freecode(&fp);
+    return p;
+}
+
+/*
+ * Connect to a collector (see dlycollect.cpp) given as tcp:host:port or
+ * udp:host:port. TCP carries the binary record stream; UDP sends it as
+ * self-contained datagrams.
+ */
+static int openCollector(const std::string& dest, bool& udp)
+{
+    size_t c1 = dest.find(':'), c2 = dest.rfind(':');
+    std::string proto = dest.substr(0, c1);
+    if (c1 == std::string::npos || c2 == c1 || (proto != "tcp" && proto != "udp")) {
+        std::cerr << "--send needs tcp:host:port or udp:host:port\n";
+        exit(1);
+    }
+    udp = proto == "udp";
+    std::string host = dest.substr(c1 + 1, c2 - c1 - 1);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    struct addrinfo hints{}, *res;
+    hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+    if (int e = getaddrinfo(host.c_str(), dest.c_str() + c2 + 1, &hints, &res); e != 0) {
+        std::cerr << "Couldn't resolve " << dest << ": " << gai_strerror(e) << "\n";
+        exit(1);
+    }
+    int fd = -1;
+    for (auto a = res; a != nullptr && fd < 0; a = a->ai_next) {
+        if ((fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) >= 0 &&
+            connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        std::cerr << "Couldn't connect to " << dest << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);   // (a collector going away shows up as write errors)
+    return fd;
+}
+
+#ifdef __linux__
+static void openTpacket(const std::string& ifname, int fanout)
+{
+    afRing = new afPacketRing;
+    if (!afRing->open(ifname)) {
+        std::cerr << "tpacket capture on " << ifname << ": " << afRing->_err << "\n";
+        exit(EXIT_FAILURE);
+    }
+    setRawDlt(afRing->_dlt);
+    // compile the filter (with its snap length) for the socket
+    pcap_t* dead = pcap_open_dead(rawDlt, SNAP_LEN);
+    struct bpf_program fp;
+    if (pcap_compile(dead, &fp, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        std::cerr << "Couldn't compile filter '" << filter << "': " << pcap_geterr(dead) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    struct sock_fprog prog{ (unsigned short)fp.bf_len, (struct sock_filter*)fp.bf_insns };
+    if (!afRing->start(&prog, fanout)) {
+        std::cerr << "tpacket capture on " << ifname << ": " << afRing->_err << "\n";
+        exit(EXIT_FAILURE);
+    }
+    pcap_freecode(&fp);
+    pcap_close(dead);
+}
+
+static void runTpacket()
+{
+    auto f = [](const uint8_t* bytes, uint32_t caplen, uint32_t len, int64_t sec, int64_t usec) {
+        pktRec pr;
+        bool ok = parseRawPacket(bytes, caplen, len, sec, usec, pr);
+        return handlePacket(ok, pr);
+    };
+    while (!stopReq && afRing->dispatch(f)) {
+        captureIdle();
+    }
+    if (!afRing->_err.empty()) {
+        std::cerr << "tpacket: " << afRing->_err << "\n";
+    }
+}
+#endif
+
+#ifdef HAVE_LIBBPF
+// handle a record from the XDP program
+static bool xdpHandler(const xdpRec& r)
+{
+    pktRec pr;
+    pktCnt += r.pkts;
+    pr.fk.src.setV6(r.src);
+    pr.fk.dst.setV6(r.dst);
+    pr.fk.sport = r.sport;
+    pr.fk.dport = r.dport;
+    pr.fk.pad = 0;
+    pr.tsval = r.tsval;
+    pr.ecr = r.ecr;
+    pr.flags = r.flags;
+    pr.sz = r.len;
+    pr.endSeq = pr.ack = pr.segLen = 0;     // (not passed up; no --seqack)
+    bool ok = !(pr.tsval == 0 || (pr.ecr == 0 && (pr.flags != tcpSYN)));
+    if (ok) {
+        int64_t sec, usec;
+        xdpCap->realTime(r, sec, usec);
+        setCapTm(sec, usec, pr);
+    }
+    return handlePacket(ok, pr);
+}
+
+static void runXdp(const std::string& ifname)
+{
+    xdpCap = new xdpCapture;
+    if (!xdpCap->open(ifname, xdpHandler)) {
+        std::cerr << "xdp capture on " << ifname << ": " << xdpCap->_err << "\n";
+        exit(EXIT_FAILURE);
+    }
+    if (filter != "tcp") {
+        std::cerr << "warning: --filter isn't applied to xdp capture\n";
+    }
+    while (!stopReq && xdpCap->poll()) {
+        captureIdle();
+    }
+    if (!xdpCap->_err.empty()) {
+        std::cerr << "xdp: " << xdpCap->_err << "\n";
+    }
+    xdpCap->close();    // detach the program from the interface
+}
+#endif
+
+static bool pcapFiltStale;  // filter changed since pcapHndl's was set
+
+static void runPcap(bool live)
+{
+    for (;;) {
+        captureIdle();
+        if (pcapFiltStale) {
+            // (set between pcap_dispatch calls rather than from its callback)
+            pcapFiltStale = false;
+            struct bpf_program fp;
+            if (pcap_compile(pcapHndl, &fp, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0 ||
+                pcap_setfilter(pcapHndl, &fp) < 0) {
+                std::cerr << "Couldn't set filter '" << filter << "': " << pcap_geterr(pcapHndl) << "\n";
+            } else {
+                pcap_freecode(&fp);
+            }
+        }
+        int n = pcap_dispatch(pcapHndl, 1024, pcapHandler, nullptr);
+        if (n == PCAP_ERROR_BREAK || (n == 0 && !live) || stopReq) {
+            break;
+        }
+        if (n < 0) {
+            std::cerr << "pcap: " << pcap_geterr(pcapHndl) << "\n";
+            break;
+        }
+    }
+}
+
+/*
+ * Offline input from an mmap'd capture file (see pcapFile.hpp). The -f
+ * filter is compiled for the file's link type and applied to each record
+ * with pcap_offline_filter. libpcap's reader is still used for anything
+ * pcapFile can't map (e.g., a pipe or compressed file).
+ */
+static pcapFile* pcapMap;
+static struct bpf_program mapFilt;
+
+static int mapFiltDlt = -1;     // link type mapFilt was compiled for
+
+// (re)compile the -f filter for link type 'dlt'
+static void compileMapFilt(int dlt)
+{
+    if (dlt == mapFiltDlt) {
+        return;
+    }
+    if (mapFiltDlt >= 0) {
+        pcap_freecode(&mapFilt);
+    }
+    pcap_t* dead = pcap_open_dead(dlt, SNAP_LEN);
+    if (pcap_compile(dead, &mapFilt, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        std::cerr << "Couldn't compile filter '" << filter << "': " << pcap_geterr(dead) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    pcap_close(dead);
+    mapFiltDlt = dlt;
+}
+
+/*
+ * (the capture thread) switch to filter 'f' (that the control thread has
+ * checked compiles) for whatever the input is. XDP capture doesn't use
+ * one.
+ */
+static void setFilter(const std::string& f)
+{
+    filter = f;
+    pcapFiltStale = pcapHndl != nullptr;
+    if (mapFiltDlt >= 0) {
+        pcap_t* dead = pcap_open_dead(mapFiltDlt, SNAP_LEN);
+        struct bpf_program fp;
+        if (pcap_compile(dead, &fp, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0) {
+            pcap_freecode(&mapFilt);
+            mapFilt = fp;
+        } else {
+            std::cerr << "Couldn't compile filter '" << filter << "': " << pcap_geterr(dead) << "\n";
+        }
+        pcap_close(dead);
+    }
+#ifdef __linux__
+    if (afRing) {
+        pcap_t* dead = pcap_open_dead(rawDlt, SNAP_LEN);
+        struct bpf_program fp;
+        if (pcap_compile(dead, &fp, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0) {
+            struct sock_fprog prog{ (unsigned short)fp.bf_len, (struct sock_filter*)fp.bf_insns };
+            if (!afRing->setFilter(&prog)) {
+                std::cerr << "tpacket: " << afRing->_err << "\n";
+            }
+            pcap_freecode(&fp);
+        }
+        pcap_close(dead);
+    }
+#endif
+}
+
+static bool openMapped(const std::string& fname)
+{
+    pcapMap = new pcapFile;
+    if (!pcapMap->open(fname.c_str()) || !rawSupported(pcapMap->dlt())) {
+        delete pcapMap;
+        pcapMap = nullptr;
+        return false;
+    }
+    setRawDlt(pcapMap->dlt());
+    compileMapFilt(rawDlt);
+    return true;
+}
+
+static inline bool mapFiltered(const uint8_t* bytes, uint32_t caplen, uint32_t len,
+                               int64_t sec, int64_t usec)
+{
+    struct pcap_pkthdr h;
+    h.ts.tv_sec = sec;
+    h.ts.tv_usec = usec;
+    h.caplen = caplen;
+    h.len = len;
+    return pcap_offline_filter(&mapFilt, &h, bytes) != 0;
+}
+
+static inline bool mappedPacket(const uint8_t* bytes, uint32_t caplen, uint32_t len,
+                                int64_t sec, int64_t usec)
+{
+    if (!mapFiltered(bytes, caplen, len, sec, usec)) {
+        return true;
+    }
+    pktRec pr;
+    bool ok = parseRawPacket(bytes, caplen, len, sec, usec, pr);
+    return handlePacket(ok, pr);
+}
+
+static void runMapped()
+{
+    pcapMap->walk(pcapMap->first(), pcapMap->size(), mappedPacket);
+}
+
+/*
+ * A sequence of capture files (several -r files or a directory, e.g.
+ * tcpdump -G rotations) processed as one continuous capture: flow and
+ * TSval state carry over from file to file. Files are taken in order of
+ * their first packet's time (then name). Mapped files are walked in place;
+ * when the walk of one is within a readahead window of its end the next
+ * is opened and its start prefetched so the switch doesn't wait on the
+ * disk. Files pcapFile can't map are read with libpcap.
+ */
+static std::vector<std::string> inFiles;
+
+// expand directories to the (non-hidden) files in them, in name order
+static std::vector<std::string> expandInputs(const std::vector<std::string>& names)
+{
+    std::vector<std::string> r;
+    for (const auto& n : names) {
+        struct stat st;
+        DIR* d;
+        if (stat(n.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || (d = opendir(n.c_str())) == nullptr) {
+            r.push_back(n);
+            continue;
+        }
+        std::vector<std::string> ents;
+        while (struct dirent* e = readdir(d)) {
+            std::string p = n + "/" + e->d_name;
+            if (e->d_name[0] != '.' && stat(p.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                ents.push_back(p);
+            }
+        }
+        closedir(d);
+        std::sort(ents.begin(), ents.end());
+        r.insert(r.end(), ents.begin(), ents.end());
+    }
+    return r;
+}
+
+// capture time (seconds) of a file's first packet, INT64_MAX if unknown
+// (or if the file's a pipe, which can only be read once)
+static int64_t firstPktSec(const std::string& fname)
+{
+    pcapFile pf;
+    int64_t sec;
+    struct stat st;
+    if (stat(fname.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return INT64_MAX;
+    }
+    if (pf.open(fname.c_str())) {
+        return pf.first() < pf.size() && pf.recSec(pf.first(), sec) ? sec : INT64_MAX;
+    }
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t* p = pcap_open_offline(fname.c_str(), errbuf);
+    if (p == nullptr) {
+        std::cerr << "Couldn't open " << fname << ": " << errbuf << "\n";
+        exit(EXIT_FAILURE);
+    }
+    struct pcap_pkthdr* h;
+    const u_char* b;
+    sec = pcap_next_ex(p, &h, &b) == 1 ? h->ts.tv_sec : INT64_MAX;
+    pcap_close(p);
+    return sec;
+}
+
+static void orderInputs()
+{
+    std::vector<std::pair<int64_t, std::string>> f;
+    for (const auto& n : inFiles) {
+        f.emplace_back(firstPktSec(n), n);
+    }
+    std::sort(f.begin(), f.end());
+    inFiles.clear();
+    for (const auto& [t, n] : f) {
+        inFiles.push_back(n);
+    }
+}
+
+// a mapped capture file, or nullptr if it needs libpcap
+static pcapFile* mapInput(const std::string& fname)
+{
+    auto pf = new pcapFile;
+    if (!pf->open(fname.c_str()) || !rawSupported(pf->dlt())) {
+        delete pf;
+        return nullptr;
+    }
+    return pf;
+}
+
+static void runFiles()
+{
+    pcapFile* nxt = mapInput(inFiles[0]);
+    for (size_t i = 0; i < inFiles.size() && !limitHit; i++) {
+        pcapFile* pf = nxt;
+        nxt = nullptr;
+        bool last = i + 1 == inFiles.size();
+        if (pf) {
+            setRawDlt(pf->dlt());
+            compileMapFilt(rawDlt);
+            size_t tail = pf->size() - std::min(pf->size() - pf->first(), pcapFile::raWindow);
+            size_t o = pf->walk(pf->first(), tail, mappedPacket);
+            if (!limitHit && !last && (nxt = mapInput(inFiles[i + 1])) != nullptr) {
+                nxt->prefetch();
+            }
+            if (!limitHit) {
+                pf->walk(o, pf->size(), mappedPacket);
+            }
+            delete pf;
+        } else {
+            pcapHndl = openPcap(inFiles[i], false);
+            setRawDlt(pcap_datalink(pcapHndl));
+            if (!rawSupported(rawDlt)) {
+                std::cerr << inFiles[i] << ": link type " << rawDlt << " isn't supported\n";
+                exit(EXIT_FAILURE);
+            }
+            runPcap(false);
+            pcap_close(pcapHndl);
+            pcapHndl = nullptr;
+            if (!limitHit && !last) {
+                nxt = mapInput(inFiles[i + 1]);
+            }
+        }
+    }
+    delete nxt;
+}
+
+/*
+ * Sliced offline processing (--slices N). The mapped file is split into N
+ * record-aligned byte ranges, each processed by its own thread with its
+ * own flow state. To pick up the TSvals and clock state in flight at its
+ * start, a slice first processes (without output) the sliceWarmup seconds
+ * of packets before it. Slice output after the first is spilled to a
+ * temporary file then replayed in order once earlier slices are done,
+ * with each flow's bytes sent and min RTT carried over from the end of
+ * the previous slice. RTTs are the same as a sequential run; delay
+ * variations can differ for a while after a slice boundary since the
+ * flow's clock fit restarts in the warmup.
+ */
+static int nSlices = 1;
+static constexpr double sliceWarmup = 60.;  // (seconds, must be >= tsvalMaxAge)
+
+struct flowSnap {
+    double bytes;
+    double minPP;
+};
+using flowSnaps = std::unordered_map<flowKey, flowSnap, flowKeyHash>;
+
+struct sliceCtx {
+    std::unique_ptr<flowShard> sh{std::make_unique<flowShard>()};
+    size_t warm, begin, end;    // offsets of warmup start, slice start and end
+    FILE* spill{};              // outRecs of slices after the first
+    flowSnaps atStart, atEnd;   // flow state at the slice's start and end
+    int pkts{}, notTCP{}, noTS{}, notV4or6{};
+    uint64_t seq{};
+    double lastTm{};
+};
+
+static void snapFlows(const flowShard& sh, flowSnaps& snap)
+{
+    for (const auto& [k, fi] : sh.flows) {
+        snap[k] = {sh.pool[fi].bytesSnt, sh.pool[fi]._minPP};
+    }
+}
+
+static void sliceLoop(sliceCtx* s)
+{
+    bool emit = false;
+    auto f = [s, &emit](const uint8_t* bytes, uint32_t caplen, uint32_t len,
+                        int64_t sec, int64_t usec) {
+        if (!mapFiltered(bytes, caplen, len, sec, usec)) {
+            return true;
+        }
+        pktRec pr;
+        parseRes r = rawParsePkt(bytes, caplen, len, pr);
+        if (emit) {
+            s->pkts++;
+            s->notTCP += r == parseRes::notTCP;
+            s->noTS += r == parseRes::noTS;
+            s->notV4or6 += r == parseRes::notV4or6;
+        }
+        if (r != parseRes::ok || (sampleShift && !sampled(pr.fk))) {
+            return true;
+        }
+        pr.tm = double(sec - offTm) + double(usec) * 1e-6;
+        pr.seq = ++s->seq;
+        outRec o;
+        if (shardPacket(*s->sh, pr, o) && emit) {
+            if (s->spill) {
+                fwrite(&o, sizeof(o), 1, s->spill);
+            } else {
+                printFn(o);
+            }
+        }
+        s->lastTm = pr.tm;
+        return true;
+    };
+    pcapMap->walk(s->warm, s->begin, f);
+    snapFlows(*s->sh, s->atStart);
+    emit = true;
+    pcapMap->walk(s->begin, s->end, f);
+    snapFlows(*s->sh, s->atEnd);
+}
+
+static void runSlices()
+{
+    // capture times are offset by the first usable packet's (as in a sequential run)
+    pcapMap->walk(pcapMap->first(), pcapMap->size(),
+        [](const uint8_t* bytes, uint32_t caplen, uint32_t len, int64_t sec, int64_t usec) {
+            pktRec pr;
+            if (!mapFiltered(bytes, caplen, len, sec, usec) ||
+                rawParsePkt(bytes, caplen, len, pr) != parseRes::ok) {
+                return true;
+            }
+            setCapTm(sec, usec, pr);
+            return false;
+        });
+    if (offTm < 0) {
+        return;     // (no usable packets)
+    }
+    std::vector<size_t> b = pcapMap->slices(nSlices);
+    std::vector<std::unique_ptr<sliceCtx>> sl;
+    for (size_t i = 0; i + 1 < b.size(); i++) {
+        auto s = std::make_unique<sliceCtx>();
+        s->sh->tsTbl.setMaxAge(tsvalMaxAge);
+        s->begin = b[i];
+        s->end = b[i + 1];
+        s->warm = s->begin;
+        if (i > 0) {
+            int64_t t;
+            if (pcapMap->recSec(s->begin, t)) {
+                s->warm = pcapMap->seekTime(t - int64_t(sliceWarmup), b[0], s->begin);
+            }
+            s->spill = std::tmpfile();
+            if (s->spill == nullptr) {
+                std::cerr << "Couldn't create a temporary file for --slices: "
+                          << strerror(errno) << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        sl.emplace_back(std::move(s));
+    }
+    std::vector<std::thread> threads;
+    for (auto& s : sl) {
+        threads.emplace_back(sliceLoop, s.get());
+    }
+    threads[0].join();
+    flowSnaps prev = std::move(sl[0]->atEnd);
+    for (size_t i = 1; i < sl.size(); i++) {
+        threads[i].join();
+        sliceCtx& s = *sl[i];
+        // bytes sent up to the slice start and min RTT so far, by flow
+        flowSnaps carry;
+        for (const auto& [k, p] : prev) {
+            auto it = s.atStart.find(k);
+            carry[k] = {p.bytes - (it == s.atStart.end() ? 0. : it->second.bytes), p.minPP};
         }
-    } else {
-        // offset capture time
-        int64_t tt = static_cast<int64_t>(pkt.timestamp().seconds()) - offTm;
-        capTm = double(tt) + double(pkt.timestamp().microseconds()) * 1e-6;
+        rewind(s.spill);
+        outRec o;
+        while (fread(&o, sizeof(o), 1, s.spill) == 1) {
+            auto it = carry.find(o.fk);
+            if (it != carry.end()) {
+                o.bytesSnt += it->second.bytes;
+                if (o.rtt >= 0. && it->second.minPP < o.minPP) {
+                    o.minPP = it->second.minPP;
+                }
+            }
+            printFn(o);
+        }
+        fclose(s.spill);
+        for (auto& [k, e] : s.atEnd) {
+            auto it = carry.find(k);
+            if (it != carry.end()) {
+                e.bytes += it->second.bytes;
+                e.minPP = std::min(e.minPP, it->second.minPP);
+            }
+            prev[k] = e;
+        }
+    }
+    for (const auto& s : sl) {
+        pktCnt += s->pkts;
+        not_tcp += s->notTCP;
+        no_TS += s->noTS;
+        not_v4or6 += s->notV4or6;
+    }
+    capTm = sl.back()->lastTm;
+    shards.clear();
+    shards.emplace_back(std::move(sl.back()->sh));
+    if (sumInt) {
+        printSummary();
     }
+}
 
-    std::string fstr = pi.IPsrc + "+" + pi.IPdst;  // could add DSCP field to key
+/*
+ * Flow state snapshots (--state, see stateFile.hpp). While running, a
+ * snapshot is made by asking each shard's thread for its part (as for
+ * the control socket's flow lists) every stateInt seconds then written
+ * to a temporary file that's renamed over the old snapshot. A last one
+ * is written after capture stops (by SIGTERM, SIGINT or the end of the
+ * input). At startup a snapshot that isn't older than stateMaxAge is
+ * loaded so the flows carry on from where they were.
+ */
+static std::mutex stateMtx;     // (snapshot writers only, not the packet path)
+static bool stateFinal;         // the last snapshot is written (guarded by stateMtx)
+static std::mutex stopMtx;      // stops the periodic snapshot thread
+static std::condition_variable stopCv;
+static bool stateStop;          // (guarded by stopMtx)
 
-    // Creates a flowDly entry whenever needed
-    flowDly* fr;
-    if (flows.count(fstr) == 0u) {
-        if (flowCnt > maxFlows) {
-            return;                 // stop adding flows till something goes away
-        }
-        fr = new flowDly(fstr);
-        fr->startTm =  capTm;
-        fr->startTS = pi.ts = extendTS(ts, &(fr->twrap));
-        fr->startTS = pi.ts;
-        flowCnt++;
-        flows.emplace(fstr, fr);
-        // only record tsvals when capturing both directions of a flow
-        // if this flow is the reverse of a known flow, mark both as bi-directional
-        if (flows.count(pi.IPdst + "+" + pi.IPsrc) != 0u) {
-            flowDly* rfr = flows.at(pi.IPdst + "+" + pi.IPsrc);
-            if (rfr == nullptr)
-                std::cerr << "Shouldn't be a nullptr\n";
-            rfr->revFlow = true;
-            rfr->rfp = fr;
-            fr->revFlow = true;
-            fr->rfp = rfr;
+// write a snapshot to 'path'. 'viaShards' is false once the shards' threads
+// are done, for the last snapshot; none are written after that one.
+static bool writeState(const std::string& path, bool viaShards)
+{
+    std::lock_guard<std::mutex> lk(stateMtx);
+    if (stateFinal) {
+        return false;
+    }
+    stateFinal = !viaShards;
+    for (auto& sh : shards) {
+        if (!viaShards) {
+            serveSnap(*sh);
+            continue;
         }
-    } else {
-        try {
-            fr = flows.at(fstr);
-            pi.ts = extendTS(ts, &(fr->twrap));
-        } catch (std::out_of_range) {   //shouldn't happen since tested first
-            std::cerr << "processPacket: no flow in map though count is non-zero\n";
-            return;
+        uint32_t want = sh->snapWant.fetch_add(1, std::memory_order_release) + 1;
+        for (int n = 0; int32_t(sh->snapDone.load(std::memory_order_acquire) - want) < 0; n++) {
+            if (n >= 2000) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
     }
-    pi.tm = fr->_lastTm = capTm;
-    pi.sz = pkt.pdu()->size();    
-    pi.ecr = extendTS(ecr, &(fr->ewrap));
-    pi.dv[0] = pi.dv[1] = pi.dv[2] = -1.;
-    fr->bytesSnt += (double)pi.sz;
-    fr->pktCnt++;
-    bool dvs = fr->computeDV(pi);
-    double outTm = -1.;   //time of outbound pping match packet
-    if(fr->revFlow) {
-        outTm = getTStm(pi.IPdst + "+" + pi.IPsrc + "+" + ecrVal);
-        if (!filtLocal || (localIP != dstHst)) {    //track for ppings
-            addTS(fstr + "+" + tsVal, capTm);
+    stateHdr h{};
+    memcpy(h.magic, "DLYS", 4);
+    h.version = stateVersion;
+    h.flowSize = sizeof(flowState);
+    h.offTm = -1;
+    for (auto& sh : shards) {
+        h.nFlows += sh->snapFlows.size();
+        h.nPts += sh->snapPts.size();
+        h.nTs += sh->snapTs.size();
+        h.offTm = std::max(h.offTm, sh->snapOffTm);
+        for (const auto& f : sh->snapFlows) {
+            h.lastTm = std::max(h.lastTm, f.lastTm);
         }
-    } else
-        uniDir++;
-
-    //output metrics [would like to consolidate print stuff into a printPacket method]
-    if (dvs && (!fr->revFlow || outTm < 0.)) { //check for no pping for this sample
-        if (machineReadable) {
-            printf("%" PRId64 ".%06d -1 -1 %.0f %.6f %.6f %.6f",
-                int64_t(capTm + offTm), int((capTm - floor(capTm)) * 1e6), fr->bytesSnt,
-                        pi.dv[0], pi.dv[1], pi.dv[2]);
-        } else {
-                char tbuff[80];
-                struct tm* ptm = std::localtime(&result);
-                strftime(tbuff, 80, "%T", ptm);
-                printf("%s - -", tbuff);
-                for(int i=0; i < 3; i++) {
-                    if(pi.dv[i] > -1.)
-                        printf(" %s", fmtTimeDiff((double)pi.dv[i]).c_str());
-                    else
-                        printf(" -");
-                }
-
-       }
-    } else if(outTm > 0.) {    //this is a return pping
-        // this packet is a return "pping" -- process it for packet's src
-        double rtt = capTm - outTm;
-        if (fr->_minPP > rtt)  {
-            fr->_minPP = rtt; // reset minimum
-            fr->_minTS = pi.ts - fr->startTS;
-            fr->_minTm = capTm;
+    }
+    if (h.offTm < 0) {
+        return false;       // (no packets yet)
+    }
+    h.wallTm = time(nullptr);
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == nullptr) {
+        std::cerr << "Couldn't write state snapshot " << tmp << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    // make the shards' point and flow indices global
+    uint64_t pts = 0;
+    for (auto& sh : shards) {
+        for (auto& fs : sh->snapFlows) {
+            fs.pts += pts;
         }
-        if (machineReadable) {
-            printf("%" PRId64 ".%06d %.6f %.6f %.0f %.6f %.6f %.6f",
-                int64_t(capTm + offTm), int((capTm - floor(capTm)) * 1e6),
-                    rtt, fr->_minPP, fr->bytesSnt, pi.dv[0], pi.dv[1], pi.dv[2]);
-        } else {
-            char tbuff[80];
-            struct tm* ptm = std::localtime(&result);
-            strftime(tbuff, 80, "%T", ptm);
-            printf("%s %s %s", tbuff, fmtTimeDiff(rtt).c_str(),
-               fmtTimeDiff(fr->_minPP).c_str());
-            for(int i=0; i < 3; i++) {
-                if(pi.dv[i] > -1.)
-                    printf(" %s", fmtTimeDiff((double)pi.dv[i]).c_str());
-                else
-                    printf(" -");
-            }
+        pts += sh->snapPts.size();
+        fwrite(sh->snapFlows.data(), sizeof(flowState), sh->snapFlows.size(), f);
+    }
+    for (auto& sh : shards) {
+        fwrite(sh->snapPts.data(), sizeof(statePt), sh->snapPts.size(), f);
+    }
+    uint32_t flows = 0;
+    for (auto& sh : shards) {
+        for (auto& t : sh->snapTs) {
+            t.flow += flows;
         }
-    } else
-        return; //no metrics to print
-
-    printf(" %s\n", fstr.c_str());
-    int64_t now = clock_now();
-    if (now - nextFlush >= 0) {
-        nextFlush = now + flushInt;
-        fflush(stdout);
+        flows += sh->snapFlows.size();
+        fwrite(sh->snapTs.data(), sizeof(tsState), sh->snapTs.size(), f);
+    }
+    bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Couldn't write state snapshot " << path << ": " << strerror(errno) << "\n";
+        unlink(tmp.c_str());
+        return false;
     }
+    return true;
 }
 
-static void cleanUp(double n)
+// restore the flows and TSvals of the snapshot at 'path' (before any packets)
+static void loadState(const std::string& path)
 {
-    // erase entry if its TSval was seen more than tsvalMaxAge
-    // seconds in the past. 
-    for (auto it = tsTbl.begin(); it != tsTbl.end();) {
-        if (capTm - std::abs(it->second) > tsvalMaxAge) {
-            it = tsTbl.erase(it);
-        } else {
-            ++it;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            std::cerr << "Couldn't open state snapshot " << path << ": " << strerror(errno) << "\n";
         }
+        return;
     }
-    for (auto it = flows.begin(); it != flows.end();) {
-        flowDly* fr = it->second;
-        if (n - fr->_lastTm > flowMaxIdle) {
-            if(fr->revFlow) {
-                fr->rfp->revFlow = false;
-                fr->rfp->rfp = nullptr;
+    struct stat st;
+    void* m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    const stateHdr* h = m == MAP_FAILED ? nullptr : stateCheck(m, st.st_size);
+    int64_t age = h ? time(nullptr) - h->wallTm : 0;
+    if (h == nullptr) {
+        std::cerr << path << " isn't a state snapshot from this version of dlyloc, not restoring\n";
+    } else if (stateMaxAge > 0. && age > stateMaxAge) {
+        std::cerr << "State snapshot " << path << " is " << age << "s old, not restoring\n";
+    } else {
+        const flowState* fl = stateFlows(h);
+        const statePt* pts = statePts(h);
+        std::vector<std::pair<flowShard*, uint32_t>> ids(h->nFlows);   // (shard, new flow id) by index
+        for (auto& sh : shards) {
+            sh->idle.start(h->lastTm);
+        }
+        int n = 0, bad = 0;
+        for (uint32_t i = 0; i < h->nFlows; i++) {
+            const flowState& s = fl[i];
+            if (!stateFlowOk(h, s)) {
+                bad++;      // (damaged: its points aren't in the file)
+                continue;
             }
-            delete it->second;
-            it = flows.erase(it);
-            flowCnt--;
-            continue;
+            flowShard& sh = *shards[s.fk.symHash() % shards.size()];
+            if (sh.flowCnt.load(std::memory_order_relaxed) >= shardMaxFlows || sh.flows.count(s.fk)) {
+                continue;
+            }
+            uint32_t fi = sh.pool.alloc(s.fk);
+            flowDly& fr = sh.pool[fi];
+            loadFlow(fr, s, pts);
+            if (!fr.full && (!tiered || tier.watch.match(s.fk))) {
+                fr.promote();
+            }
+            fr._id = sh.newFlowId();
+            bump(sh.flowCnt);
+            sh.flows.emplace(s.fk, fi);
+            sh.idle.add(fr._lastTm + flowMaxIdle, {fi, uint32_t(fr._id)});
+            ids[i] = {&sh, uint32_t(fr._id)};
+            n++;
+        }
+        // both directions of a flow are in the same shard
+        for (auto& sh : shards) {
+            for (const auto& [k, fi] : sh->flows) {
+                flowDly& fr = sh->pool[fi];
+                auto rit = sh->flows.find(k.reverse());
+                if (fr.revFlow || rit == sh->flows.end()) {
+                    continue;
+                }
+                flowDly& rfr = sh->pool[rit->second];
+                fr.revFlow = rfr.revFlow = true;
+                fr.rfi = rit->second;
+                fr._rid = rfr._id;
+                rfr.rfi = fi;
+                rfr._rid = fr._id;
+            }
+        }
+        const tsState* ts = stateTs(h);
+        for (uint64_t i = 0; i < h->nTs; i++) {
+            uint32_t fl = ts[i].flow & tsvalTable::idMask;
+            if (fl < h->nFlows && ids[fl].first) {
+                ids[fl].first->tsTbl.restore(ids[fl].second, ts[i].tsv, ts[i].tm,
+                                             (ts[i].flow & tsvalTable::usedBit) != 0);
+            }
+        }
+        offTm = h->offTm;
+        capTm = h->lastTm;
+        warmStart = true;
+        if (sumInt) {
+            std::cerr << "Restored " << n << " flows from " << path << " (" << age << "s old)\n";
+        }
+        if (bad) {
+            std::cerr << "Skipped " << bad << " damaged flows in state snapshot " << path << "\n";
         }
-        ++it;
+    }
+    if (m != MAP_FAILED) {
+        munmap(m, st.st_size);
     }
 }
 
-// return the local ip address of 'ifname'
-// XXX since an interface can have multiple addresses, both IP4 and IP6,
-// this should really create a set of all of them and later test for
-// membership. But for now we just take the first IP4 address.
-static std::string localAddrOf(const std::string ifname)
-{
-    std::string local{};
-    struct ifaddrs* ifap;
+/*
+ * Control socket commands (--control). Each reply ends with a line that's
+ * "ok" or starts with "error:".
+ *   get                    current settings
+ *   set <name> <value>     change filter, tsvalMaxAge, flowMaxIdle, sumInt,
+ *                          maxFlows, output (human or machine) or tiered
+ *                          (a --tiered spec or off). A lower maxFlows is
+ *                          reached by evicting flows as new ones arrive.
+ *   watch add|del <pfx>[,<pfx>..]   change the --watch list
+ *   watch clear
+ *   top [N]                the N (default 10) flows with the most queueing
+ *                          delay (latest RTT less min RTT)
+ *   flows <file>           write a line for every flow to <file>
+ *                          (lines of both give a flow's packet count only
+ *                          up to 65535, printed as "65535+" past that)
+ *   snapshot [file]        write a --state snapshot to <file> (default the
+ *                          --state file)
+ * Settings changes go out as a new runCfg. Flow state is read by asking
+ * each shard's thread for a dump, which it makes between packets (or
+ * when capture is idle), so nothing the packet path uses is locked.
+ */
+static ctlSocket* ctl;
+static bool filterSettable;     // input's filter can be changed while running
+static int ctlThreads;          // threads flow state is divided among
 
-    if (getifaddrs(&ifap) == 0) {
-        for (auto ifp = ifap; ifp; ifp = ifp->ifa_next) {
-            if (ifname == ifp->ifa_name &&
-                  ifp->ifa_addr->sa_family == AF_INET) {
-                uint32_t ip = ((struct sockaddr_in*)
-                               ifp->ifa_addr)->sin_addr.s_addr;
-                local = IPv4Address(ip).to_string();
-                break;
+// each shard's flows (as of when its thread got to the request)
+static bool collectFlows(std::vector<flowSum>& v)
+{
+    std::vector<uint32_t> want;
+    for (auto& sh : shards) {
+        want.push_back(sh->dumpWant.fetch_add(1, std::memory_order_release) + 1);
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        for (int n = 0; shards[i]->dumpDone.load(std::memory_order_acquire) != want[i]; n++) {
+            if (n >= 2000) {
+                return false;   // (not processing packets, e.g. libtins input that's idle)
             }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
-        freeifaddrs(ifap);
+        v.insert(v.end(), shards[i]->dump.begin(), shards[i]->dump.end());
     }
-    return local;
+    return true;
 }
 
-static inline std::string printnz(int v, const char *s) {
-    return (v > 0? std::to_string(v) + s : "");
+static std::string flowLine(const flowSum& f)
+{
+    char b[128];
+    snprintf(b, sizeof(b), "%.6f %.6f %.6f %.0f %u%s %s ", f.lastTm, f.minPP < 1e30 ? f.minPP : -1.,
+             f.qdly, f.bytes, unsigned(f.pkts), f.pkts == UINT16_MAX ? "+" : "", f.clkSet ? "clk" : "-");
+    return b + f.fk.to_string() + "\n";
 }
 
-static void printSummary()
+static std::string ctlCommand(const std::string& ln)
 {
-    std::cerr << flowCnt << " flows, "
-              << pktCnt << " packets, " +
-                 printnz(no_TS, " no TS opt, ") +
-                 printnz(uniDir, " uni-directional, ") +
-                 printnz(not_tcp, " not TCP, ") +
-                 printnz(not_v4or6, " not v4 or v6, ") +
-                 "\n";
+    std::vector<std::string> a;
+    std::vector<size_t> at;         // where each word starts in 'ln'
+    for (size_t b = ln.find_first_not_of(' '); b != std::string::npos; b = ln.find_first_not_of(' ', b)) {
+        size_t e = std::min(ln.find(' ', b), ln.size());
+        a.push_back(ln.substr(b, e - b));
+        at.push_back(b);
+        b = e;
+    }
+    const runCfg& c = *cfg.read();     // (this thread is the only writer)
+    auto err = [](const std::string& m) { return "error: " + m + "\n"; };
+    if (a.empty()) {
+        return err("empty command");
+    }
+    if (a[0] == "get") {
+        char b[512];
+        snprintf(b, sizeof(b), "filter %s\ntsvalMaxAge %g\nflowMaxIdle %g\nsumInt %g\nmaxFlows %d\n"
+                 "output %s\ntiered %s\nwatch %s\nok\n", c.filter.c_str(), c.tsvalMaxAge,
+                 c.flowMaxIdle, c.sumInt, c.shardMaxFlows * ctlThreads,
+                 c.fmt == outFmt::binary ? "binary" : c.fmt == outFmt::machine ? "machine" : "human",
+                 c.tiered ? c.tier.spec().c_str() : "off", c.tier.watch.to_string().c_str());
+        return b;
+    }
+    if (a[0] == "snapshot") {
+        std::string path = a.size() > 1 ? a[1] : statePath;
+        if (path.empty()) {
+            return err("snapshot needs a file name (no --state file)");
+        }
+        return writeState(path, true) ? "ok\n" : err("snapshot not written (see dlyloc's stderr)");
+    }
+    if (a[0] == "top" || a[0] == "flows") {
+        FILE* f = nullptr;
+        size_t n = a[0] == "top" && a.size() > 1 ? atoi(a[1].c_str()) : 10;
+        if (a[0] == "flows" && (a.size() != 2 || (f = fopen(a[1].c_str(), "w")) == nullptr)) {
+            return err(a.size() != 2 ? "flows needs a file name" : a[1] + ": " + strerror(errno));
+        }
+        std::vector<flowSum> v;
+        bool ok = collectFlows(v);
+        std::string r;
+        if (f) {
+            fprintf(f, "# lastTm minRTT qdly bytes pkts clock flow\n"
+                       "# (pkts stops counting at 65535, shown as 65535+)\n");
+            for (const auto& fs : v) {
+                fputs(flowLine(fs).c_str(), f);
+            }
+            fclose(f);
+        } else {
+            std::sort(v.begin(), v.end(), [](const flowSum& x, const flowSum& y) {
+                return x.qdly > y.qdly;
+            });
+            for (size_t i = 0; i < v.size() && i < n; i++) {
+                r += flowLine(v[i]);
+            }
+        }
+        return r + (ok ? "ok\n" : err("some flows weren't reported (no packets being processed)"));
+    }
+    auto n = std::make_unique<runCfg>(c);
+    if (a[0] == "set" && a.size() >= 3) {
+        const std::string& k = a[1];
+        double v = atof(a[2].c_str());
+        if (k == "filter") {
+            if (!filterSettable) {
+                return err("the filter can't be changed for this input");
+            }
+            // (the rest of the line is the expression, spaces and all)
+            std::string x = ln.substr(at[2], ln.find_last_not_of(' ') + 1 - at[2]);
+            std::string f = x == "tcp" ? "tcp" : "tcp and (" + x + ")";
+            pcap_t* dead = pcap_open_dead(ctlDlt.load(std::memory_order_relaxed), SNAP_LEN);
+            struct bpf_program fp;
+            bool ok = pcap_compile(dead, &fp, f.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0;
+            std::string e = ok ? "" : pcap_geterr(dead);
+            if (ok) {
+                pcap_freecode(&fp);
+            }
+            pcap_close(dead);
+            if (!ok) {
+                return err("filter: " + e);
+            }
+            n->filter = f;
+        } else if (k == "tsvalMaxAge" && v > 0.) {
+            n->tsvalMaxAge = v;
+        } else if (k == "flowMaxIdle" && v > 0.) {
+            n->flowMaxIdle = v;
+        } else if (k == "sumInt" && v >= 0.) {
+            n->sumInt = v;
+        } else if (k == "maxFlows" && v >= 1.) {
+            n->shardMaxFlows = std::max(1, int(v) / ctlThreads);
+        } else if (k == "output" && (a[2] == "human" || a[2] == "machine")) {
+            if (c.fmt == outFmt::binary || colOut) {
+                return err("only text output can be switched");
+            }
+            n->fmt = a[2] == "human" ? outFmt::human : outFmt::machine;
+        } else if (k == "tiered") {
+            tierCfg t;
+            if (a[2] != "off" && !t.parse(a[2])) {
+                return err("tiered needs off or bytes=N,secs=S,rtt=P");
+            }
+            t.watch = c.tier.watch;
+            n->tier = t;
+            n->tiered = a[2] != "off";
+        } else {
+            return err("can't set " + k + " to " + a[2]);
+        }
+    } else if (a[0] == "watch" && a.size() == 2 && a[1] == "clear") {
+        n->tier.watch = watchList{};
+    } else if (a[0] == "watch" && a.size() == 3 && (a[1] == "add" || a[1] == "del")) {
+        for (size_t b = 0, e; b <= a[2].size(); b = e + 1) {
+            e = std::min(a[2].find(',', b), a[2].size());
+            std::string p = a[2].substr(b, e - b);
+            if (a[1] == "add" ? !n->tier.watch.add(p) : !n->tier.watch.remove(p)) {
+                return err(p + (a[1] == "add" ? " isn't an address prefix" : " isn't in the watch list"));
+            }
+        }
+        n->tiered |= a[1] == "add";
+    } else {
+        return err("unknown command (get, set, watch, top, flows, snapshot)");
+    }
+    n->gen = c.gen + 1;
+    cfg.update(n.release());
+    return "ok\n";
 }
 
 static struct option opts[] = {
@@ -452,15 +2542,44 @@ static struct option opts[] = {
     { "verbose",   no_argument,       nullptr, 'v' },
     { "showLocal", no_argument,       nullptr, 'l' },
     { "machine",   no_argument,       nullptr, 'm' },
+    { "binary",    no_argument,       nullptr, 'b' },
+    { "columnar",  required_argument, nullptr, 'C' },
     { "sumInt",    required_argument, nullptr, 'S' },
     { "tsvalMaxAge", required_argument, nullptr, 'M' },
     { "flowMaxIdle", required_argument, nullptr, 'F' },
+    { "threads",   required_argument, nullptr, 't' },
+    { "pipeline",  no_argument,       nullptr, 'p' },
+    { "libtins",   no_argument,       nullptr, 'T' },
+    { "tpacket",   no_argument,       nullptr, 'K' },
+    { "fanout",    required_argument, nullptr, 'O' },
+    { "xdp",       no_argument,       nullptr, 'X' },
+    { "slices",    required_argument, nullptr, 'N' },
+    { "hullPts",   required_argument, nullptr, 'H' },
+    { "maxFlows",  required_argument, nullptr, 'W' },
+    { "flowMem",   required_argument, nullptr, 'G' },
+    { "digest",    no_argument,       nullptr, 'D' },
+    { "prefix",    required_argument, nullptr, 'x' },
+    { "topk",      required_argument, nullptr, 'k' },
+    { "stats",     required_argument, nullptr, 'Z' },
+    { "sample",    required_argument, nullptr, 'P' },
+    { "adaptive",  no_argument,       nullptr, 'A' },
+    { "seqack",    no_argument,       nullptr, 'Q' },
+    { "send",      required_argument, nullptr, 'E' },
+    { "cpName",    required_argument, nullptr, 'J' },
+    { "tiered",    required_argument, nullptr, 'L' },
+    { "watch",     required_argument, nullptr, 'Y' },
+    { "control",   required_argument, nullptr, 'U' },
+    { "state",     required_argument, nullptr, 'R' },
+    { "stateInt",  required_argument, nullptr, 'V' },
+    { "stateMaxAge", required_argument, nullptr, 'B' },
+    { "hugepages", required_argument, nullptr, 'g' },
+    { "numa",      no_argument,       nullptr, 'u' },
     { "help",      no_argument,       nullptr, 'h' },
     { 0, 0, 0, 0 }
 };
 
 static void usage(const char* pname) {
-    std::cerr << "usage: " << pname << " [flags] -i interface | -r pcapFile\n";
+    std::cerr << "usage: " << pname << " [flags] -i interface | -r pcapFile|dir [pcapFile|dir ...]\n";
 }
 
 static void help(const char* pname) {
@@ -468,7 +2587,10 @@ static void help(const char* pname) {
     std::cerr << " flags:\n"
 "  -i|--interface ifname   do live capture from interface <ifname>\n"
 "\n"
-"  -r|--read pcap     process capture file <pcap>\n"
+"  -r|--read pcap     process capture file <pcap>. More files or directories\n"
+"                     (e.g., tcpdump -G rotations) can follow the flags;\n"
+"                     they're read in first packet time order as one\n"
+"                     continuous capture.\n"
 "\n"
 "  -f|--filter expr   pcap filter applied to packets.\n"
 "                     Eg., \"-f 'net 74.125.0.0/16 or 45.57.0.0/17'\"\n" 
@@ -481,6 +2603,33 @@ static void help(const char* pname) {
 "                     times have a resolution of 1us (6 digits after\n"
 "                     decimal point).\n"
 "\n"
+"  -b|--binary        compact binary records (see outWriter.hpp)\n"
+"                     instead of text lines.\n"
+"\n"
+"  --send dest        (implies -b) send the binary records to a dlycollect\n"
+"                     collector at dest, tcp:host:port or udp:host:port\n"
+"\n"
+"  --cpName name      name this capture point in binary output (default for\n"
+"                     --send: the host name)\n"
+"\n"
+"  -C|--columnar file write output to <file> in a chunked columnar format\n"
+"                     (see colWriter.hpp) rather than to stdout\n"
+"\n"
+"  --digest           instead of a line per packet, print each flow's rtt,\n"
+"                     min rtt and delay variation percentiles (count, min,\n"
+"                     p10, p50, p90, p99, max) every sumInt seconds\n"
+"\n"
+"  --prefix v4[,v6]   (implies --digest) also summarize by src/dst prefix\n"
+"                     pair using prefixes of these lengths (default 24,48).\n"
+"                     Give --digest too to get per-flow summaries as well.\n"
+"\n"
+"  --topk K           instead of a line per packet, print the K flows with\n"
+"                     the most queueing delay (rtt - min rtt) and dv1 every\n"
+"                     sumInt seconds, ranked by the sum over the interval.\n"
+"                     Memory is fixed (4K counters) however many flows\n"
+"                     there are. With --prefix, src/dst prefix pairs are\n"
+"                     ranked instead; give --digest too to rank both.\n"
+"\n"
 "  -c|--count num     stop after capturing <num> packets\n"
 "\n"
 "  -s|--seconds num   stop after capturing for <num> seconds \n"
@@ -495,8 +2644,97 @@ static void help(const char* pname) {
 "\n"
 "  --tsvalMaxAge num  max age of an unmatched tsval (default 10s)\n"
 "\n"
+"  --seqack           also match acks to the data segment they ack by seq\n"
+"                     number (and ECR) so the RTT is to that segment rather\n"
+"                     than to the first packet with its TSval. Keeps up to\n"
+"                     32 unacked segments per flow. Not with --xdp.\n"
+"\n"
+"  --tiered spec      track RTTs of all flows but only estimate clocks and\n"
+"                     delay variations for flows that have sent bytes=N\n"
+"                     (k, M or G suffix ok), lasted secs=S or had an RTT\n"
+"                     above percentile rtt=P of recent ones (comma separated,\n"
+"                     any of them promotes a flow), e.g., bytes=100k,rtt=90\n"
+"\n"
+"  --watch pfx[,pfx]  (implies --tiered) also promote flows to or from these\n"
+"                     address prefixes, e.g., 10.1.0.0/16,2001:db8::/32\n"
+"\n"
 "  --flowMaxIdle num  flows idle longer than <num> are deleted (default 300s)\n"
 "\n"
+"  --maxFlows num     track at most <num> flows (default 10000)\n"
+"\n"
+"  --flowMem size     limit flow state to <size> bytes (k, M or G suffix ok)\n"
+"                     rather than a flow count. When the limit is reached\n"
+"                     flows are evicted, uni-directional and unclocked\n"
+"                     ones first.\n"
+"\n"
+"  --stats file       (built with STATS=1) keep per-stage timing histograms\n"
+"                     and table counters and write them to <file> in\n"
+"                     Prometheus text format about once a second\n"
+"\n"
+"  --sample N         only track 1 in N flows (rounded up to a power of\n"
+"                     2), chosen by a hash of the flow so both directions\n"
+"                     of a sampled flow are kept\n"
+"\n"
+"  --adaptive         (live capture) sample fewer flows when packets are\n"
+"                     being dropped or queues back up, and more again when\n"
+"                     load drops, down to the --sample rate. The current\n"
+"                     rate is shown in the summary.\n"
+"\n"
+"  --hullPts num      max lower hull points kept per flow for its clock\n"
+"                     estimate (default 64, 0 = no limit)\n"
+"\n"
+"  --control path     listen for commands on UNIX socket <path> to change\n"
+"                     settings (filter, tsvalMaxAge, flowMaxIdle, sumInt,\n"
+"                     maxFlows, output, tiered, watch list) while running\n"
+"                     or list flows (top N, flows file). 'get' shows the\n"
+"                     settings; e.g., echo 'set sumInt 1' | nc -U <path>\n"
+"\n"
+"  --state file       save flow state (clock estimates, min RTTs, pending\n"
+"                     TSvals) to <file> periodically and on exit (SIGTERM\n"
+"                     or SIGINT) and restore it on startup so a restart\n"
+"                     doesn't lose the flows' warm up\n"
+"  --stateInt secs    seconds between --state snapshots (default 60, 0 =\n"
+"                     only on exit or from the control socket)\n"
+"  --stateMaxAge secs don't restore a snapshot older than this (default\n"
+"                     300, 0 = any age)\n"
+"\n"
+"  -t|--threads num   process flows with <num> worker threads (default 1).\n"
+"                     Both directions of a flow go to the same worker.\n"
+"\n"
+"  --hugepages 2M|1G|thp  put each worker's flow and TSval tables (and its\n"
+"                     queues) in memory backed by reserved hugetlb pages of\n"
+"                     that size, or transparent hugepages (thp, also used\n"
+"                     when no reserved pages are left)\n"
+"  --numa             bind the capture thread to its NIC's NUMA node and\n"
+"                     spread the workers over the nodes, each with its tables\n"
+"                     on its own node. Memory by node is shown on exit.\n"
+"\n"
+"  -p|--pipeline      run capture, flow processing and output in separate\n"
+"                     threads connected by lock-free queues (implied by -t).\n"
+"                     For live capture, records that find a queue full are\n"
+"                     dropped (and counted in the summary) so a slow output\n"
+"                     consumer doesn't stall capture.\n"
+"\n"
+"  --libtins          decode packets with libtins rather than parsing\n"
+"                     headers in place in libpcap's buffers\n"
+"\n"
+"  --tpacket          (Linux, live capture) capture from a TPACKET_V3\n"
+"                     memory-mapped ring rather than through libpcap\n"
+"\n"
+"  --fanout id        (implies --tpacket) join PACKET_FANOUT group <id> so\n"
+"                     several dlyloc processes can split an interface's\n"
+"                     flows. Both directions of a flow go to the same one.\n"
+"\n"
+"  --xdp              (built with XDP=1, live capture) extract TCP timestamp\n"
+"                     records in an XDP program and only pass up packets\n"
+"                     with a new TSval/ECR pair. Sees received packets\n"
+"                     only (e.g., a tap or span port); -f isn't applied.\n"
+"\n"
+"  --slices N         (offline) split the capture file into N parts\n"
+"                     processed in parallel. Output is the same as a\n"
+"                     sequential run except for delay variations shortly\n"
+"                     after each split point.\n"
+"\n"
 "  -h|--help          print help then exit\n"
 ;
 }
@@ -504,16 +2742,25 @@ static void help(const char* pname) {
 int main(int argc, char* const* argv)
 {
     bool liveInp = false;
+    bool useRaw = true;
+    bool useTpacket = false;
+    bool useXdp = false;
+    bool digFlows = false, digPfx = false;
+    int topK = 0;
+    bool useNuma = false;
+    int digV4len = 24, digV6len = 48;
+    double digInt = sumInt;     // (not turned off by -q)
+    int fanout = 0;
     std::string fname;
     if (argc <= 1) {
         help(argv[0]);
         exit(1);
     }
-    for (int c; (c = getopt_long(argc, argv, "i:r:f:c:s:hlmqv",
+    for (int c; (c = getopt_long(argc, argv, "i:r:f:c:s:t:C:bhlmpqv",
                                  opts, nullptr)) != -1; ) {
         switch (c) {
         case 'i': liveInp = true; fname = optarg; break;
-        case 'r': fname = optarg; break;
+        case 'r': fname = optarg; inFiles.push_back(optarg); break;
         case 'f': filter += " and (" + std::string(optarg) + ")"; break;
         case 'c': maxPackets = atof(optarg); break;
         case 's': time_to_run = atof(optarg); break;
@@ -521,19 +2768,238 @@ int main(int argc, char* const* argv)
         case 'v': break; // summary on by default
         case 'l': filtLocal = false; break;
         case 'm': machineReadable = true; break;
-        case 'S': sumInt = atof(optarg); break;
+        case 'b': binaryOut = true; break;
+        case 'C':
+            colOut = new colWriter;
+            if (!colOut->open(optarg)) {
+                std::cerr << "Couldn't open columnar output " << colOut->_err << "\n";
+                exit(1);
+            }
+            break;
+        case 'S': sumInt = digInt = atof(optarg); break;
         case 'M': tsvalMaxAge = atof(optarg); break;
         case 'F': flowMaxIdle = atof(optarg); break;
+        case 't': nThreads = atoi(optarg); break;
+        case 'p': pipelined = true; break;
+        case 'T': useRaw = false; break;
+        case 'K': useTpacket = true; break;
+        case 'X': useXdp = true; break;
+        case 'O': useTpacket = true; fanout = atoi(optarg); break;
+        case 'N': nSlices = atoi(optarg); break;
+        case 'D': digFlows = true; break;
+        case 'x':
+            digPfx = true;
+            if (sscanf(optarg, "%d,%d", &digV4len, &digV6len) < 1) {
+                std::cerr << "--prefix needs a length, e.g., 24 or 24,48\n";
+                exit(1);
+            }
+            break;
+        case 'k':
+            if ((topK = atoi(optarg)) < 1) {
+                std::cerr << "--topk needs a count of at least 1\n";
+                exit(1);
+            }
+            break;
+        case 'Z': statsFile = optarg; break;
+        case 'P':
+            while (sampleMinShift < sampleMaxShift && (1 << sampleMinShift) < atoi(optarg)) {
+                sampleMinShift++;
+            }
+            break;
+        case 'A': sampleAdapt = true; break;
+        case 'Q': seqAck = true; break;
+        case 'E': sendTo = optarg; binaryOut = true; break;
+        case 'J': cpName = optarg; break;
+        case 'U': ctlPath = optarg; break;
+        case 'R': statePath = optarg; break;
+        case 'V': stateInt = atof(optarg); break;
+        case 'B': stateMaxAge = atof(optarg); break;
+        case 'L':
+            tiered = true;
+            if (!tier.parse(optarg)) {
+                std::cerr << "--tiered needs bytes=N, secs=S and/or rtt=P (percentile), e.g., bytes=1M,rtt=95\n";
+                exit(1);
+            }
+            break;
+        case 'Y':
+            tiered = true;
+            for (size_t b = 0, e; b <= strlen(optarg); b = e + 1) {
+                std::string w = optarg;
+                e = std::min(w.find(',', b), w.size());
+                if (!tier.watch.add(w.substr(b, e - b))) {
+                    std::cerr << "--watch needs address prefixes, e.g., 10.1.0.0/16,2001:db8::/32\n";
+                    exit(1);
+                }
+            }
+            break;
+        case 'H': lhMaxPts = std::max(0, atoi(optarg)); break;
+        case 'W': maxFlows = atoi(optarg); break;
+        case 'G': {
+            char* e;
+            double v = strtod(optarg, &e);
+            switch (*e) {
+            case 'k': case 'K': v *= 1e3; break;
+            case 'm': case 'M': v *= 1e6; break;
+            case 'g': case 'G': v *= 1e9; break;
+            }
+            flowMem = size_t(v);
+            break;
+        }
+        case 'g':
+            hugeArena::on = true;
+            if (strcmp(optarg, "2M") == 0) {
+                hugeArena::hugeShift = 21;
+            } else if (strcmp(optarg, "1G") == 0) {
+                hugeArena::hugeShift = 30;
+            } else if (strcmp(optarg, "thp") != 0) {
+                std::cerr << "--hugepages takes 2M, 1G or thp\n";
+                exit(1);
+            }
+            break;
+        case 'u': useNuma = true; hugeArena::on = true; break;
         case 'h': help(argv[0]); exit(0);
         }
     }
+    if (!liveInp && !inFiles.empty()) {
+        // more capture files can follow the options (e.g., -r cap-*.pcap)
+        inFiles.insert(inFiles.end(), argv + optind, argv + argc);
+        optind = argc;
+        inFiles = expandInputs(inFiles);
+        if (inFiles.empty()) {
+            std::cerr << "No capture files in " << fname << "\n";
+            exit(1);
+        }
+        if (inFiles.size() > 1) {
+            orderInputs();
+        }
+        fname = inFiles[0];
+    }
     if (optind < argc || fname.empty()) {
         usage(argv[0]);
         exit(1);
     }
+    if (nThreads < 1) {
+        nThreads = 1;
+    }
+    pipelined |= nThreads > 1;
+    shardMaxFlows = std::max(1, flowMem ? int(flowMem / flowBytes / nThreads) : maxFlows / nThreads);
+    if (nSlices > 1 && (liveInp || pipelined || maxPackets > 0 || time_to_run > 0. || inFiles.size() > 1)) {
+        std::cerr << "--slices only applies to reading one file (-r) without -t, -p, -c or -s\n";
+        exit(1);
+    }
+    if (nSlices > 1 && !ctlPath.empty()) {
+        std::cerr << "--control can't be used with --slices\n";
+        exit(1);
+    }
+    if (nSlices > 1 && !statePath.empty()) {
+        std::cerr << "--state can't be used with --slices\n";
+        exit(1);
+    }
+#ifndef DLYLOC_STATS
+    if (!statsFile.empty()) {
+        std::cerr << "--stats needs a dlyloc built with STATS=1\n";
+        exit(1);
+    }
+#endif
+    if (sampleAdapt && !liveInp) {
+        std::cerr << "--adaptive only applies to live capture (-i)\n";
+        exit(1);
+    }
+    sampleShift = sampleMinShift;
+    if (topK) {
+        if (binaryOut || colOut) {
+            std::cerr << "--topk writes text reports (not -b or -C)\n";
+            exit(1);
+        }
+        topOut = new topkWriter(out, digInt, topK);
+        topOut->byFlow(digFlows || !digPfx);
+        if (digPfx) {
+            topOut->byPrefix(digV4len, digV6len);
+        }
+    } else if (digFlows || digPfx) {
+        if (binaryOut || colOut) {
+            std::cerr << "--digest and --prefix write text summaries (not -b or -C)\n";
+            exit(1);
+        }
+        digOut = new digestWriter(out, digInt);
+        digOut->byFlow(digFlows);
+        if (digPfx) {
+            digOut->byPrefix(digV4len, digV6len);
+        }
+    }
+    // with --numa the capture thread runs on its NIC's node (so the kernel
+    // allocates capture rings there) and workers are spread over the nodes
+    // starting with that one, each shard's arena on its worker's node
+    int capNode = -1, nNodes = 1;
+    if (useNuma) {
+        nNodes = numaNodes();
+        capNode = liveInp ? std::max(0, nicNode(fname)) : 0;
+        if (!bindToNode(capNode)) {
+            std::cerr << "warning: couldn't bind capture to NUMA node " << capNode << "\n";
+        }
+    }
+    for (int i = 0; i < nThreads; i++) {
+        int node = capNode < 0 ? -1 : pipelined ? (capNode + i) % nNodes : capNode;
+        shards.emplace_back(std::make_unique<flowShard>(node));
+        shards.back()->tsTbl.setMaxAge(tsvalMaxAge);
+    }
 
-    BaseSniffer* snif;
-    {
+#ifndef HAVE_LIBBPF
+    if (useXdp) {
+        std::cerr << "--xdp needs a dlyloc built with XDP=1 (libbpf)\n";
+        exit(1);
+    }
+#endif
+    if (useXdp) {
+        if (!liveInp) {
+            std::cerr << "--xdp only applies to live capture (-i)\n";
+            exit(1);
+        }
+        if (seqAck) {
+            std::cerr << "--seqack can't be used with --xdp (records don't carry seq numbers)\n";
+            exit(1);
+        }
+        useRaw = false;
+    }
+#ifdef __linux__
+    if (useTpacket) {
+        if (!liveInp) {
+            std::cerr << "--tpacket only applies to live capture (-i)\n";
+            exit(1);
+        }
+        openTpacket(fname, fanout);
+        useRaw = false;
+    }
+#else
+    if (useTpacket) {
+        std::cerr << "--tpacket capture is only available on Linux\n";
+        exit(1);
+    }
+#endif
+    if (inFiles.size() > 1) {
+        if (!useRaw) {
+            std::cerr << "several capture files can't be read with --libtins\n";
+            exit(1);
+        }
+        useRaw = false;
+    } else if (useRaw && !liveInp && openMapped(fname)) {
+        useRaw = false;
+    } else if (nSlices > 1) {
+        std::cerr << "--slices needs a pcap or pcapng file that can be mapped\n";
+        exit(1);
+    }
+    if (useRaw) {
+        pcapHndl = openPcap(fname, liveInp);
+        setRawDlt(pcap_datalink(pcapHndl));
+        if (!rawSupported(rawDlt)) {
+            std::cerr << fname << ": link type " << rawDlt
+                      << " not handled by the fast path, using libtins\n";
+            pcap_close(pcapHndl);
+            pcapHndl = nullptr;
+        }
+    }
+    BaseSniffer* snif = nullptr;
+    if (!pcapHndl && !pcapMap && !useTpacket && !useXdp && inFiles.size() <= 1) {
         SnifferConfiguration config;
         config.set_filter(filter);
         config.set_promisc_mode(false);
@@ -543,12 +3009,6 @@ int main(int argc, char* const* argv)
         try {
             if (liveInp) {
                 snif = new Sniffer(fname, config);
-                if (filtLocal) {
-                    localIP = localAddrOf(fname);
-                    if (localIP.empty()) {    
-                        filtLocal = false;  // couldn't get local ip addr
-                    }
-                }
             } else {
                 snif = new FileSniffer(fname, config);
             }
@@ -557,39 +3017,165 @@ int main(int argc, char* const* argv)
             exit(EXIT_FAILURE);
         }
     }
-    if (liveInp && machineReadable) {
+    if (liveInp && filtLocal) {
+        localIP = localAddrOf(fname);
+        if (localIP.empty()) {
+            filtLocal = false;  // couldn't get local ip addr
+        }
+    }
+    out.setFormat(binaryOut ? outFmt::binary :
+                  machineReadable ? outFmt::machine : outFmt::human);
+    if (!sendTo.empty() && cpName.empty()) {
+        char h[256] = "";
+        gethostname(h, sizeof(h) - 1);
+        cpName = h;
+    }
+    out.setName(cpName);
+    // (ids for twice the flow table's capacity so they rarely restart)
+    out.setMaxFlowIds(2 * size_t(shardMaxFlows) * std::max(nThreads, 1));
+    if (!sendTo.empty()) {
+        bool udp;
+        out.setFd(openCollector(sendTo, udp));
+        if (udp) {
+            out.setDatagram(1400);
+        }
+    }
+    if (liveInp && (machineReadable || binaryOut)) {
         // output every 100ms when piping to analysis/display program
         flushInt /= 10;
     }
     nextFlush = clock_now() + flushInt;
-    double nxtSum = 0., nxtClean = 0.;
+    wallFlush = liveInp;        // offline output is only written as buffers fill
+    pickPaths();
+
+    // settings that can change while running (the rcu readers are the
+    // capture thread, which is also the shard's and output thread when not
+    // pipelined, then each worker and the output thread)
+    int readers = 0;
+    if (!ctlPath.empty()) {
+        capRcu = readers++;
+        for (auto& sh : shards) {
+            sh->rcuId = pipelined ? readers++ : capRcu;
+        }
+        outRcu = pipelined ? readers++ : -1;
+    }
+    cfg.init(new runCfg{0, filter, tsvalMaxAge, flowMaxIdle, sumInt, shardMaxFlows,
+                        out.format(), tiered, tier}, readers);
+    if (!ctlPath.empty()) {
+        ctl = new ctlSocket;
+        if (!ctl->open(ctlPath)) {
+            std::cerr << "Couldn't open control socket " << ctl->_err << "\n";
+            exit(1);
+        }
+        filterSettable = !useXdp && snif == nullptr;
+        ctlThreads = nThreads;
+        std::thread([] { ctl->serve(ctlCommand); }).detach();
+    }
 
-    for (const auto& packet : *snif) {
-        processPacket(packet);
+    std::thread stateThread;    // periodic snapshots (--stateInt)
+    if (!statePath.empty()) {
+        loadState(statePath);
+        struct sigaction sa{};
+        sa.sa_handler = [](int) { stopReq = 1; };
+        sigaction(SIGTERM, &sa, nullptr);
+        sigaction(SIGINT, &sa, nullptr);
+        if (stateInt > 0.) {
+            stateThread = std::thread([] {
+                std::unique_lock<std::mutex> lk(stopMtx);
+                while (!stopCv.wait_for(lk, std::chrono::duration<double>(stateInt),
+                                        [] { return stateStop; })) {
+                    lk.unlock();
+                    writeState(statePath, true);
+                    lk.lock();
+                }
+            });
+        }
+    }
 
-        if ((time_to_run > 0. && capTm - startm >= time_to_run) ||
-            (maxPackets > 0 && pktCnt >= maxPackets)) {
-            printSummary();
-            std::cerr << "Captured " << pktCnt << " packets in "
-                      << (capTm - startm) << " seconds\n";
-            break;
+    std::vector<std::thread> threads;
+    if (pipelined) {
+        dropWhenFull = liveInp;
+        for (auto& sh : shards) {
+            workers.emplace_back(std::make_unique<workerCtx>(sh.get()));
         }
-        if (capTm >= nxtSum && sumInt) {
-            if (nxtSum > 0.) {
-                printSummary();
-                pktCnt = 0;
-                no_TS = 0;
-                uniDir = 0;
-                not_tcp = 0;
-                not_v4or6 = 0;
-            }
-            nxtSum = capTm + sumInt;
+        for (auto& w : workers) {
+            threads.emplace_back(workerLoop, w.get());
+        }
+        threads.emplace_back(outputLoop);
+    }
 
+    if (useXdp) {
+#ifdef HAVE_LIBBPF
+        runXdp(fname);
+#endif
+    } else if (useTpacket) {
+#ifdef __linux__
+        runTpacket();
+#endif
+    } else if (inFiles.size() > 1) {
+        runFiles();
+    } else if (pcapMap) {
+        if (nSlices > 1) {
+            runSlices();
+        } else {
+            runMapped();
+        }
+    } else if (pcapHndl) {
+        runPcap(liveInp);
+    } else {
+        pktRec pr;
+        for (const auto& packet : *snif) {
+            bool ok = parsePacket(packet, pr);
+            if (!handlePacket(ok, pr)) {
+                break;
+            }
+        }
+    }
+    // (a periodic snapshot needs the shards' threads so stop it first)
+    if (stateThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(stopMtx);
+            stateStop = true;
         }
-        if (capTm >= nxtClean) {
-            cleanUp(capTm);  // get rid of stale entries
-            nxtClean = capTm + tsvalMaxAge;
+        stopCv.notify_one();
+        stateThread.join();
+    }
+    if (pipelined) {
+        for (auto& w : workers) {
+            w->in.close();
+        }
+        for (auto& t : threads) {
+            t.join();
         }
     }
+    if (!statePath.empty()) {
+        writeState(statePath, false);
+    }
+    if (limitHit) {
+        printSummary();
+        std::cerr << "Captured " << pktCnt << " packets in "
+                  << (capTm - startm) << " seconds\n";
+    }
+    if (digOut) {
+        digOut->close();
+    }
+    if (topOut) {
+        topOut->close();
+    }
+    out.flush();
+#ifdef DLYLOC_STATS
+    if (!statsFile.empty()) {
+        writeStats();
+    }
+#endif
+    if (hugeArena::on && sumInt) {
+        printArenas();
+    }
+    if (colOut) {
+        colOut->close();
+    }
+    if (ctl) {
+        ctl->close();
+    }
     exit(0);
-}
+}
\ No newline at end of file
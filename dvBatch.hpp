@@ -0,0 +1,159 @@
+/*
+ * dvBatch: delay variations for a block of packets at once
+ *
+ * computeDV (flowDelay.hpp) does two different things for a packet: it
+ * updates the flow's clock estimate, which has to go packet by packet in
+ * order, then does a few multiplies, adds and compares with the clock
+ * parameters of the flow and of its reverse. For a batch of packets
+ * (a worker takes up to N at a time off its input ring) the first part
+ * is done per packet and gathers each packet's clock parameters, as they
+ * were right after its update, into one lane of the arrays here, so the
+ * parameters of flows scattered over the pool end up contiguous. Then
+ * compute() does the arithmetic for every lane with AVX2 (chosen at run
+ * time on x86-64), NEON (aarch64) or plain code. Each lane gets the same
+ * result computeDV would give; it uses fused multiply-adds only where the
+ * compiler would also fuse them in computeDV.
+ *
+ * A lane's dvs are -1 if they can't be computed and set[] is non-zero if
+ * any of them could (computeDV's return value).
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef DVBATCH_HPP
+#define DVBATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+struct dvBatch {
+    static constexpr size_t N = 64;     // max packets per batch
+
+    // inputs, one lane per packet. s* are the packet's source clock (the
+    // flow's) and d* its destination's (the reverse flow's): dt is the
+    // (extended) TSval or ECR minus the clock's zeroTS, sp seconds per tick
+    // and zt zeroTm. sOk and dOk are all ones if that clock is usable.
+    alignas(64) double tm[N];
+    alignas(64) double sdt[N], ssp[N], szt[N];
+    alignas(64) double ddt[N], dsp[N], dzt[N];
+    alignas(64) int64_t sOk[N], dOk[N];
+    // outputs
+    alignas(64) double dv0[N], dv1[N], dv2[N];
+    alignas(64) int64_t set[N];
+    // (kept for the caller while the batch is being filled for output)
+    double outTm[N];
+    bool rev[N], rtt[N];
+
+    // a packet that doesn't get dvs
+    void none(size_t i) {
+        tm[i] = sdt[i] = ssp[i] = szt[i] = ddt[i] = dsp[i] = dzt[i] = 0.;
+        sOk[i] = dOk[i] = 0;
+    }
+
+    void compute(size_t n) {
+        size_t i = 0;
+#if defined(__x86_64__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2) {
+            i = computeAvx2(n);
+        }
+#elif defined(__aarch64__)
+        // (separate multiply and add: a fused vfmaq rounds differently than lane())
+        for (; i + 2 <= n; i += 2) {
+            float64x2_t t = vld1q_f64(tm + i);
+            float64x2_t s = vminq_f64(vaddq_f64(vmulq_f64(vld1q_f64(sdt + i), vld1q_f64(ssp + i)), vld1q_f64(szt + i)), t);
+            float64x2_t d = vaddq_f64(vmulq_f64(vld1q_f64(ddt + i), vld1q_f64(dsp + i)), vld1q_f64(dzt + i));
+            uint64x2_t so = vreinterpretq_u64_s64(vld1q_s64(sOk + i));
+            uint64x2_t dk = vandq_u64(vreinterpretq_u64_s64(vld1q_s64(dOk + i)), vcleq_f64(d, t));
+            float64x2_t neg = vdupq_n_f64(-1.);
+            vst1q_f64(dv1 + i, vbslq_f64(so, vsubq_f64(t, s), neg));
+            vst1q_f64(dv2 + i, vbslq_f64(dk, vsubq_f64(t, d), neg));
+            vst1q_f64(dv0 + i, vbslq_f64(vandq_u64(so, dk), vsubq_f64(s, d), neg));
+            vst1q_s64(set + i, vreinterpretq_s64_u64(vorrq_u64(so, dk)));
+        }
+#endif
+        for (; i < n; i++) {
+            lane(i);
+        }
+    }
+
+  private:
+    // computeDV's arithmetic for one packet
+    void lane(size_t i) {
+        double s = sdt[i] * ssp[i] + szt[i];
+        if (s > tm[i]) {
+            s = tm[i];
+        }
+        double d = ddt[i] * dsp[i] + dzt[i];
+        bool so = sOk[i] != 0;
+        bool dk = dOk[i] != 0 && !(d > tm[i]);
+        dv1[i] = so ? tm[i] - s : -1.;
+        dv2[i] = dk ? tm[i] - d : -1.;
+        dv0[i] = so && dk ? s - d : -1.;
+        set[i] = -int64_t(so || dk);
+    }
+
+#if defined(__x86_64__)
+    // (no "fma" target: the baseline x86-64 computeDV doesn't fuse)
+    __attribute__((target("avx2"))) size_t computeAvx2(size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d t = _mm256_load_pd(tm + i);
+            __m256d s = _mm256_add_pd(_mm256_mul_pd(_mm256_load_pd(sdt + i), _mm256_load_pd(ssp + i)),
+                                      _mm256_load_pd(szt + i));
+            s = _mm256_min_pd(s, t);
+            __m256d d = _mm256_add_pd(_mm256_mul_pd(_mm256_load_pd(ddt + i), _mm256_load_pd(dsp + i)),
+                                      _mm256_load_pd(dzt + i));
+            __m256d so = _mm256_castsi256_pd(_mm256_load_si256(reinterpret_cast<const __m256i*>(sOk + i)));
+            __m256d dk = _mm256_and_pd(_mm256_castsi256_pd(_mm256_load_si256(reinterpret_cast<const __m256i*>(dOk + i))),
+                                       _mm256_cmp_pd(d, t, _CMP_LE_OQ));
+            __m256d neg = _mm256_set1_pd(-1.);
+            _mm256_store_pd(dv1 + i, _mm256_blendv_pd(neg, _mm256_sub_pd(t, s), so));
+            _mm256_store_pd(dv2 + i, _mm256_blendv_pd(neg, _mm256_sub_pd(t, d), dk));
+            _mm256_store_pd(dv0 + i, _mm256_blendv_pd(neg, _mm256_sub_pd(s, d), _mm256_and_pd(so, dk)));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(set + i), _mm256_castpd_si256(_mm256_or_pd(so, dk)));
+        }
+        return i;
+    }
+#endif
+};
+
+#endif // DVBATCH_HPP
@@ -42,20 +42,32 @@
  *
  */
 
-// extended timestamp value to deal with wraps
-const int64_t wrapCnt = 0x10000l;
+#include "./flowTier.hpp"
+
+/*
+ * extended timestamp value to deal with wraps. wraps[0] is the wrap count
+ * of the low half of the TS space and wraps[1] of the high half: when the
+ * TS crosses from the high half to the low it has wrapped and wraps[0] is
+ * incremented but late values in the high half still get the old count
+ * until the TS moves into the high half again. Values behind 'last' (in
+ * serial number order) don't move it. (1us clocks wrap every 71 minutes.)
+ */
 struct tsWrap {
-    int64_t offset[2];
+    uint16_t wraps[2];  //offsets in units of 2^32
     uint32_t last;
 };
 static inline int64_t extendTS(uint32_t ts, struct tsWrap *tsw) {
-    if( (tsw->last & ~ts) >> 31) {
-        //timestamp wrapped
-        tsw->offset[1] = tsw->offset[0];
-        tsw->offset[0] += wrapCnt;
+    if (int32_t(ts - tsw->last) > 0 || (tsw->last | tsw->wraps[0]) == 0) {
+        if ((tsw->last ^ ts) >> 31) {
+            if (ts >> 31) {
+                tsw->wraps[1] = tsw->wraps[0];  //into the high half
+            } else {
+                tsw->wraps[0]++;        //timestamp wrapped
+            }
+        }
+        tsw->last = ts;
     }
-    tsw->last = ts;
-    return tsw->offset[ts>>31] + ts;
+    return (int64_t(tsw->wraps[ts>>31]) << 32) + ts;
 }
 
 struct tSamp {
@@ -66,97 +78,186 @@ struct tSamp {
     double tm;
     int64_t ts;
 };
+/*
+ * Lower hull of the (ts, tm) local min points of a flow, added in ts order.
+ * Points are kept in a ring and only the newest lhMaxPts are kept (so
+ * per-flow state stays flat on long-lived flows); 0 means no limit. A
+ * 'strict' hull drops colinear points. The ring also holds, for each point,
+ * the index of the longest segment ending at or before it so the hull's
+ * longest segment is known without a scan.
+ */
+inline size_t lhMaxPts = 64;
+
+template <bool strict>
+struct lowerHull {
+    struct lhPt {
+        tSamp p{0, 0};
+        size_t best{};      //(unwrapped) index of longest segment end through here
+    };
+    inlineRing<lhPt, 4> _pts;
+
+    size_t size() const { return _pts.size(); }
+    const tSamp& pt(size_t i) const { return _pts.at(i).p; }
+
+    static double cross(const tSamp& O, const tSamp& A, const tSamp& B)
+    { return (A.ts - O.ts) * (B.tm - O.tm) - (A.tm - O.tm) * (B.ts - O.ts); }
+
+    int64_t segLen(size_t i) const { return pt(i).ts - pt(i - 1).ts; }
+
+    void add(const tSamp& v) {
+        while (size() >= 2) {
+            double c = cross(pt(_pts.end() - 2), pt(_pts.end() - 1), v);
+            if (strict ? c > 0.0 : c >= 0.0) {
+                break;
+            }
+            _pts.pop_back();
+        }
+        size_t e = _pts.end();
+        size_t b = e;
+        if (size() >= 2 && segLen(_pts.at(e - 1).best) > v.ts - pt(e - 1).ts) {
+            b = _pts.at(e - 1).best;    //(ties go to the newer segment)
+        }
+        _pts.push_back({v, b});
+        if (lhMaxPts >= 2 && size() > lhMaxPts) {
+            dropOldest();
+        }
+    }
+
+    // the newest point of the longest segment (size() must be >= 2)
+    size_t longest() const { return _pts.at(_pts.end() - 1).best; }
+
+  private:
+    void dropOldest() {
+        _pts.pop_front();
+        // redo the longest segment indices that referred to the dropped
+        // segment (they're a prefix since later ones only move forward)
+        size_t hd = _pts.begin();
+        for (size_t i = hd + 1; i < _pts.end() && _pts.at(i).best <= hd; i++) {
+            _pts.at(i).best = (i == hd + 1 || segLen(_pts.at(i - 1).best) <= segLen(i)) ?
+                                i : _pts.at(i - 1).best;
+        }
+    }
+};
+
 struct pktInfo {
     double tm;          //capture time adjusted by frstTm
     int64_t ts, ecr;    // extended TSval, ECR
     int sz;             //total bytes
     double dv[3];       //delay variations in sec (or negative 1 if can't compute
-    std::string IPsrc, IPdst;
 };
 
-struct flowDly
+/*
+ * Flow state is laid out by how often it's touched: the first cache line has
+ * everything every packet of the flow uses, the second the clock and pping
+ * state used when a packet yields metrics, the rest (key, moving min and
+ * hulls) is only touched for new TSvals or output. Flows live in a
+ * slabPool (see slabPool.hpp) and refer to their reverse flow by index.
+ */
+struct alignas(64) flowDly
 {
-    explicit flowDly(std::string nm) : _mm{5.0,50}, lhPts{}
+    explicit flowDly(const flowKey& k) : _key{k}, _mm{5.0,50}
     {
-        _flowname = std::move(nm);
-        twrap.offset[0] = twrap.offset[1] = 0;
-        twrap.last = 0;
-        ewrap.offset[0] = ewrap.offset[1] = 0;
-        ewrap.last = 0;
+        twrap = ewrap = tsWrap{{0, 0}, 0};
         _mm.setFirstInterval();  //since use adjusted values, sets start at 0
     };
     ~flowDly() = default;
 
-    std::string _flowname;
+    /* hot: every packet */
     double _lastTm{};     //capture time for last packet
-    double _minPP{1e30};   // current min value for capturepoint-to-source-to-CP RTT
-    int64_t _minTS{};      // adjusted (-startTS) TSval when current min was computed
-    double _minTm{};    // capture time when this min was seen
     double bytesSnt{};  // number of bytes sent through CP toward dst: inbound-to-CP, or return, direction
-    bool revFlow{};     //inidcates if a reverse flow has been seen
-    flowDly* rfp{};
+    int64_t lstTS{};    //last unique extended TSval (until full, the last before the next to retain)
+    double spTS{0};     //seconds per TS tick
+    tsWrap twrap;
+    tsWrap ewrap;
+    uint32_t _id:31{};  //flow id used in the tsval table
+    uint32_t revFlow:1{};   //inidcates if a reverse flow has been seen
+    uint32_t _rid{};    //reverse flow's id in the tsval table (if revFlow)
+    uint32_t rfi{};     //reverse flow's index in the flow pool (if revFlow)
+    uint16_t pktCnt{};  //number of packets sent through CP toward dst (saturates)
+    bool clkSet:1{};    //true when there is a "clock" for this flow
+    bool full:1{true};  //does clock and dv estimation (see flowTier.hpp)
+    uint8_t clkRef{};   //eviction clock chances left (set by each packet)
 
-    /* for segment delay variation */
-    movingMin _mm;     //keeps a moving min of the capture time vs TSval points
-    int pktCnt{};       //number of packets sent through CP toward dst
+    /* warm: clock and pping state */
     int64_t zeroTS{};     //extended TSval used for reference as the start of the slope
     double zeroTm;      //the capture time of the zeroTS (estimate of time when zero added delay)
     double startTm{};     //time at flow start
     int64_t startTS{};  //TSval at flow start
-    tsWrap twrap;
-    tsWrap ewrap;
-    tSamp lstTS{0,0};   //last unique TS (unadjusted)
-
-    std::vector<tSamp> lhPts; //keep lower hull points including colinear pts
-    double spTS{0};     //seconds per TS tick
+    double _minPP{1e30};   // current min value for capturepoint-to-source-to-CP RTT
+    double _lastPP{-1.};   // latest capturepoint-to-source-to-CP RTT (-1 until there's one)
+    int64_t _minTS{};      // adjusted (-startTS) TSval when current min was computed
+    double _minTm{};    // capture time when this min was seen
     double spSet;       //last time set the spTS value
-    bool clkSet{};      //true when there is a "clock" for this flow
 
-    /* for computing lower hull */
-    double cross(const tSamp O, const tSamp A, const tSamp B)
-    { return (A.ts - O.ts) * (B.tm - O.tm) - (A.tm - O.tm) * (B.ts - O.ts); }
+    /* cold */
+    flowKey _key;       //this flow's 5-tuple (printable form built only for output)
+    movingMin _mm;     //keeps a moving min of the capture time vs TSval points
+    lowerHull<false> lhPts; //lower hull points including colinear pts
+    lowerHull<true> lhSegs; //lower hull without intermediate colinear pts
+    int64_t tickScl{};  //movingMin interval scale for the TS clock (0 until set)
+    std::unique_ptr<segRing> segs;  //sent segments for SEQ/ACK matching (--seqack)
+    std::unique_ptr<warmBuf> warm;  //TSval samples kept until promoted to full (--tiered)
+
+    // keep a sample for the clock estimation in case the flow's promoted
+    void retain(double tm, int64_t ts) {
+        if (ts <= lstTS) {
+            return;     //(without touching the buffer)
+        }
+        if (!warm) {
+            warm = std::make_unique<warmBuf>();
+        }
+        warm->add(tm, ts);
+        lstTS = warm->_p[warm->_n - 1].ts + warm->_gap - 1;
+    }
+
+    // start clock and dv estimation, warmed up with the retained samples
+    void promote() {
+        full = true;
+        lstTS = 0;
+        if (warm) {
+            for (uint32_t i = 0; i < warm->_n; i++) {
+                computeTicks(warm->_p[i].tm, warm->_p[i].ts);
+            }
+            warm.reset();
+        }
+    }
+
     /*
      * find candidate slope of sec per TS tick using lower hull over local minimum points
      */
     bool computeTicks(double tm, int64_t ts) {        
-        if(pktCnt && lstTS.ts >= ts) { //use only first time see a TSval
+        if(pktCnt && lstTS >= ts) { //use only first time see a TSval
             return clkSet;
         }
-        lstTS = {tm,ts};
+        lstTS = ts;
         tm -= startTm;   //work with adjusted values to get slope
         ts -= startTS;
         // Track the minimum values over 100 tick intervals using 20 tick subintervals (set in movingmin.hpp)
-        std::vector<tSamp> lhSegs = lhPts; //keep lh without intermediate colinear pts
         _mm.addSample(tm,ts);
         if(_mm.newInterval(ts)) {
-            minSamp p = _mm.intervalMin();   //add this local min to lower hull
-            //test against lower hull points
-            auto newVal = tSamp{p.first, p.second};
-            while(lhPts.size() >= 2 && cross(lhPts[lhPts.size()-2], lhPts[lhPts.size()-1], newVal) < 0.0) {
-                lhPts.pop_back();
-            }
-            lhPts.push_back(newVal);
-            while(lhSegs.size() >= 2 && cross(lhSegs[lhSegs.size()-2], lhSegs[lhSegs.size()-1], newVal) <= 0.0) {
-                lhSegs.pop_back();
+            if(!tickScl) {
+                //first interval: a clock with fine ticks needs a longer (in ticks) interval
+                tickScl = tickScale(tm, ts);
+                if(tickScl > 1) {
+                    _mm.scale(tickScl, ts);
+                    return clkSet;
+                }
             }
-            lhSegs.push_back(newVal);
+            minSamp p = _mm.intervalMin();   //add this local min to lower hulls
+            auto newVal = tSamp{p.first, p.second};
+            lhPts.add(newVal);
+            lhSegs.add(newVal);
         } else
              return clkSet; //do nothing until in a new movingmin interval
         // these numbers are somewhat arbitrary
-        if(ts < 3*interval || lhPts.size() < 2 || pktCnt < 20) {
+        if(ts < 3*interval*tickScl || lhPts.size() < 2 || pktCnt < 20) {
             return clkSet;  //wait 3 movingmin intervals before computing
         }
 
-        //find the longest segment in the lower hull (ignoring intermediate colinear pts) and use its end pt as candidate reference zero
-        int64_t longestSeg = 0;
-        int li = 0;
-        for(int i=1; i<lhSegs.size(); i++){
-            if(lhSegs[i].ts - lhSegs[i-1].ts >= longestSeg) {
-                longestSeg = lhSegs[i].ts - lhSegs[i-1].ts;
-                li = i;
-            }
-        }
-        if(lhSegs[li].ts+startTS == zeroTS)  {  //test for same interval
+        //the longest segment in the lower hull (ignoring intermediate colinear pts) gives its end pt as candidate reference zero
+        size_t li = lhSegs.longest();
+        const tSamp& le = lhSegs.pt(li);
+        if(le.ts+startTS == zeroTS)  {  //test for same interval
             if(_minTS > zeroTS) {               //test for later min pp
                 zeroTS = _minTS;                //move the reference zero
                 zeroTm = _minTm;
@@ -164,27 +265,35 @@ struct flowDly
             return clkSet;                      //don't recompute
         }
 
-        auto m = (lhSegs[li].tm - lhSegs[li-1].tm)/(lhSegs[li].ts - lhSegs[li-1].ts);
-        //figure out if it's usable - need to change for us ticks
-        double spt = round(m*1000.)/1000.;   //sec per tick rounded to nearest ms
+        //figure out if it's usable: fit the (newest) hull points and match a tick rate
+        //skew should be less than maxSkew, conservative is 50 us per sec (0.00005)
+        double spt = matchTick(hullSlope());
         if(spt == 0.) {
-            clkSet = false;
-            return clkSet;
-        }
-        auto skew = fabs(m - spt);       //skew in sec per ts tick
-        //skew should be less than limit, conservative is 50 us per sec (0.00005)
-        if(skew/spt > 0.005)  {
             clkSet = false;    //in case it was looking okay, switch
             return clkSet;   //can't determine a clock
         }
-        spTS =  spt;    //sec per TS tick rounded to nearest ms
-        zeroTS = startTS + lhSegs[li].ts;
-        zeroTm = startTm + lhSegs[li].tm;
+        spTS =  spt;    //sec per TS tick of the matching clock
+        zeroTS = startTS + le.ts;
+        zeroTm = startTm + le.tm;
         clkSet = true;
         spSet = tm;
         return clkSet;
     }
 
+    // least squares slope (sec per tick) of the newest fitMaxPts lower hull points
+    static constexpr size_t fitMaxPts = 64;
+    double hullSlope() const {
+        double x[fitMaxPts], y[fitMaxPts];
+        size_t n = std::min(lhPts.size(), fitMaxPts);
+        size_t b = lhPts._pts.end() - n;
+        for (size_t i = 0; i < n; i++) {
+            const tSamp& p = lhPts.pt(b + i);
+            x[i] = double(p.ts);
+            y[i] = p.tm;
+        }
+        return fitSlope(x, y, n);
+    }
+
     /*
     * Compute delay variations for a packet (in integer microsecs)
      *
@@ -201,7 +310,7 @@ struct flowDly
      *  use the sample associated with a min pping
      *
      */
-    bool computeDV(pktInfo& pi)
+    bool computeDV(pktInfo& pi, const flowDly* rfp)
     {
         double srcTm;
         bool setDV = false;
@@ -221,7 +330,7 @@ struct flowDly
             //adjusted time passed at sourceIP + fudge factor for multiple packets with same TSval
             //estimate of time at source plus the (unknown) min delay
             // has to be for a point captured after zero point
-            srcTm = double ((pi.ts - zeroTS) * spTS) + zeroTm; // + (pi.tm - lstTS.tm);
+            srcTm = double ((pi.ts - zeroTS) * spTS) + zeroTm;
             if(srcTm > pi.tm) {
                 srcTm = pi.tm;
             }
@@ -250,4 +359,29 @@ struct flowDly
         }
         return setDV;
     }
+
+    // computeDV for a packet in a batch: update the clock then put the
+    // parameters computeDV would use in lane i of 'b' (see dvBatch.hpp)
+    void gatherDV(const pktInfo& pi, const flowDly* rfp, dvBatch& b, size_t i)
+    {
+        b.tm[i] = pi.tm;
+        if(computeTicks(pi.tm, pi.ts)) {
+            b.sOk[i] = -1;
+            b.sdt[i] = double(pi.ts - zeroTS);
+            b.ssp[i] = spTS;
+            b.szt[i] = zeroTm;
+        } else {
+            b.sOk[i] = 0;
+            b.sdt[i] = b.ssp[i] = b.szt[i] = 0.;
+        }
+        if(revFlow && rfp != nullptr && rfp->clkSet) {
+            b.dOk[i] = -1;
+            b.ddt[i] = double(pi.ecr - rfp->zeroTS);
+            b.dsp[i] = rfp->spTS;
+            b.dzt[i] = rfp->zeroTm;
+        } else {
+            b.dOk[i] = 0;
+            b.ddt[i] = b.dsp[i] = b.dzt[i] = 0.;
+        }
+    }
 };
@@ -0,0 +1,148 @@
+/*
+ * flowKey: fixed size binary key for the flow table
+ *
+ * A flow is identified by its 5-tuple (protocol is always TCP so isn't
+ * stored). v4 addresses are kept in v4-mapped v6 form (::ffff:a.b.c.d) so
+ * both address families share one key layout and one hash. The printable
+ * srcIP:port+dstIP:port form is only built when an output line needs it.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef FLOWKEY_HPP
+#define FLOWKEY_HPP
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// finalizer from murmur3 - cheap and mixes all input bits into all output bits
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// an IP address held as 16 bytes in network order
+struct ipAddr {
+    uint64_t w[2]{};
+
+    void setV4(uint32_t a) {        // 'a' in network byte order
+        uint8_t* b = (uint8_t*)w;
+        memset(b, 0, 10);
+        b[10] = b[11] = 0xff;
+        memcpy(b + 12, &a, 4);
+    }
+    void setV6(const uint8_t* a) { memcpy(w, a, 16); }
+    const uint8_t* bytes() const { return (const uint8_t*)w; }
+    bool isV4() const {
+        static const uint8_t pfx[12] = {0,0,0,0,0,0,0,0,0,0,0xff,0xff};
+        return memcmp(w, pfx, 12) == 0;
+    }
+    bool empty() const { return w[0] == 0 && w[1] == 0; }
+    bool operator==(const ipAddr&) const = default;
+
+    // this address with all but the first v4len (or v6len) bits cleared
+    ipAddr masked(int v4len, int v6len) const {
+        int bits = isV4() ? 96 + v4len : v6len;
+        ipAddr m = *this;
+        uint8_t* b = (uint8_t*)m.w;
+        for (int i = 0; i < 16; i++, bits -= 8) {
+            if (bits < 8) {
+                b[i] &= bits <= 0 ? 0 : uint8_t(0xff << (8 - bits));
+            }
+        }
+        return m;
+    }
+
+    std::string to_string() const {
+        char buf[INET6_ADDRSTRLEN];
+        if (isV4()) {
+            inet_ntop(AF_INET, bytes() + 12, buf, sizeof(buf));
+        } else {
+            inet_ntop(AF_INET6, bytes(), buf, sizeof(buf));
+        }
+        return buf;
+    }
+};
+
+struct flowKey {
+    ipAddr src, dst;
+    uint16_t sport{}, dport{};      // host byte order
+    uint32_t pad{};                 // keeps the key free of uninitialized bytes (could hold DSCP)
+
+    // O(1) key of the reverse direction of this flow
+    flowKey reverse() const {
+        flowKey r;
+        r.src = dst;
+        r.dst = src;
+        r.sport = dport;
+        r.dport = sport;
+        r.pad = pad;
+        return r;
+    }
+    bool operator==(const flowKey&) const = default;
+
+    uint64_t hash() const {
+        uint64_t h = src.w[0] ^ rotl64(src.w[1], 17) ^ rotl64(dst.w[0], 31) ^ rotl64(dst.w[1], 47);
+        return mix64(h ^ ((uint64_t(sport) << 16 | dport) * 0x9e3779b97f4a7c15ull));
+    }
+    // hash that's the same for both directions of a flow
+    uint64_t symHash() const {
+        uint64_t s = mix64(src.w[0] ^ rotl64(src.w[1], 17) ^ sport);
+        uint64_t d = mix64(dst.w[0] ^ rotl64(dst.w[1], 17) ^ dport);
+        return mix64(s + d);
+    }
+
+    // srcIP:port+dstIP:port
+    std::string to_string() const {
+        return src.to_string() + ":" + std::to_string(sport) + "+" +
+               dst.to_string() + ":" + std::to_string(dport);
+    }
+};
+
+struct flowKeyHash {
+    size_t operator()(const flowKey& k) const { return k.hash(); }
+};
+
+#endif // FLOWKEY_HPP
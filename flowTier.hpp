@@ -0,0 +1,272 @@
+/*
+ * flowTier: which flows get delay variation estimation (--tiered)
+ *
+ * With --tiered every flow gets pping (RTT) tracking but only 'full'
+ * flows run the clock estimation and delay variation computation of
+ * flowDly::computeDV. A flow becomes full (is promoted) when it has sent
+ * some number of bytes, has lasted some time, gets a pping RTT above a
+ * quantile of the shard's recent RTTs, or one of its addresses is in the
+ * watch list; its reverse flow is promoted with it since that's where the
+ * destination clock comes from. Until then a flow keeps a small sample of
+ * its (capture time, TSval) points in a warmBuf and replays them into
+ * the clock estimation when promoted so it gets a clock soon after.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef FLOWTIER_HPP
+#define FLOWTIER_HPP
+
+#include <arpa/inet.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "./flowKey.hpp"
+#include "./tDigest.hpp"
+
+/*
+ * The first appearance of a flow's TSvals, at least _gap ticks apart.
+ * When it fills every other point is dropped and the gap doubled so the
+ * points always span the flow so far.
+ */
+struct warmBuf {
+    static constexpr uint32_t N = 16;   // points held (even)
+    struct pt {
+        double tm;
+        int64_t ts;     // extended TSval
+    };
+    pt _p[N];
+    uint32_t _n{};
+    int64_t _gap{1};
+
+    void add(double tm, int64_t ts) {
+        if (_n && ts - _p[_n - 1].ts < _gap) {
+            return;
+        }
+        if (_n == N) {
+            for (uint32_t i = 1; i < N / 2; i++) {
+                _p[i] = _p[2 * i];
+            }
+            _n = N / 2;
+            _gap *= 2;
+            if (ts - _p[_n - 1].ts < _gap) {
+                return;
+            }
+        }
+        _p[_n++] = {tm, ts};
+    }
+};
+
+// address prefixes (v4 ones are held v4 mapped, as in ipAddr)
+struct watchList {
+    struct pfx {
+        ipAddr a;
+        int bits;
+    };
+    std::vector<pfx> _p;
+
+    bool empty() const { return _p.empty(); }
+
+    // parse a.b.c.d[/len] or a v6 address[/len]
+    static bool parse(const std::string& s, pfx& p) {
+        size_t sl = s.find('/');
+        std::string a = s.substr(0, sl);
+        uint8_t b[16];
+        if (inet_pton(AF_INET, a.c_str(), b) == 1) {
+            uint32_t v;
+            memcpy(&v, b, 4);
+            p.a.setV4(v);
+            p.bits = 96 + 32;
+        } else if (inet_pton(AF_INET6, a.c_str(), b) == 1) {
+            p.a.setV6(b);
+            p.bits = 128;
+        } else {
+            return false;
+        }
+        if (sl != std::string::npos) {
+            int len = atoi(s.c_str() + sl + 1);
+            if (len < 0 || len > p.bits - (p.a.isV4() ? 96 : 0)) {
+                return false;
+            }
+            p.bits = len + (p.a.isV4() ? 96 : 0);
+        }
+        uint8_t* m = (uint8_t*)p.a.w;     // (clear the host bits)
+        for (int i = 0, k = p.bits; i < 16; i++, k -= 8) {
+            if (k < 8) {
+                m[i] &= k <= 0 ? 0 : uint8_t(0xff << (8 - k));
+            }
+        }
+        return true;
+    }
+    bool add(const std::string& s) {
+        pfx p;
+        if (!parse(s, p)) {
+            return false;
+        }
+        _p.push_back(p);
+        return true;
+    }
+    // remove prefix 's' if it's in the list
+    bool remove(const std::string& s) {
+        pfx p;
+        if (!parse(s, p)) {
+            return false;
+        }
+        for (auto it = _p.begin(); it != _p.end(); ++it) {
+            if (it->a == p.a && it->bits == p.bits) {
+                _p.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+    // the prefixes separated by spaces
+    std::string to_string() const {
+        std::string r;
+        for (const auto& p : _p) {
+            r += (r.empty() ? "" : " ") + p.a.to_string() + "/" +
+                 std::to_string(p.bits - (p.a.isV4() ? 96 : 0));
+        }
+        return r;
+    }
+
+    bool covers(const ipAddr& a) const {
+        for (const auto& p : _p) {
+            const uint8_t* x = a.bytes();
+            const uint8_t* y = p.a.bytes();
+            int n = p.bits / 8, r = p.bits % 8;
+            if (memcmp(x, y, n) == 0 && (r == 0 || ((x[n] ^ y[n]) >> (8 - r)) == 0)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    bool match(const flowKey& k) const { return !empty() && (covers(k.src) || covers(k.dst)); }
+};
+
+/*
+ * Promotion thresholds from a spec of comma separated bytes=N (k, M or G
+ * suffix ok), secs=S and rtt=P (percentile). Unset ones (0) aren't used.
+ */
+struct tierCfg {
+    double bytes{};     // bytes sent by the flow
+    double secs{};      // time since the flow's first packet
+    double rttQ{};      // quantile of the shard's pping RTTs
+    watchList watch;
+
+    bool parse(const std::string& spec) {
+        for (size_t b = 0; b < spec.size(); ) {
+            size_t e = spec.find(',', b);
+            std::string f = spec.substr(b, e == std::string::npos ? e : e - b);
+            b = e == std::string::npos ? spec.size() : e + 1;
+            size_t eq = f.find('=');
+            if (eq == std::string::npos) {
+                return false;
+            }
+            std::string k = f.substr(0, eq);
+            char* end;
+            double v = strtod(f.c_str() + eq + 1, &end);
+            if (k == "bytes") {
+                switch (*end) {
+                case 'k': case 'K': v *= 1e3; end++; break;
+                case 'm': case 'M': v *= 1e6; end++; break;
+                case 'g': case 'G': v *= 1e9; end++; break;
+                }
+                bytes = v;
+            } else if (k == "secs") {
+                secs = v;
+            } else if (k == "rtt" && v > 0. && v < 100.) {
+                rttQ = v / 100.;
+            } else {
+                return false;
+            }
+            if (*end != '\0' || v < 0.) {
+                return false;
+            }
+        }
+        return true;
+    }
+    std::string spec() const {
+        std::string r;
+        auto f = [&r](const char* k, double v) {
+            if (v > 0.) {
+                char b[64];
+                snprintf(b, sizeof(b), "%s%s=%g", r.empty() ? "" : ",", k, v);
+                r += b;
+            }
+        };
+        f("bytes", bytes);
+        f("secs", secs);
+        f("rtt", rttQ * 100.);
+        return r;
+    }
+    bool due(double sent, double age) const {
+        return (bytes > 0. && sent >= bytes) || (secs > 0. && age >= secs);
+    }
+};
+
+/*
+ * Recent pping RTTs of a shard. The quantile used as the promotion
+ * threshold is refreshed every 'refresh' RTTs and the digest restarted
+ * every 'span' so it follows changes in the traffic mix.
+ */
+struct rttGate {
+    static constexpr uint32_t refresh = 256;
+    static constexpr uint32_t span = 64 * refresh;
+    tDigest _d{100};
+    double _thr{INFINITY};  // (nothing is above it until there are enough RTTs)
+    uint32_t _n{};
+
+    // add an RTT; true if it's above the q quantile of recent ones
+    bool above(double rtt, double q) {
+        bool r = rtt > _thr;
+        _d.add(rtt);
+        if (++_n % refresh == 0) {
+            _thr = _d.quantile(q);
+            if (_n == span) {
+                _d.clear();
+                _n = 0;
+            }
+        }
+        return r;
+    }
+};
+
+#endif // FLOWTIER_HPP
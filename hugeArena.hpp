@@ -0,0 +1,311 @@
+/*
+ * hugeArena: hugepage-backed, NUMA-placed memory for a shard's tables
+ *
+ * The tables that are hit at random per packet (the flow pool's slabs,
+ * the flow hash's nodes and buckets and the TSval table) are big enough
+ * that TLB misses, and on a multi-socket box accesses to the other
+ * socket's memory, add up. An arena gets memory in regions backed by
+ * hugetlb pages of hugeShift (2MB or 1GB, from the pages reserved in
+ * /sys/kernel/mm/hugepages) or, when there are none, by transparent
+ * hugepages, and asks the kernel (mbind MPOL_PREFERRED, so a full node
+ * spills rather than fails) to put them on the node of the thread that
+ * uses them. Blocks are handed out by bumping a pointer through the
+ * current region. Freed blocks go on a free list for their exact size,
+ * which suits tables that allocate the same few sizes over and over, and
+ * regions are only unmapped when the arena goes away. An arena belongs
+ * to one thread at a time so nothing is locked.
+ *
+ * When hugeArena::on is false (the default) nothing uses an arena and
+ * allocation is the normal heap's. arenaAlloc<T> lets std containers use
+ * an arena (a null arena means the default allocator).
+ *
+ * numaNodes(), nicNode() and bindToNode() are the (Linux sysfs and
+ * affinity) helpers for deciding where threads and their arenas go.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef HUGEARENA_HPP
+#define HUGEARENA_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// memory mapped for arenas wanting one node
+struct arenaStats {
+    std::atomic<uint64_t> hugetlb{}, thp{}, regions{};
+};
+
+struct hugeArena {
+    static constexpr int maxNodes = 64;     // (one word of mbind node mask)
+    static constexpr size_t thpSize = size_t(2) << 20;
+    static constexpr size_t align = 64;     // blocks are cache line aligned
+
+    // chosen before any arena is made and never changed
+    static inline bool on{};        // shards get arenas
+    static inline int hugeShift{};  // log2 of hugetlb page size, 0 = transparent hugepages only
+
+    // bytes mapped by arenas wanting each node (index maxNodes is "no node")
+    static inline arenaStats stats[maxNodes + 1];
+
+    explicit hugeArena(int node = -1) : _node(node >= 0 && node < maxNodes ? node : -1) {}
+    hugeArena(const hugeArena&) = delete;
+    hugeArena& operator=(const hugeArena&) = delete;
+    ~hugeArena() {
+        arenaStats& s = stats[_node >= 0 ? _node : maxNodes];
+        for (const auto& r : _regions) {
+            (r.huge ? s.hugetlb : s.thp).fetch_sub(r.len, std::memory_order_relaxed);
+            s.regions.fetch_sub(1, std::memory_order_relaxed);
+            munmap(r.base, r.len);
+        }
+    }
+
+    void* alloc(size_t n) {
+        n = (n + align - 1) & ~(align - 1);
+        if (auto it = _free.find(n); it != _free.end() && !it->second.empty()) {
+            void* p = it->second.back();
+            it->second.pop_back();
+            return p;
+        }
+        if (_left < n) {
+            newRegion(n);
+        }
+        void* p = _cur;
+        _cur += n;
+        _left -= n;
+        return p;
+    }
+    void free(void* p, size_t n) {
+        _free[(n + align - 1) & ~(align - 1)].push_back(p);
+    }
+
+    int node() const { return _node; }
+    // bytes of this arena's pages that the kernel put on some other node
+    uint64_t remoteBytes() const {
+        uint64_t n = 0;
+#ifdef __linux__
+        if (_node < 0) {
+            return 0;
+        }
+        for (const auto& r : _regions) {
+            size_t pg = r.huge ? size_t(1) << hugeShift : thpSize;
+            std::vector<void*> pages;
+            for (size_t o = 0; o < r.len; o += pg) {
+                pages.push_back(r.base + o);
+            }
+            std::vector<int> st(pages.size());
+            if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, st.data(), 0) != 0) {
+                continue;
+            }
+            for (int s : st) {
+                n += s >= 0 && s != _node ? pg : 0;     // (negative is not faulted in yet)
+            }
+        }
+#endif
+        return n;
+    }
+
+  private:
+    struct region {
+        char* base;
+        size_t len;
+        bool huge;          // hugetlb (else transparent hugepages)
+    };
+    int _node;
+    char* _cur{};
+    size_t _left{};
+    std::vector<region> _regions;
+    std::unordered_map<size_t, std::vector<void*>> _free;  // by block size
+
+    void newRegion(size_t n) {
+        size_t pg = hugeShift ? size_t(1) << hugeShift : thpSize;
+        size_t len = (n + pg - 1) & ~(pg - 1);
+        void* p = MAP_FAILED;
+        bool huge = false;
+#ifdef __linux__
+        if (hugeShift) {
+            p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (hugeShift << MAP_HUGE_SHIFT), -1, 0);
+            huge = p != MAP_FAILED;
+        }
+#endif
+        if (!huge) {
+            // over-map by a hugepage and trim so the region is aligned for THP
+            len = (n + thpSize - 1) & ~(thpSize - 1);
+            p = mmap(nullptr, len + thpSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            char* b = static_cast<char*>(p);
+            char* a = reinterpret_cast<char*>((uintptr_t(b) + thpSize - 1) & ~(thpSize - 1));
+            if (a > b) {
+                munmap(b, a - b);
+            }
+            munmap(a + len, b + thpSize - a);
+            p = a;
+#ifdef MADV_HUGEPAGE
+            madvise(p, len, MADV_HUGEPAGE);
+#endif
+        }
+#ifdef __linux__
+        if (_node >= 0) {
+            // (before any page is touched so they're allocated there)
+            unsigned long mask = 1ul << _node;
+            syscall(SYS_mbind, p, len, 1 /* MPOL_PREFERRED */, &mask, maxNodes + 1, 0);
+        }
+#endif
+        _regions.push_back({static_cast<char*>(p), len, huge});
+        arenaStats& s = stats[_node >= 0 ? _node : maxNodes];
+        (huge ? s.hugetlb : s.thp).fetch_add(len, std::memory_order_relaxed);
+        s.regions.fetch_add(1, std::memory_order_relaxed);
+        _cur = static_cast<char*>(p);
+        _left = len;
+    }
+};
+
+template <typename T>
+struct arenaAlloc {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    hugeArena* _a{};
+
+    arenaAlloc() = default;
+    explicit arenaAlloc(hugeArena* a) : _a(a) {}
+    template <typename U>
+    arenaAlloc(const arenaAlloc<U>& o) : _a(o._a) {}
+
+    T* allocate(size_t n) {
+        return _a ? static_cast<T*>(_a->alloc(n * sizeof(T))) : std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        if (_a) {
+            _a->free(p, n * sizeof(T));
+        } else {
+            std::allocator<T>().deallocate(p, n);
+        }
+    }
+    template <typename U>
+    bool operator==(const arenaAlloc<U>& o) const { return _a == o._a; }
+    template <typename U>
+    bool operator!=(const arenaAlloc<U>& o) const { return _a != o._a; }
+};
+
+// number of NUMA nodes (1 if unknown)
+static inline int numaNodes()
+{
+    int n = 1;
+#ifdef __linux__
+    if (FILE* f = fopen("/sys/devices/system/node/online", "r")) {
+        // (a list of ranges, e.g., "0-1"; the last number is the highest node)
+        char b[256];
+        if (fgets(b, sizeof(b), f)) {
+            std::string s(b);
+            size_t e = s.find_last_of("0123456789");
+            size_t s0 = e == std::string::npos ? e : s.find_last_not_of("0123456789", e);
+            if (e != std::string::npos) {
+                n = std::stoi(s.substr(s0 == std::string::npos ? 0 : s0 + 1)) + 1;
+            }
+        }
+        fclose(f);
+    }
+#endif
+    return std::min(n, hugeArena::maxNodes);
+}
+
+// node of a network interface's device (-1 if unknown, e.g., not a PCI device)
+static inline int nicNode(const std::string& ifname)
+{
+    int n = -1;
+    if (FILE* f = fopen(("/sys/class/net/" + ifname + "/device/numa_node").c_str(), "r")) {
+        if (fscanf(f, "%d", &n) != 1) {
+            n = -1;
+        }
+        fclose(f);
+    }
+    return n;
+}
+
+// run the calling thread only on 'node's cpus
+static inline bool bindToNode(int node)
+{
+#ifdef __linux__
+    FILE* f = fopen(("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist").c_str(), "r");
+    if (f == nullptr) {
+        return false;
+    }
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    for (int a, b; fscanf(f, "%d", &a) == 1; ) {
+        b = a;
+        if (fscanf(f, "-%d", &b) < 0) {
+            b = a;
+        }
+        for (int c = a; c <= b && c < CPU_SETSIZE; c++) {
+            CPU_SET(c, &cs);
+        }
+        if (fgetc(f) != ',') {
+            break;
+        }
+    }
+    fclose(f);
+    return CPU_COUNT(&cs) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+#endif // HUGEARENA_HPP
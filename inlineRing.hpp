@@ -0,0 +1,97 @@
+/*
+ * inlineRing: small ring buffer (deque) with inline storage
+ *
+ * Holds up to N elements inside the object itself and only goes to the
+ * heap (doubling) if more are needed, so per-flow deques that are almost
+ * always short (moving min candidates, lower hull points) cost no
+ * allocation and sit next to the rest of the flow's state. Indices are
+ * unwrapped (they only grow) and stay valid across growth.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef INLINERING_HPP
+#define INLINERING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+template <typename T, uint32_t N>
+struct inlineRing {
+    static_assert((N & (N - 1)) == 0, "inline size must be a power of 2");
+
+    size_t begin() const { return _hd; }    // (unwrapped) index of the front
+    size_t end() const { return _tl; }      // one past the back
+    size_t size() const { return _tl - _hd; }
+    bool empty() const { return _hd == _tl; }
+
+    T& at(size_t i) { return buf()[i & (_cap - 1)]; }
+    const T& at(size_t i) const { return buf()[i & (_cap - 1)]; }
+    T& front() { return at(_hd); }
+    T& back() { return at(_tl - 1); }
+
+    void clear() { _hd = _tl = 0; }
+    void pop_front() { _hd++; }
+    void pop_back() { _tl--; }
+    void push_back(const T& v) {
+        if (size() == _cap) {
+            grow();
+        }
+        at(_tl++) = v;
+    }
+
+  private:
+    T _inl[N]{};
+    std::unique_ptr<T[]> _big;
+    size_t _hd{}, _tl{};
+    uint32_t _cap{N};
+
+    T* buf() { return _big ? _big.get() : _inl; }
+    const T* buf() const { return _big ? _big.get() : _inl; }
+
+    void grow() {
+        uint32_t cap = _cap * 2;
+        std::unique_ptr<T[]> b(new T[cap]);
+        for (size_t i = _hd; i < _tl; i++) {
+            b[i & (cap - 1)] = at(i);
+        }
+        _big = std::move(b);
+        _cap = cap;
+    }
+};
+
+#endif // INLINERING_HPP
@@ -2,7 +2,8 @@
  * movingmin: Track the minimum over a moving interval.
  *
  * For approximate, set subinterval to a nonzero value of suitable granularity
- * by setting the number of spaces per interval
+ * by setting the number of spaces per interval (or build with
+ * -DMOVINGMIN_EXACT=1 for an exact moving min)
  * Every subinterval, check for a new min using t-axis of int64_t (could use double
  * for more general time notion. This is a general technique but in use by dlyloc,
  * intervals are in TS tick therefore 1ms TS ticks will be ms.
@@ -50,53 +51,60 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include "./inlineRing.hpp"
 
 using minSamp = std::pair<double, int64_t>;
 const int64_t interval = 100;    //~100 ms
 const double intervalSpaces = 5.;
 
-struct movingMin {
-    std::vector<minSamp>  _minList{};
+/*
+ * The samples that can still become the min are kept in a monotonic deque
+ * (values and times both increasing from front to back) held in a ring
+ * buffer (inline for the usual few entries) so adding a sample and expiring old ones are amortized O(1) with
+ * no element shifting. The front is always the min of the current interval.
+ *
+ * With MOVINGMIN_EXACT set to 1 every sample is a candidate and the min is
+ * exact. Otherwise (the default) a sample larger than all the candidates
+ * is only added if it starts a new subinterval (_sub = _interval/spaces)
+ * which bounds the deque at about 'spaces' entries.
+ */
+#ifndef MOVINGMIN_EXACT
+#define MOVINGMIN_EXACT 0
+#endif
+
+template <bool exact>
+struct basicMovingMin {
+    inlineRing<minSamp, 8> _minList;    //candidates (values and times increasing)
     double _nxtIntr{};
     int64_t _interval;
     int64_t _sub;
 
-    movingMin(double is=intervalSpaces, int64_t i= interval) : _interval{i}
+    basicMovingMin(double is=intervalSpaces, int64_t i= interval) : _interval{i}
     { _sub = i/is; }
 
     void addSample(auto v, auto t)
     {
-    if(_minList.empty() || v <= _minList.front().first || t > _minList.back().second + _interval) {
-        _minList.clear();
-        _minList.emplace_back(v,t);
-        return;
-    }
-    auto frst = 0;  //first in current interval
-    for(auto i=0; i< _minList.size(); i++)
-    {
-        if((_minList[i].second + _interval) >= t) {
-            frst = i;
-            break;
+        auto& l = _minList;
+        if (l.empty() || v <= l.front().first || t > l.back().second + _interval) {
+            l.clear();
+            l.push_back({v, t});
+            return;
         }
-    }
-    if(frst != 0) { //checked last item already so frst has to be at most size+1
-        _minList.erase(_minList.begin(), _minList.begin()+frst);
-    }
-    if(v > _minList.back().first) {
-        if (_minList.back().second + _sub < t) {
-            _minList.emplace_back(v,t);
+        // expire samples that have left the interval (back is still in it)
+        while (l.front().second + _interval < t) {
+            l.pop_front();
         }
-        return;
-    }
-    for(auto i=0; i< _minList.size(); i++)
-    {
-        if(v <= _minList[i].first) {
-            _minList.resize(i);
-            _minList.emplace_back(v,t);
+        if (v > l.back().first) {
+            if (exact || l.back().second + _sub < t) {
+                l.push_back({v, t});
+            }
             return;
         }
-    }
-    return; //shouldn't get here since v should be <= to at least end value
+        // drop the candidates this sample beats
+        while (!l.empty() && v <= l.back().first) {
+            l.pop_back();
+        }
+        l.push_back({v, t});
     }
 
     bool newInterval(uint64_t t) {
@@ -107,9 +115,18 @@ struct movingMin {
 
     void setFirstInterval(int64_t t = 0) { _nxtIntr = t+_interval;}
 
-    const minSamp intervalMin() { return {_minList.front().first, _minList.front().second};}
+    // multiply the interval by k (for a finer clock) starting at t
+    void scale(int64_t k, int64_t t) {
+        _interval *= k;
+        _sub *= k;
+        setFirstInterval(t);
+    }
+
+    const minSamp intervalMin() { return _minList.front(); }
 };
 
+using movingMin = basicMovingMin<MOVINGMIN_EXACT>;
+
 /*
 int main()
 {
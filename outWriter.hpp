@@ -0,0 +1,517 @@
+/*
+ * outWriter: buffered writer for dlyloc's output lines and records
+ *
+ * Lines are formatted straight into a set of large buffers with hand
+ * rolled fixed point number formatting (no printf, no std::string) and
+ * the buffers are handed to the kernel with a single writev when they're
+ * full or when a flush is due. Besides the two text formats there's a
+ * compact binary format of fixed size (48 byte) little-endian records:
+ *
+ *  file header: "DLYB" + u16 version + u16 record size (48)  (8 bytes)
+ *  flow record: u8 type=1, 3 pad, u32 flow id, 16 byte src addr,
+ *               16 byte dst addr (v4 in v4-mapped form), u16 sport,
+ *               u16 dport, 4 pad
+ *  data record: u8 type=2, u8 flags (bit 0: rtt valid), 2 pad, u32 flow id,
+ *               i64 capture time (us since epoch), i32 rtt (us),
+ *               i32 min rtt (us), u64 bytes sent, i32 dv0..dv2 (us, -1 if
+ *               not computed), u32 TSval
+ *  name record: u8 type=3, 3 pad, 44 byte capture point name (NUL padded);
+ *               only if a name was set, right after the file header
+ *
+ * A flow record defining a flow id always precedes the first data record
+ * that uses it. Ids are only kept for a bounded number of flows: when
+ * that many have been defined the ids start again at 1 and flows are
+ * defined again as they next appear, so a flow record replaces any
+ * earlier definition of its id. Ids are never above maxFlowId so
+ * decoders can reject larger ones. In datagram mode (records sent to a collector over UDP,
+ * see dlycollect.cpp) every datagram starts with the file header (and
+ * name) and defines the flows it uses, so it can be decoded on its own.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef OUTWRITER_HPP
+#define OUTWRITER_HPP
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "./pktRec.hpp"
+
+enum class outFmt { human, machine, binary };
+
+/*
+ * number formatting. These write at 'p' and return the end. fmtFixed
+ * gives the same digits as printf's %.Nf for the magnitudes dlyloc prints.
+ */
+static inline char* fmtUInt(char* p, uint64_t v)
+{
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = char('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+static inline char* fmtFixed(char* p, double v, int dec)
+{
+    static const uint64_t p10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    if (!(fabs(v) < 1e12)) {
+        return p + snprintf(p, 32, "%.*f", dec, v);     // (not expected in practice)
+    }
+    if (v < 0.) {
+        *p++ = '-';
+        v = -v;
+    }
+    // round like printf: fma gives the exact residual of the scaled value
+    double sc = double(p10[dec]);
+    double f = floor(v * sc);
+    double r = fma(v, sc, -f);
+    if (r < 0.) {
+        f -= 1.;
+        r += 1.;
+    }
+    uint64_t u = uint64_t(f);
+    if (r > 0.5 || (r == 0.5 && (u & 1))) {
+        u++;
+    }
+    p = fmtUInt(p, u / p10[dec]);
+    if (dec) {
+        *p++ = '.';
+        uint64_t f = u % p10[dec];
+        for (int i = dec - 1; i >= 0; i--) {
+            p[i] = char('0' + f % 10);
+            f /= 10;
+        }
+        p += dec;
+    }
+    return p;
+}
+
+// format a time difference with an SI prefix (e.g., "2.35ms", " 120us")
+static inline char* fmtTimeDiff(char* p, double dt)
+{
+    char buf[32];
+    char* e = buf;
+    const char* SIprefix = "";
+    if (dt < 1e-3) {
+        dt *= 1e6;
+        SIprefix = "u";
+    } else if (dt < 1) {
+        dt *= 1e3;
+        SIprefix = "m";
+    }
+    if (dt < 10.) {
+        e = fmtFixed(e, dt, 2);
+    } else if (dt < 100.) {
+        e = fmtFixed(e, dt, 1);
+    } else {
+        *e++ = ' ';
+        e = fmtFixed(e, dt, 0);
+    }
+    while (*SIprefix) {
+        *e++ = *SIprefix++;
+    }
+    *e++ = 's';
+    size_t n = e - buf;
+    if (n > 9) {
+        n = 9;      // (fits in the 10 byte buffer the format always used)
+    }
+    memcpy(p, buf, n);
+    return p + n;
+}
+
+static inline char* fmtAddr(char* p, const ipAddr& a)
+{
+    char buf[INET6_ADDRSTRLEN];
+    if (a.isV4()) {
+        inet_ntop(AF_INET, a.bytes() + 12, buf, sizeof(buf));
+    } else {
+        inet_ntop(AF_INET6, a.bytes(), buf, sizeof(buf));
+    }
+    size_t n = strlen(buf);
+    memcpy(p, buf, n);
+    return p + n;
+}
+
+// srcIP:port+dstIP:port
+static inline char* fmtFlow(char* p, const flowKey& fk)
+{
+    p = fmtAddr(p, fk.src);
+    *p++ = ':';
+    p = fmtUInt(p, fk.sport);
+    *p++ = '+';
+    p = fmtAddr(p, fk.dst);
+    *p++ = ':';
+    return fmtUInt(p, fk.dport);
+}
+
+// srcPrefix/len+dstPrefix/len of a key made with ipAddr::masked()
+static inline char* fmtPrefixes(char* p, const flowKey& pk, int v4len, int v6len)
+{
+    p = fmtAddr(p, pk.src);
+    *p++ = '/';
+    p = fmtUInt(p, pk.src.isV4() ? v4len : v6len);
+    *p++ = '+';
+    p = fmtAddr(p, pk.dst);
+    *p++ = '/';
+    return fmtUInt(p, pk.dst.isV4() ? v4len : v6len);
+}
+
+static inline char* fmtStr(char* p, const char* s)
+{
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+/*
+ * periodic summaries (digestWriter.hpp, topK.hpp). sumClock splits capture
+ * time into intervals: tick() is given each record's time and calls
+ * 'report' first if the record is past the current interval. Summary
+ * lines start with the interval's end time, as the local time of day
+ * (human) or unix seconds.usec (machine), and give delays as an SI
+ * scaled time (human) or seconds.
+ */
+struct sumClock {
+    double len;             // interval (0 = one summary at the end)
+    double end{};           // end of the current interval
+    double last{};          // capture time of the latest record
+
+    template <typename F>
+    void tick(double tm, F&& report) {
+        if (len > 0.) {
+            if (end == 0.) {
+                end = tm + len;
+            }
+            if (tm >= end) {
+                report();
+                while (tm >= end) {
+                    end += len;
+                }
+            }
+        }
+        last = tm;
+    }
+    // capture time the current interval's summary is stamped with
+    double stamp() const { return len > 0. ? end : last; }
+};
+
+static inline char* fmtSumTm(char* p, double tm, int64_t offTm, bool human)
+{
+    int64_t sec = int64_t(floor(tm)) + offTm;
+    if (human) {
+        std::time_t t = sec;
+        return p + strftime(p, 16, "%T", std::localtime(&t));
+    }
+    p = fmtUInt(p, uint64_t(sec));
+    *p++ = '.';
+    int us = int((tm - floor(tm)) * 1e6);
+    for (int i = 5; i >= 0; i--) {
+        p[i] = char('0' + us % 10);
+        us /= 10;
+    }
+    return p + 6;
+}
+
+static inline char* fmtSumVal(char* p, double v, bool human)
+{
+    return human ? fmtTimeDiff(p, v) : fmtFixed(p, v, 6);
+}
+
+// little-endian stores
+static inline char* putLE(char* p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++) {
+        *p++ = char(v >> (8 * i));
+    }
+    return p;
+}
+
+static inline int32_t toUs(double t) { return t < 0. ? -1 : int32_t(llround(t * 1e6)); }
+
+struct outWriter {
+    static constexpr size_t chunkSize = 1 << 16;    // bytes per buffer
+    static constexpr int nChunks = 16;              // buffers per writev
+    static constexpr size_t maxRec = 256;           // longest line or record
+    static constexpr size_t binRecSize = 48;
+    static constexpr uint32_t maxFlowId = 1 << 22;    // (binary format flow ids)
+
+    explicit outWriter(int fd = STDOUT_FILENO, outFmt f = outFmt::human) : _fd{fd}, _fmt{f} {
+        for (auto& c : _chunk) {
+            c.reset(new char[chunkSize]);
+        }
+    }
+    ~outWriter() { flush(); }
+
+    void setFormat(outFmt f) { _fmt = f; }
+    outFmt format() const { return _fmt; }
+    void setFd(int fd) { flush(); _fd = fd; }
+    // capture point name (binary format, at most 43 bytes)
+    void setName(const std::string& n) { _name = n.substr(0, 43); }
+    // send binary records as self-contained datagrams of at most 'max' bytes
+    void setDatagram(size_t max) { _lim = std::max(max, maxRec); }
+    // start flow ids over after this many (binary format, at most maxFlowId)
+    void setMaxFlowIds(size_t n) { _maxIds = std::clamp<size_t>(n, 1, maxFlowId); }
+
+    // write one output line (or binary record) for 'o'. 'offTm' is the
+    // capture time offset (seconds) that o.tm is relative to.
+    void put(const outRec& o, int64_t offTm) {
+        switch (_fmt) {
+        case outFmt::machine: machineLine(o, offTm); break;
+        case outFmt::human: humanLine(o, offTm); break;
+        case outFmt::binary: binaryRec(o, offTm); break;
+        }
+    }
+
+    // write 'n' (at most maxRec) bytes of already formatted text
+    void text(const char* s, size_t n) {
+        char* p = reserve();
+        memcpy(p, s, n);
+        commit(p + n);
+    }
+
+    // hand everything buffered to the kernel
+    void flush() {
+        if (_used[0] == 0) {
+            return;
+        }
+        struct iovec iov[nChunks];
+        int n = 0;
+        for (int i = 0; i <= _cur; i++) {
+            iov[n].iov_base = _chunk[i].get();
+            iov[n].iov_len = _used[i];
+            n++;
+        }
+        if (_lim < chunkSize) {
+            for (int i = 0; i < n; i++) {
+                (void)!write(_fd, iov[i].iov_base, iov[i].iov_len);    // (a lost datagram is lost)
+            }
+            n = 0;
+        }
+        struct iovec* v = iov;
+        while (n > 0) {
+            ssize_t w = writev(_fd, v, n);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;      // (output closed - nothing useful to do)
+            }
+            while (n > 0 && size_t(w) >= v->iov_len) {
+                w -= v->iov_len;
+                v++;
+                n--;
+            }
+            if (n > 0) {
+                v->iov_base = (char*)v->iov_base + w;
+                v->iov_len -= w;
+            }
+        }
+        for (int i = 0; i <= _cur; i++) {
+            _used[i] = 0;
+        }
+        _cur = 0;
+    }
+
+  private:
+    int _fd;
+    outFmt _fmt;
+    std::unique_ptr<char[]> _chunk[nChunks];
+    size_t _used[nChunks]{};
+    int _cur{};
+    int64_t _tmSec{-1};         // second of the cached human readable time
+    char _tmStr[16];
+    size_t _tmLen{};
+    bool _binHdr{};             // binary file header written
+    std::string _name;          // capture point name (binary format)
+    size_t _lim{chunkSize};     // bytes per buffer (datagram size in datagram mode)
+    uint32_t _dgram{};          // number of the current datagram
+    struct flowId {
+        uint32_t id;
+        uint32_t dgram;         // last datagram that defined it
+    };
+    std::unordered_map<flowKey, flowId, flowKeyHash> _flowIds;
+    size_t _maxIds{1 << 20};
+
+    // space for up to maxRec bytes
+    char* reserve() {
+        if (_used[_cur] + maxRec > _lim) {
+            if (++_cur == nChunks) {
+                _cur = nChunks - 1;
+                flush();
+            }
+        }
+        return _chunk[_cur].get() + _used[_cur];
+    }
+    void commit(char* e) { _used[_cur] = e - _chunk[_cur].get(); }
+
+    char* fmtCapTm(char* p, const outRec& o, int64_t offTm) {
+        p = fmtUInt(p, uint64_t(int64_t(o.tm + offTm)));
+        *p++ = '.';
+        int us = int((o.tm - floor(o.tm)) * 1e6);
+        for (int i = 5; i >= 0; i--) {
+            p[i] = char('0' + us % 10);
+            us /= 10;
+        }
+        return p + 6;
+    }
+
+    void machineLine(const outRec& o, int64_t offTm) {
+        char* p = reserve();
+        p = fmtCapTm(p, o, offTm);
+        if (o.rtt < 0.) {
+            memcpy(p, " -1 -1", 6);
+            p += 6;
+        } else {
+            *p++ = ' ';
+            p = fmtFixed(p, o.rtt, 6);
+            *p++ = ' ';
+            p = fmtFixed(p, o.minPP, 6);
+        }
+        *p++ = ' ';
+        p = fmtFixed(p, o.bytesSnt, 0);
+        for (int i = 0; i < 3; i++) {
+            *p++ = ' ';
+            p = fmtFixed(p, o.dv[i], 6);
+        }
+        *p++ = ' ';
+        p = fmtFlow(p, o.fk);
+        *p++ = '\n';
+        commit(p);
+    }
+
+    void humanLine(const outRec& o, int64_t offTm) {
+        int64_t sec = int64_t(o.tm + offTm);
+        if (sec != _tmSec) {
+            // localtime and strftime only once a second
+            std::time_t result = sec;
+            struct tm* ptm = std::localtime(&result);
+            _tmLen = strftime(_tmStr, sizeof(_tmStr), "%T", ptm);
+            _tmSec = sec;
+        }
+        char* p = reserve();
+        memcpy(p, _tmStr, _tmLen);
+        p += _tmLen;
+        if (o.rtt < 0.) {
+            memcpy(p, " - -", 4);
+            p += 4;
+        } else {
+            *p++ = ' ';
+            p = fmtTimeDiff(p, o.rtt);
+            *p++ = ' ';
+            p = fmtTimeDiff(p, o.minPP);
+        }
+        for (int i = 0; i < 3; i++) {
+            *p++ = ' ';
+            if (o.dv[i] > -1.) {
+                p = fmtTimeDiff(p, o.dv[i]);
+            } else {
+                *p++ = '-';
+            }
+        }
+        *p++ = ' ';
+        p = fmtFlow(p, o.fk);
+        *p++ = '\n';
+        commit(p);
+    }
+
+    // (header, name, flow and data records are all put in one reserve()
+    // so a datagram never ends between a flow's definition and its use)
+    void binaryRec(const outRec& o, int64_t offTm) {
+        char* p = reserve();
+        bool dg = _lim < chunkSize;
+        if (!_binHdr || (dg && _used[_cur] == 0)) {
+            memcpy(p, "DLYB", 4);
+            p = putLE(p + 4, 1, 2);
+            p = putLE(p, binRecSize, 2);
+            if (!_name.empty()) {
+                memset(p, 0, binRecSize);
+                p[0] = 3;
+                memcpy(p + 4, _name.data(), _name.size());
+                p += binRecSize;
+            }
+            _binHdr = true;
+            _dgram++;
+        }
+        if (_flowIds.size() >= _maxIds && _flowIds.find(o.fk) == _flowIds.end()) {
+            _flowIds.clear();       // (flows get new ids from 1 as they appear)
+        }
+        auto [it, isNew] = _flowIds.try_emplace(o.fk, flowId{uint32_t(_flowIds.size() + 1), 0});
+        uint32_t fid = it->second.id;
+        if (isNew || (dg && it->second.dgram != _dgram)) {
+            char* s = p;
+            p = putLE(p, 1, 4);
+            p = putLE(p, fid, 4);
+            memcpy(p, o.fk.src.bytes(), 16);
+            memcpy(p + 16, o.fk.dst.bytes(), 16);
+            p = putLE(p + 32, o.fk.sport, 2);
+            p = putLE(p, o.fk.dport, 2);
+            p = putLE(p, 0, 4);
+            p = s + binRecSize;
+            it->second.dgram = _dgram;
+        }
+        char* s = p;
+        p = putLE(p, 2 | (o.rtt >= 0. ? 0x100 : 0), 4);
+        p = putLE(p, fid, 4);
+        p = putLE(p, uint64_t(llround((o.tm + double(offTm)) * 1e6)), 8);
+        p = putLE(p, uint32_t(toUs(o.rtt)), 4);
+        p = putLE(p, uint32_t(o.rtt >= 0. ? toUs(o.minPP) : -1), 4);
+        p = putLE(p, uint64_t(o.bytesSnt), 8);
+        for (int i = 0; i < 3; i++) {
+            p = putLE(p, uint32_t(toUs(o.dv[i])), 4);
+        }
+        p = putLE(p, o.tsval, 4);
+        commit(s + binRecSize);
+    }
+};
+
+#endif // OUTWRITER_HPP
@@ -0,0 +1,450 @@
+/*
+ * pcapFile: memory-mapped reader for pcap and pcapng capture files
+ *
+ * The file is mmap'd and records are walked in place: the callback gets
+ * pointers into the mapping so nothing is copied or allocated per packet.
+ * Readahead is driven with madvise (MADV_SEQUENTIAL for the mapping plus
+ * MADV_WILLNEED on a window ahead of the walk) and pages behind the walk are
+ * dropped so RSS stays small on very large files.
+ *
+ * A file can be split into byte ranges that start on record boundaries
+ * (slices()) so that several threads can each walk part of it. Boundaries
+ * are found by resynchronizing from an arbitrary offset: a position is
+ * taken as a record start if it and the next few records all have
+ * plausible headers (pcap) or consistent leading and trailing block
+ * lengths (pcapng).
+ *
+ * Both byte orders and us or ns (or, for pcapng, any if_tsresol) time
+ * resolutions are handled. pcapng files must use a single link type.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef PCAPFILE_HPP
+#define PCAPFILE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct pcapFile {
+    static constexpr size_t raWindow = size_t(64) << 20;     // readahead window
+    static constexpr uint32_t maxCaplen = 262144;
+    static constexpr int syncRecs = 8;      // records checked by resync
+    std::string _err;
+
+    ~pcapFile() { close(); }
+
+    bool open(const char* fname) {
+        struct stat st;
+        // check before opening: opening then closing a pipe loses its data
+        if (stat(fname, &st) == 0 && !S_ISREG(st.st_mode)) {
+            _err = std::string(fname) + ": not a regular file";
+            return false;
+        }
+        int fd = ::open(fname, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < 24) {
+            _err = std::string(fname) + ": " + (fd < 0 ? strerror(errno) : "not a capture file");
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        _size = st.st_size;
+        void* m = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            _err = std::string(fname) + ": " + strerror(errno);
+            return false;
+        }
+        _base = (const uint8_t*)m;
+        madvise(m, _size, MADV_SEQUENTIAL);
+        if (!parseHeader()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (_base) {
+            munmap((void*)_base, _size);
+            _base = nullptr;
+        }
+    }
+
+    // start reading the beginning of the file (e.g., while the previous
+    // file of a sequence is still being walked)
+    void prefetch() const {
+        madvise((void*)_base, raWindow < _size ? raWindow : _size, MADV_WILLNEED);
+    }
+
+    int dlt() const { return _dlt; }
+    size_t first() const { return _first; }     // offset of the first record
+    size_t size() const { return _size; }
+
+    /*
+     * Split the records into 'n' byte ranges. Returns the n+1 boundary
+     * offsets (the last is the file size); each starts a record. Fewer
+     * ranges are returned if the file is too small to split n ways.
+     */
+    std::vector<size_t> slices(int n) const {
+        std::vector<size_t> b{_first};
+        for (int i = 1; i < n; i++) {
+            size_t o = resync(_first + (_size - _first) / n * i);
+            if (o > b.back() && o < _size) {
+                b.push_back(o);
+            }
+        }
+        b.push_back(_size);
+        return b;
+    }
+
+    /*
+     * Return the offset of a record boundary in [lo, hi) whose time is at
+     * or before 'sec' (found by bisection so it assumes time is mostly
+     * increasing through the file). 'lo' must be a record boundary.
+     */
+    size_t seekTime(int64_t sec, size_t lo, size_t hi) const {
+        while (hi - lo > (size_t(1) << 16)) {
+            size_t mid = resync(lo + (hi - lo) / 2);
+            int64_t t;
+            if (mid >= hi || !recSec(mid, t)) {
+                break;
+            }
+            if (t < sec) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // capture time (seconds) of the (first packet) record at boundary 'o'
+    bool recSec(size_t o, int64_t& sec) const {
+        if (!_ng) {
+            sec = rd32(_base + o, _swap);
+            return true;
+        }
+        // skip to the next packet block
+        for (size_t n; o + 28 <= _size; o = n) {
+            const uint8_t* p = _base + o;
+            uint32_t type = rd32(p, _swap);
+            uint32_t ifn = type == epbType ? rd32(p + 8, _swap) : rd16(p + 8, _swap);
+            if ((type == epbType || type == pbType) && ifn < _ifs.size()) {
+                uint64_t ticks = (uint64_t(rd32(p + 12, _swap)) << 32) | rd32(p + 16, _swap);
+                sec = int64_t(ticks / _ifs[ifn].tps) + _ifs[ifn].offset;
+                return true;
+            }
+            if (!plausible(o, n) || n == o) {
+                break;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Walk the packet records starting at record boundary 'from' up to
+     * (but not including) the record at or after 'to', calling
+     *   bool f(const uint8_t* bytes, uint32_t caplen, uint32_t len,
+     *          int64_t sec, int64_t usec)
+     * for each. Stops early if f returns false. Returns the offset where
+     * the walk stopped.
+     */
+    template <typename F>
+    size_t walk(size_t from, size_t to, F&& f) const {
+        std::vector<ifInfo> ifs = _ifs;
+        bool swap = _swap;
+        size_t ra = from;           // where to issue the next readahead
+        size_t o = from;
+        while (o < to) {
+            if (o >= ra) {
+                advise(from, o);
+                ra = o + raWindow / 2;
+            }
+            const uint8_t* p = _base + o;
+            size_t left = _size - o;
+            if (!_ng) {
+                if (left < 16) {
+                    break;
+                }
+                uint32_t caplen = rd32(p + 8, swap);
+                if (caplen > left - 16) {
+                    break;      // (truncated)
+                }
+                int64_t frac = rd32(p + 4, swap);
+                if (!f(p + 16, caplen, rd32(p + 12, swap), int64_t(rd32(p, swap)),
+                       _nsec ? frac / 1000 : frac)) {
+                    return o;
+                }
+                o += 16 + caplen;
+                continue;
+            }
+            if (left < 12) {
+                break;
+            }
+            uint32_t type = rd32(p, swap);
+            uint32_t blen = rd32(p + 4, swap);
+            if (type == shbType) {
+                // new section: byte order and interfaces start over
+                swap = rd32(p + 8, false) != bomMagic;
+                blen = rd32(p + 4, swap);
+                ifs.clear();
+            }
+            if (blen < 12 || (blen & 3) || blen > left) {
+                break;
+            }
+            if (type == idbType) {
+                ifs.push_back(parseIdb(p, blen, swap));
+            } else if (type == epbType || type == pbType) {
+                uint32_t ifn, hi, lo, caplen, len;
+                if (type == epbType) {
+                    ifn = rd32(p + 8, swap);
+                    hi = rd32(p + 12, swap);
+                    lo = rd32(p + 16, swap);
+                    caplen = rd32(p + 20, swap);
+                    len = rd32(p + 24, swap);
+                } else {
+                    ifn = rd16(p + 8, swap);
+                    hi = rd32(p + 12, swap);
+                    lo = rd32(p + 16, swap);
+                    caplen = rd32(p + 20, swap);
+                    len = rd32(p + 24, swap);
+                }
+                if (ifn < ifs.size() && ifs[ifn].dlt == _dlt && caplen <= blen - 32) {
+                    const ifInfo& ifi = ifs[ifn];
+                    uint64_t ticks = (uint64_t(hi) << 32) | lo;
+                    int64_t sec = int64_t(ticks / ifi.tps) + ifi.offset;
+                    int64_t usec = int64_t((ticks % ifi.tps) * 1000000 / ifi.tps);
+                    if (!f(p + 28, caplen, len, sec, usec)) {
+                        return o;
+                    }
+                }
+            }
+            o += blen;
+        }
+        return o < to ? o : to;
+    }
+
+  private:
+    static constexpr uint32_t shbType = 0x0A0D0D0A;
+    static constexpr uint32_t idbType = 1;
+    static constexpr uint32_t pbType = 2;       // (obsolete packet block)
+    static constexpr uint32_t epbType = 6;
+    static constexpr uint32_t bomMagic = 0x1A2B3C4D;
+
+    struct ifInfo {
+        int dlt;
+        uint64_t tps;       // timestamp ticks per second
+        int64_t offset;     // if_tsoffset (seconds)
+    };
+    const uint8_t* _base{};
+    size_t _size{};
+    size_t _first{};
+    int _dlt{-1};
+    bool _ng{}, _swap{}, _nsec{};
+    uint32_t _snap{maxCaplen};
+    std::vector<ifInfo> _ifs;   // pcapng interfaces defined before the first packet
+
+    static uint32_t rd32(const uint8_t* p, bool swap) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return swap ? __builtin_bswap32(v) : v;
+    }
+    static uint16_t rd16(const uint8_t* p, bool swap) {
+        uint16_t v;
+        memcpy(&v, p, 2);
+        return swap ? __builtin_bswap16(v) : v;
+    }
+
+    // a walk that started at 'from' is at 'o': start reading the window
+    // ahead of it and drop the pages it's done with
+    void advise(size_t from, size_t o) const {
+        const size_t pg = 4096;
+        size_t s = o & ~(pg - 1);
+        madvise((void*)(_base + s), raWindow < _size - s ? raWindow : _size - s, MADV_WILLNEED);
+        size_t b = (from + pg - 1) & ~(pg - 1);
+        if (o > b + raWindow) {
+            madvise((void*)(_base + b), (o - raWindow - b) & ~(pg - 1), MADV_DONTNEED);
+        }
+    }
+
+    static ifInfo parseIdb(const uint8_t* p, uint32_t blen, bool swap) {
+        ifInfo ifi{rd16(p + 8, swap), 1000000, 0};
+        // options follow linktype, reserved and snaplen
+        for (uint32_t o = 16; o + 4 <= blen - 4;) {
+            uint16_t code = rd16(p + o, swap);
+            uint16_t len = rd16(p + o + 2, swap);
+            if (code == 0 || o + 4 + len > blen - 4) {
+                break;
+            }
+            if (code == 9 && len >= 1) {            // if_tsresol
+                uint8_t r = p[o + 4];
+                uint64_t tps = 1;
+                for (int i = 0; i < (r & 0x7f) && tps < (uint64_t(1) << 60); i++) {
+                    tps *= (r & 0x80) ? 2 : 10;
+                }
+                ifi.tps = tps;
+            } else if (code == 14 && len >= 8) {    // if_tsoffset
+                uint64_t v;
+                memcpy(&v, p + o + 4, 8);
+                ifi.offset = int64_t(swap ? __builtin_bswap64(v) : v);
+            }
+            o += 4 + ((len + 3) & ~3u);
+        }
+        return ifi;
+    }
+
+    bool parseHeader() {
+        uint32_t magic = rd32(_base, false);
+        if (magic == shbType) {
+            _ng = true;
+            _swap = rd32(_base + 8, false) != bomMagic;
+            if (_swap && rd32(_base + 8, true) != bomMagic) {
+                _err = "bad pcapng section header";
+                return false;
+            }
+            // collect the interfaces defined before the first packet
+            size_t o = 0;
+            while (o + 12 <= _size) {
+                uint32_t type = rd32(_base + o, _swap);
+                uint32_t blen = rd32(_base + o + 4, _swap);
+                if (blen < 12 || (blen & 3) || blen > _size - o) {
+                    break;
+                }
+                if (type == epbType || type == pbType) {
+                    break;
+                }
+                if (type == idbType) {
+                    _ifs.push_back(parseIdb(_base + o, blen, _swap));
+                }
+                o += blen;
+            }
+            if (_ifs.empty()) {
+                _err = "no interfaces in pcapng file";
+                return false;
+            }
+            _dlt = _ifs[0].dlt;
+            for (const auto& i : _ifs) {
+                if (i.dlt != _dlt) {
+                    _err = "pcapng file has more than one link type";
+                    return false;
+                }
+            }
+            _first = 0;         // (walk from the section header)
+            return true;
+        }
+        if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+            _swap = false;
+        } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+            _swap = true;
+        } else {
+            _err = "not a pcap or pcapng file";
+            return false;
+        }
+        _nsec = rd32(_base, _swap) == 0xa1b23c4d;
+        _snap = rd32(_base + 16, _swap);
+        if (_snap == 0 || _snap > maxCaplen) {
+            _snap = maxCaplen;
+        }
+        _dlt = int(rd32(_base + 20, _swap) & 0x0fffffff);
+        _first = 24;
+        return true;
+    }
+
+    // is there a plausible record at 'o'? If so sets 'next' to the following one.
+    bool plausible(size_t o, size_t& next) const {
+        if (o == _size) {
+            next = o;
+            return true;        // (end of file is a boundary)
+        }
+        const uint8_t* p = _base + o;
+        if (!_ng) {
+            if (_size - o < 16) {
+                return false;
+            }
+            uint32_t caplen = rd32(p + 8, _swap);
+            uint32_t len = rd32(p + 12, _swap);
+            uint32_t frac = rd32(p + 4, _swap);
+            if (caplen > _snap || caplen > len || len > maxCaplen ||
+                frac >= (_nsec ? 1000000000u : 1000000u) || caplen > _size - o - 16) {
+                return false;
+            }
+            next = o + 16 + caplen;
+            return true;
+        }
+        if (_size - o < 12) {
+            return false;
+        }
+        uint32_t blen = rd32(p + 4, _swap);
+        if (blen < 12 || (blen & 3) || blen > _size - o || rd32(p + blen - 4, _swap) != blen) {
+            return false;
+        }
+        next = o + blen;
+        return true;
+    }
+
+    // first record boundary at or after 'o'
+    size_t resync(size_t o) const {
+        if (_ng) {
+            o = (o + 3) & ~size_t(3);   // (blocks are 32 bit aligned)
+        }
+        for (; o < _size; o += _ng ? 4 : 1) {
+            size_t n = o;
+            int i = 0;
+            while (i < syncRecs && plausible(n, n)) {
+                if (n == _size) {
+                    i = syncRecs;
+                    break;
+                }
+                i++;
+            }
+            if (i == syncRecs) {
+                return o;
+            }
+        }
+        return _size;
+    }
+};
+
+#endif // PCAPFILE_HPP
@@ -0,0 +1,74 @@
+/*
+ * pktRec: compact records passed between dlyloc's processing stages
+ *
+ * A pktRec holds just the parts of a captured packet that delay
+ * estimation uses. An outRec holds the metrics of one output line.
+ * Both are plain data so they can be batched and copied between threads
+ * without touching the packet buffers they came from.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef PKTREC_HPP
+#define PKTREC_HPP
+
+#include <cstdint>
+#include "./flowKey.hpp"
+
+struct pktRec {
+    flowKey fk;
+    uint64_t seq;       // capture order
+    double tm;          // capture time, offset by first packet's time
+    uint32_t tsval, ecr;
+    uint32_t sz;        // frame length on the wire (not the captured length)
+    uint16_t flags;     // tcp flags
+    uint32_t endSeq;    // tcp seq just past this segment (data, SYN and FIN)
+    uint32_t ack;       // tcp ack
+    uint32_t segLen;    // seq space this segment uses (0 for a pure ack)
+};
+
+struct outRec {
+    flowKey fk;
+    uint64_t seq;       // seq of the packet that produced this line
+    double tm;          // capture time, offset by first packet's time
+    double rtt;         // pping value or -1 if none
+    double minPP;       // flow's min pping (valid if rtt >= 0)
+    double bytesSnt;    // bytes seen from this flow so far
+    double dv[3];       // delay variations or -1 if not computable
+    uint32_t tsval;     // TSval of that packet
+};
+
+#endif // PKTREC_HPP
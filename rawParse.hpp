@@ -0,0 +1,261 @@
+/*
+ * rawParse: in place parsing of captured frames into a pktRec
+ *
+ * The fast path for input from libpcap. Walks the link layer (Ethernet
+ * with any number of VLAN tags, Linux cooked, BSD loopback or raw IP),
+ * IPv4 or IPv6 (skipping extension headers) and the TCP header and
+ * options directly in the capture buffer. No allocation and no copies
+ * beyond the few fields dlyloc uses. Anything it doesn't understand
+ * is reported so the caller can count it.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef RAWPARSE_HPP
+#define RAWPARSE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include "./pktRec.hpp"
+
+enum class parseRes { ok, notTCP, noTS, notV4or6, skip };
+
+static constexpr uint16_t tcpSYN = 0x02;   // tcp flags byte with only SYN set
+static constexpr uint16_t tcpFIN = 0x01;
+static constexpr uint16_t tcpACK = 0x10;
+
+// link types with a parser (values from pcap/dlt.h)
+enum : int {
+    rawDltNull = 0, rawDltEN10MB = 1, rawDltRaw = 12, rawDltRawBSD = 14,
+    rawDltLoop = 108, rawDltLinuxSLL = 113, rawDltIPv4 = 228, rawDltIPv6 = 229,
+    rawDltLinuxSLL2 = 276
+};
+
+static inline bool rawSupported(int dlt)
+{
+    switch (dlt) {
+    case rawDltNull: case rawDltEN10MB: case rawDltRaw: case rawDltRawBSD:
+    case rawDltLoop: case rawDltLinuxSLL: case rawDltIPv4: case rawDltIPv6:
+    case rawDltLinuxSLL2:
+        return true;
+    }
+    return false;
+}
+
+static inline uint16_t rd16(const uint8_t* p) { return uint16_t(p[0] << 8 | p[1]); }
+static inline uint32_t rd32(const uint8_t* p)
+{
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+/*
+ * Parse the TCP header at 'p' ('len' bytes available, 'segLen' bytes in
+ * the TCP segment according to the IP header) into pr. Returns noTS if
+ * there's no timestamp option.
+ */
+static inline parseRes rawParseTCP(const uint8_t* p, uint32_t len, uint32_t segLen, pktRec& pr)
+{
+    if (len < 20) {
+        return parseRes::notTCP;
+    }
+    uint32_t hlen = (p[12] >> 4) * 4u;
+    if (hlen < 20) {
+        return parseRes::notTCP;
+    }
+    uint32_t dlen = segLen > hlen ? segLen - hlen : 0;
+    if (hlen > len) {
+        hlen = len;                 // options truncated by snap length
+    }
+    pr.fk.sport = rd16(p);
+    pr.fk.dport = rd16(p + 2);
+    pr.flags = p[13];
+    pr.segLen = dlen + (p[13] & tcpSYN ? 1 : 0) + (p[13] & tcpFIN ? 1 : 0);
+    pr.endSeq = rd32(p + 4) + pr.segLen;
+    pr.ack = rd32(p + 8);
+    for (uint32_t i = 20; i < hlen; ) {
+        uint8_t kind = p[i];
+        if (kind == 0) {            // end of options
+            break;
+        }
+        if (kind == 1) {            // nop
+            i++;
+            continue;
+        }
+        if (i + 1 >= hlen || p[i + 1] < 2) {
+            break;                  // malformed
+        }
+        uint8_t olen = p[i + 1];
+        if (kind == 8 && olen == 10 && i + 10 <= hlen) {
+            pr.tsval = rd32(p + i + 2);
+            pr.ecr = rd32(p + i + 6);
+            return parseRes::ok;
+        }
+        i += olen;
+    }
+    return parseRes::noTS;
+}
+
+static inline parseRes rawParseIPv4(const uint8_t* p, uint32_t len, pktRec& pr)
+{
+    if (len < 20 || (p[0] >> 4) != 4) {
+        return parseRes::notV4or6;
+    }
+    uint32_t hlen = (p[0] & 0xf) * 4u;
+    if (hlen < 20 || hlen > len) {
+        return parseRes::notV4or6;
+    }
+    if (p[9] != 6 || (rd16(p + 6) & 0x1fff) != 0) {
+        return parseRes::notTCP;    // not tcp or not the first fragment
+    }
+    uint32_t s, d;
+    memcpy(&s, p + 12, 4);
+    memcpy(&d, p + 16, 4);
+    pr.fk.src.setV4(s);
+    pr.fk.dst.setV4(d);
+    uint16_t tlen = rd16(p + 2);
+    return rawParseTCP(p + hlen, len - hlen, tlen > hlen ? tlen - hlen : 0, pr);
+}
+
+static inline parseRes rawParseIPv6(const uint8_t* p, uint32_t len, pktRec& pr)
+{
+    if (len < 40 || (p[0] >> 4) != 6) {
+        return parseRes::notV4or6;
+    }
+    pr.fk.src.setV6(p + 8);
+    pr.fk.dst.setV6(p + 24);
+    uint8_t nxt = p[6];
+    uint32_t off = 40;
+    uint32_t plen = rd16(p + 4) + 40u;  // (ignores jumbograms)
+    for (;;) {
+        switch (nxt) {
+        case 6:
+            return rawParseTCP(p + off, len - off, plen > off ? plen - off : 0, pr);
+        case 0: case 43: case 60:   // hop-by-hop, routing, destination options
+            if (off + 8 > len) {
+                return parseRes::notTCP;
+            }
+            nxt = p[off];
+            off += (p[off + 1] + 1) * 8u;
+            break;
+        case 44:                    // fragment
+            if (off + 8 > len || (rd16(p + off + 2) & 0xfff8) != 0) {
+                return parseRes::notTCP;
+            }
+            nxt = p[off];
+            off += 8;
+            break;
+        default:
+            return parseRes::notTCP;
+        }
+        if (off > len) {
+            return parseRes::notTCP;
+        }
+    }
+}
+
+static inline parseRes rawParseIP(const uint8_t* p, uint32_t len, pktRec& pr)
+{
+    if (len < 1) {
+        return parseRes::notV4or6;
+    }
+    switch (p[0] >> 4) {
+    case 4: return rawParseIPv4(p, len, pr);
+    case 6: return rawParseIPv6(p, len, pr);
+    }
+    return parseRes::notV4or6;
+}
+
+static inline parseRes rawParseEther(uint16_t type, const uint8_t* p, uint32_t len, pktRec& pr)
+{
+    switch (type) {
+    case 0x0800: return rawParseIPv4(p, len, pr);
+    case 0x86dd: return rawParseIPv6(p, len, pr);
+    }
+    return parseRes::notTCP;        // (libtins finds no TCP in non-IP frames either)
+}
+
+/*
+ * Parse a captured frame of link type 'dlt' into pr's flow key, tcp flags,
+ * TSval and ECR. 'caplen' is the number of bytes captured. The caller sets
+ * the size, capture time and sequence.
+ */
+static inline parseRes rawParse(int dlt, const uint8_t* p, uint32_t caplen, pktRec& pr)
+{
+    pr.fk.pad = 0;
+    switch (dlt) {
+    case rawDltEN10MB: {
+        if (caplen < 14) {
+            return parseRes::notTCP;
+        }
+        uint32_t off = 12;
+        uint16_t type = rd16(p + off);
+        while (type == 0x8100 || type == 0x88a8 || type == 0x9100) {   // vlan tags
+            off += 4;
+            if (off + 2 > caplen) {
+                return parseRes::notTCP;
+            }
+            type = rd16(p + off);
+        }
+        off += 2;
+        return rawParseEther(type, p + off, caplen - off, pr);
+    }
+    case rawDltLinuxSLL:
+        if (caplen < 16) {
+            return parseRes::notTCP;
+        }
+        return rawParseEther(rd16(p + 14), p + 16, caplen - 16, pr);
+    case rawDltLinuxSLL2:
+        if (caplen < 20) {
+            return parseRes::notTCP;
+        }
+        return rawParseEther(rd16(p), p + 20, caplen - 20, pr);
+    case rawDltNull:
+    case rawDltLoop:
+        // 4 byte address family (byte order varies) - just look at the IP version
+        if (caplen < 4) {
+            return parseRes::notTCP;
+        }
+        return rawParseIP(p + 4, caplen - 4, pr);
+    case rawDltRaw:
+    case rawDltRawBSD:
+    case rawDltIPv4:
+    case rawDltIPv6:
+        return rawParseIP(p, caplen, pr);
+    }
+    return parseRes::notV4or6;
+}
+
+#endif // RAWPARSE_HPP
@@ -0,0 +1,123 @@
+/*
+ * rcuCell: a read-mostly object that's replaced, never modified in place
+ *
+ * Readers get the current version with a single atomic load and never
+ * wait. A writer (there's one, or they're serialized by the caller)
+ * publishes a new version with update() and the old one is freed once
+ * every registered reader has passed a quiescent point since, i.e.
+ * called quiesce(), which says the reader holds no pointer it got from
+ * read() before. Each reader quiesces between the units of work it reads
+ * the object for (e.g., per packet), which is a load of the shared epoch
+ * and a store to the reader's own cache line. A reader that stops (or
+ * blocks for a long time) only delays freeing retired versions, never
+ * the writer.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef RCU_HPP
+#define RCU_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template<typename T>
+struct rcuCell {
+    struct alignas(64) reader {
+        std::atomic<uint64_t> seen{UINT64_MAX};     // epoch at last quiesce (max = not reading)
+    };
+
+    ~rcuCell() {
+        for (auto& [e, p] : _retired) {
+            delete p;
+        }
+        delete _cur.load();
+    }
+
+    // set the first version and the number of readers (who each quiesce before their first read)
+    void init(const T* v, int readers) {
+        _cur.store(v);
+        _rd = std::make_unique<reader[]>(readers);
+        _nrd = readers;
+    }
+
+    const T* read() const { return _cur.load(std::memory_order_acquire); }
+
+    // reader 'r' (0 <= r < readers) holds nothing from read() calls before this
+    void quiesce(int r) {
+        _rd[r].seen.store(_epoch.load(std::memory_order_acquire), std::memory_order_release);
+    }
+    // reader 'r' won't read again (until its next quiesce)
+    void offline(int r) { _rd[r].seen.store(UINT64_MAX, std::memory_order_release); }
+
+    // (writer) publish 'v' and free the versions no reader can still hold
+    void update(const T* v) {
+        const T* old = _cur.exchange(v);
+        _retired.emplace_back(_epoch.fetch_add(1) + 1, old);
+        reclaim();
+    }
+
+    // (writer) free the retired versions every reader has quiesced past
+    void reclaim() {
+        uint64_t m = UINT64_MAX;
+        for (int i = 0; i < _nrd; i++) {
+            m = std::min(m, _rd[i].seen.load(std::memory_order_acquire));
+        }
+        size_t k = 0;
+        for (auto& [e, p] : _retired) {
+            if (e <= m) {
+                delete p;
+            } else {
+                _retired[k++] = {e, p};
+            }
+        }
+        _retired.resize(k);
+    }
+    size_t retired() const { return _retired.size(); }
+
+  private:
+    std::atomic<const T*> _cur{};
+    std::atomic<uint64_t> _epoch{1};
+    std::unique_ptr<reader[]> _rd;
+    int _nrd{};
+    std::vector<std::pair<uint64_t, const T*>> _retired;   // (epoch retired at, version)
+};
+
+#endif // RCU_HPP
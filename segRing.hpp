@@ -0,0 +1,87 @@
+/*
+ * segRing: a flow's recently sent segments for SEQ/ACK matched ppings
+ *
+ * With --seqack, each data segment a flow sends (while it has room) is
+ * recorded as (TSval, end seq, capture time) in a small fixed ring. A
+ * returning ack whose ack number is exactly a recorded segment's end seq
+ * and whose ECR is that segment's TSval gives the RTT to that segment
+ * rather than to the first packet seen with the TSval (what the tsval
+ * table alone gives), so flows sending many segments per TSval tick get
+ * more, and tighter, RTT samples. Acks drop the segments they cover. When
+ * the ring is full new segments aren't recorded until acks make room, so
+ * a flow with more in flight gets a sample of its segments matched.
+ * Segments that don't advance the seq (retransmissions) aren't recorded
+ * and their acks echo a newer TSval so they can't match the original.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef SEGRING_HPP
+#define SEGRING_HPP
+
+#include <cstdint>
+
+struct segRing {
+    static constexpr uint32_t N = 32;   // segments held (power of 2)
+    struct seg {
+        uint32_t tsval;
+        uint32_t endSeq;
+        double tm;
+    };
+    seg _s[N];
+    uint32_t _hd{}, _tl{};
+
+    void add(uint32_t tsval, uint32_t endSeq, double tm) {
+        if (_tl - _hd == N || (_tl != _hd && int32_t(endSeq - _s[(_tl - 1) % N].endSeq) <= 0)) {
+            return;
+        }
+        _s[_tl++ % N] = {tsval, endSeq, tm};
+    }
+
+    // capture time of the segment acked by (ack, ecr) or -1 if none
+    double match(uint32_t ack, uint32_t ecr) {
+        double t = -1.;
+        while (_hd != _tl && int32_t(_s[_hd % N].endSeq - ack) <= 0) {
+            const seg& s = _s[_hd++ % N];
+            if (s.endSeq == ack && s.tsval == ecr) {
+                t = s.tm;
+            }
+        }
+        return t;
+    }
+};
+
+#endif // SEGRING_HPP
@@ -0,0 +1,137 @@
+/*
+ * slabPool: pooled allocation of fixed-size objects with stable indices
+ *
+ * Objects are constructed in place in large slabs (allocated as needed and
+ * never moved) and are named by a 32 bit index rather than a pointer, so
+ * objects can refer to each other compactly and state for millions of them
+ * doesn't fragment the heap. Index 0 is never allocated and means "none".
+ * Freed slots are reused most recently freed first (they're likely still
+ * in cache). Slabs come from a hugeArena if one is given.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef SLABPOOL_HPP
+#define SLABPOOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "./hugeArena.hpp"
+
+template <typename T>
+struct slabPool {
+    static constexpr uint32_t slabBits = 12;    // 4096 objects per slab
+    static constexpr uint32_t slabObjs = 1u << slabBits;
+
+    explicit slabPool(hugeArena* a = nullptr) : _arena(a) {}
+    slabPool(const slabPool&) = delete;
+    slabPool& operator=(const slabPool&) = delete;
+    ~slabPool() {
+        // (destroy whatever is still live)
+        for (uint32_t i = 1; i < _next; i++) {
+            if (used(i)) {
+                (*this)[i].~T();
+            }
+        }
+        for (slab* s : _slabs) {
+            if (_arena) {
+                _arena->free(s, sizeof(slab));
+            } else {
+                delete s;
+            }
+        }
+    }
+
+    template <typename... A>
+    uint32_t alloc(A&&... args) {
+        uint32_t i;
+        if (!_free.empty()) {
+            i = _free.back();
+            _free.pop_back();
+        } else {
+            i = _next++;
+            if ((i >> slabBits) >= _slabs.size()) {
+                _slabs.push_back(_arena ? new (_arena->alloc(sizeof(slab))) slab : new slab);
+            }
+        }
+        new (slot(i)) T(std::forward<A>(args)...);
+        if (i >= _used.size()) {
+            _used.resize(size_t(i) * 2);
+        }
+        _used[i] = true;
+        _live++;
+        return i;
+    }
+
+    void free(uint32_t i) {
+        (*this)[i].~T();
+        _used[i] = false;
+        _free.push_back(i);
+        _live--;
+    }
+
+    T& operator[](uint32_t i) { return *std::launder(reinterpret_cast<T*>(slot(i))); }
+    const T& operator[](uint32_t i) const {
+        return *std::launder(reinterpret_cast<const T*>(slot(i)));
+    }
+
+    // indices in use are in [1, end()) (for walking the pool)
+    uint32_t end() const { return _next; }
+    bool used(uint32_t i) const { return i < _used.size() && _used[i]; }
+    size_t live() const { return _live; }
+    size_t bytes() const { return _slabs.size() * sizeof(slab); }   // memory held
+
+  private:
+    struct slab {
+        alignas(T) unsigned char b[sizeof(T) * slabObjs];
+    };
+    hugeArena* _arena;
+    std::vector<slab*> _slabs;
+    std::vector<uint32_t> _free;
+    std::vector<bool> _used;
+    uint32_t _next{1};          // next never-used index (0 is "none")
+    size_t _live{};
+
+    unsigned char* slot(uint32_t i) const {
+        return _slabs[i >> slabBits]->b + sizeof(T) * (i & (slabObjs - 1));
+    }
+};
+
+#endif // SLABPOOL_HPP
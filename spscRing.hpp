@@ -0,0 +1,205 @@
+/*
+ * spscRing: bounded lock-free single-producer/single-consumer ring
+ *
+ * Connects dlyloc's pipeline stages. The producer and consumer indices are
+ * on separate cache lines and each side keeps a cached copy of the other's
+ * index so, in steady state, a push or pop touches only its own line plus
+ * the slot. push() never blocks: it returns false when the ring is full and
+ * the caller decides whether to drop or wait. Occupancy high-water and
+ * drop counts are kept for the summary report. The slots can be put in a
+ * hugeArena (on the consumer's node).
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef SPSCRING_HPP
+#define SPSCRING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include "./hugeArena.hpp"
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// spin, then yield, then sleep while waiting on a ring
+struct backoff {
+    int _n{};
+    void reset() { _n = 0; }
+    void pause() {
+        if (++_n < 64) {
+            cpuRelax();
+        } else if (_n < 128) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+};
+
+template<typename T>
+struct spscRing {
+    explicit spscRing(size_t minSize, hugeArena* a = nullptr) : _arena(a) {
+        size_t n = 2;
+        while (n < minSize) n <<= 1;
+        if (a) {
+            _buf = static_cast<T*>(a->alloc(n * sizeof(T)));
+            std::uninitialized_default_construct_n(_buf, n);
+        } else {
+            _buf = new T[n];
+        }
+        _mask = n - 1;
+    }
+    spscRing(const spscRing&) = delete;
+    spscRing& operator=(const spscRing&) = delete;
+    ~spscRing() {
+        if (_arena) {
+            std::destroy_n(_buf, _mask + 1);
+            _arena->free(_buf, (_mask + 1) * sizeof(T));
+        } else {
+            delete[] _buf;
+        }
+    }
+
+    // producer side
+    bool push(const T& v) {
+        size_t t = _tail.load(std::memory_order_relaxed);
+        if (t - _headCache > _mask || (t & 63) == 0) {
+            _headCache = _head.load(std::memory_order_acquire);
+            size_t occ = t - _headCache;
+            if (occ > hwm.load(std::memory_order_relaxed)) {
+                hwm.store(occ, std::memory_order_relaxed);
+            }
+            if (occ > _mask) {
+                return false;
+            }
+        }
+        _buf[t & _mask] = v;
+        _tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    // push up to n entries with one index update, returns how many fit
+    size_t push(const T* v, size_t n) {
+        size_t t = _tail.load(std::memory_order_relaxed);
+        if (t + n - _headCache > _mask + 1) {
+            _headCache = _head.load(std::memory_order_acquire);
+        }
+        size_t occ = t - _headCache;
+        size_t k = std::min(n, _mask + 1 - occ);
+        if (occ + k > hwm.load(std::memory_order_relaxed)) {
+            hwm.store(occ + k, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < k; i++) {
+            _buf[(t + i) & _mask] = v[i];
+        }
+        _tail.store(t + k, std::memory_order_release);
+        return k;
+    }
+    void drop() { drops.store(drops.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+    void close() { _closed.store(true, std::memory_order_release); }
+
+    // consumer side
+    T* front() {
+        size_t h = _head.load(std::memory_order_relaxed);
+        if (h == _tailCache) {
+            _tailCache = _tail.load(std::memory_order_acquire);
+            if (h == _tailCache) {
+                return nullptr;
+            }
+        }
+        return &_buf[h & _mask];
+    }
+    void pop() { _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    bool pop(T& v) {
+        T* p = front();
+        if (p == nullptr) {
+            return false;
+        }
+        v = *p;
+        pop();
+        return true;
+    }
+    // take up to max entries with one index update, returns how many
+    size_t pop(T* v, size_t max) {
+        size_t h = _head.load(std::memory_order_relaxed);
+        if (_tailCache - h < max) {
+            _tailCache = _tail.load(std::memory_order_acquire);
+        }
+        size_t n = std::min(max, _tailCache - h);
+        for (size_t i = 0; i < n; i++) {
+            v[i] = _buf[(h + i) & _mask];
+        }
+        if (n) {
+            _head.store(h + n, std::memory_order_release);
+        }
+        return n;
+    }
+    // true when the producer closed the ring and everything has been consumed
+    bool finished() {
+        return _closed.load(std::memory_order_acquire) && front() == nullptr;
+    }
+
+    // either side (or an observer)
+    size_t size() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+    size_t capacity() const { return _mask + 1; }
+
+    std::atomic<uint64_t> drops{};  // pushes refused because ring was full (counted by caller)
+    std::atomic<size_t> hwm{};      // occupancy high-water (reset by the summary)
+
+  private:
+    hugeArena* _arena;
+    T* _buf;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _tail{};    // written by producer
+    size_t _headCache{};
+    alignas(64) std::atomic<size_t> _head{};    // written by consumer
+    size_t _tailCache{};
+    alignas(64) std::atomic<bool> _closed{};
+};
+
+#endif // SPSCRING_HPP
@@ -0,0 +1,228 @@
+/*
+ * stateFile: flow state snapshots for warm restarts (--state)
+ *
+ * A snapshot holds every flow's clock estimation state (the moving min,
+ * both lower hulls, the fitted clock and zero point, TSval wrap state)
+ * and pping state plus the live entries of the TSval tables, so a
+ * restarted dlyloc has its clocks and pending TSvals from the first
+ * packet instead of reconverging. The file is a stateHdr followed by
+ * arrays of fixed size records, each 8-byte aligned, so it can be mapped
+ * and used in place:
+ *     stateHdr | flowState[nFlows] | statePt[nPts] | tsState[nTs]
+ * A flow's points (moving min candidates, then lhPts, lhSegs and any
+ * warmBuf points) are a run of statePts starting at its 'pts'. TSval
+ * entries refer to their flow by index in the flowState array. Times are
+ * capture times offset by the stateHdr's offTm (as dlyloc holds them).
+ * Reverse flow links and TSval table flow ids are rebuilt on loading, so
+ * a snapshot can be loaded with a different number of threads.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef STATEFILE_HPP
+#define STATEFILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+constexpr uint32_t stateVersion = 1;
+
+struct stateHdr {
+    char magic[4];      // "DLYS"
+    uint32_t version;
+    uint32_t flowSize;  // sizeof(flowState) (a check that it's the same layout)
+    uint32_t nFlows;
+    uint64_t nPts;
+    uint64_t nTs;
+    int64_t offTm;      // (unix seconds) time base of the capture times
+    double lastTm;      // latest capture time when written
+    int64_t wallTm;     // (unix seconds) when written
+};
+
+struct statePt {
+    double tm;
+    int64_t ts;
+};
+
+struct flowState {
+    flowKey fk;
+    double lastTm, bytesSnt, spTS, zeroTm, startTm, minPP, minTm, spSet;
+    int64_t lstTS, zeroTS, startTS, minTS, tickScl;
+    double mmNxt;               // movingMin state
+    int64_t mmInterval, mmSub;
+    int64_t warmGap;
+    tsWrap twrap, ewrap;
+    uint64_t pts;               // first of this flow's points
+    uint32_t nMm, nLhPts, nLhSegs, nWarm;   // (nWarm > 0 if it had a warmBuf)
+    uint16_t pktCnt;
+    uint8_t clkSet, full, clkRef, pad[3];
+};
+static_assert(sizeof(flowState) % 8 == 0, "flowState records must stay 8-byte aligned");
+
+struct tsState {
+    uint32_t flow;      // index in the flowState array | tsvalTable::usedBit
+    uint32_t tsv;
+    double tm;
+};
+
+// append the state of flow 'f' to 'fs' (its points to 'pts')
+static inline void saveFlow(const flowDly& f, std::vector<flowState>& fs, std::vector<statePt>& pts)
+{
+    flowState s{};
+    s.fk = f._key;
+    s.lastTm = f._lastTm;
+    s.bytesSnt = f.bytesSnt;
+    s.spTS = f.spTS;
+    s.zeroTm = f.zeroTm;
+    s.startTm = f.startTm;
+    s.minPP = f._minPP;
+    s.minTm = f._minTm;
+    s.spSet = f.spSet;
+    s.lstTS = f.lstTS;
+    s.zeroTS = f.zeroTS;
+    s.startTS = f.startTS;
+    s.minTS = f._minTS;
+    s.tickScl = f.tickScl;
+    s.mmNxt = f._mm._nxtIntr;
+    s.mmInterval = f._mm._interval;
+    s.mmSub = f._mm._sub;
+    s.twrap = f.twrap;
+    s.ewrap = f.ewrap;
+    s.pktCnt = f.pktCnt;
+    s.clkSet = f.clkSet;
+    s.full = f.full;
+    s.clkRef = f.clkRef;
+    s.pts = pts.size();
+    const auto& mm = f._mm._minList;
+    for (size_t i = mm.begin(); i < mm.end(); i++) {
+        pts.push_back({mm.at(i).first, mm.at(i).second});
+    }
+    s.nMm = mm.size();
+    for (size_t i = f.lhPts._pts.begin(); i < f.lhPts._pts.end(); i++) {
+        pts.push_back({f.lhPts.pt(i).tm, f.lhPts.pt(i).ts});
+    }
+    s.nLhPts = f.lhPts.size();
+    for (size_t i = f.lhSegs._pts.begin(); i < f.lhSegs._pts.end(); i++) {
+        pts.push_back({f.lhSegs.pt(i).tm, f.lhSegs.pt(i).ts});
+    }
+    s.nLhSegs = f.lhSegs.size();
+    if (f.warm) {
+        for (uint32_t i = 0; i < f.warm->_n; i++) {
+            pts.push_back({f.warm->_p[i].tm, f.warm->_p[i].ts});
+        }
+        s.nWarm = f.warm->_n;
+        s.warmGap = f.warm->_gap;
+    }
+    fs.push_back(s);
+}
+
+// set the state of the (newly made) flow 'f' from 's' whose points are in 'pts'
+static inline void loadFlow(flowDly& f, const flowState& s, const statePt* pts)
+{
+    f._lastTm = s.lastTm;
+    f.bytesSnt = s.bytesSnt;
+    f.spTS = s.spTS;
+    f.zeroTm = s.zeroTm;
+    f.startTm = s.startTm;
+    f._minPP = s.minPP;
+    f._minTm = s.minTm;
+    f.spSet = s.spSet;
+    f.lstTS = s.lstTS;
+    f.zeroTS = s.zeroTS;
+    f.startTS = s.startTS;
+    f._minTS = s.minTS;
+    f.tickScl = s.tickScl;
+    f._mm._nxtIntr = s.mmNxt;
+    f._mm._interval = s.mmInterval;
+    f._mm._sub = s.mmSub;
+    f.twrap = s.twrap;
+    f.ewrap = s.ewrap;
+    f.pktCnt = s.pktCnt;
+    f.clkSet = s.clkSet;
+    f.full = s.full;
+    f.clkRef = s.clkRef;
+    const statePt* p = pts + s.pts;
+    f._mm._minList.clear();
+    for (uint32_t i = 0; i < s.nMm; i++, p++) {
+        f._mm._minList.push_back({p->tm, p->ts});
+    }
+    // (re-adding a hull's points in order rebuilds the same hull)
+    for (uint32_t i = 0; i < s.nLhPts; i++, p++) {
+        f.lhPts.add(tSamp{p->tm, p->ts});
+    }
+    for (uint32_t i = 0; i < s.nLhSegs; i++, p++) {
+        f.lhSegs.add(tSamp{p->tm, p->ts});
+    }
+    if (s.nWarm) {
+        f.warm = std::make_unique<warmBuf>();
+        for (uint32_t i = 0; i < s.nWarm && i < warmBuf::N; i++, p++) {
+            f.warm->_p[i] = {p->tm, p->ts};
+        }
+        f.warm->_n = std::min(s.nWarm, warmBuf::N);
+        f.warm->_gap = s.warmGap;
+    }
+}
+
+// check a mapped snapshot of 'len' bytes. Returns nullptr if it isn't one.
+static inline const stateHdr* stateCheck(const void* p, size_t len)
+{
+    auto h = (const stateHdr*)p;
+    if (len < sizeof(*h) || memcmp(h->magic, "DLYS", 4) != 0 || h->version != stateVersion ||
+        h->flowSize != sizeof(flowState)) {
+        return nullptr;
+    }
+    if (h->nPts > len / sizeof(statePt) || h->nTs > len / sizeof(tsState)) {
+        return nullptr;     // (and the sizes below can't overflow)
+    }
+    uint64_t n = sizeof(*h) + uint64_t(h->nFlows) * sizeof(flowState) +
+                 h->nPts * sizeof(statePt) + h->nTs * sizeof(tsState);
+    return n == len ? h : nullptr;
+}
+
+// true if flow 's' of the snapshot 'h' has its points inside the snapshot
+static inline bool stateFlowOk(const stateHdr* h, const flowState& s)
+{
+    uint64_t n = uint64_t(s.nMm) + s.nLhPts + s.nLhSegs + s.nWarm;
+    return s.pts <= h->nPts && n <= h->nPts - s.pts;
+}
+static inline const flowState* stateFlows(const stateHdr* h) { return (const flowState*)(h + 1); }
+static inline const statePt* statePts(const stateHdr* h) { return (const statePt*)(stateFlows(h) + h->nFlows); }
+static inline const tsState* stateTs(const stateHdr* h) { return (const tsState*)(statePts(h) + h->nPts); }
+
+#endif // STATEFILE_HPP
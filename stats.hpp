@@ -0,0 +1,174 @@
+/*
+ * stats: optional hot path instrumentation
+ *
+ * Built only with 'make STATS=1' (-DDLYLOC_STATS). Otherwise the STATS_*
+ * macros expand to nothing so the packet path is unchanged. Stages are
+ * timed with the cycle counter (rdtsc, or cntvct on arm64) into HDR style
+ * log-linear histograms: 16 sub-buckets per power of two, so a recorded
+ * value is within 1/16 of its true value. Each histogram has a single
+ * writer (the thread that owns the stage) so a record is a plain load and
+ * store of relaxed atomics and readers in other threads see counts that
+ * are at worst a little stale.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#ifdef DLYLOC_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// cycle counter rate, measured over 20ms the first time it's needed
+static inline double cycleHz()
+{
+    static const double hz = [] {
+        using clk = std::chrono::steady_clock;
+        auto t0 = clk::now();
+        uint64_t c0 = cycles();
+        while (clk::now() - t0 < std::chrono::milliseconds(20)) {
+        }
+        std::chrono::duration<double> dt = clk::now() - t0;
+        return double(cycles() - c0) / dt.count();
+    }();
+    return hz;
+}
+
+struct latHist {
+    static constexpr int subBits = 4;
+    static constexpr int nSub = 1 << subBits;
+    static constexpr int nBuckets = (64 - subBits + 1) * nSub;
+
+    std::atomic<uint64_t> cnt[nBuckets]{};
+    std::atomic<uint64_t> sum{};
+
+    // values below nSub get their own bucket; above that a bucket is the
+    // position of the leading 1 bit and the subBits bits after it
+    static int bucket(uint64_t v) {
+        if (v < nSub) {
+            return int(v);
+        }
+        int e = 63 - __builtin_clzll(v);
+        return (e - subBits + 1) * nSub + int((v >> (e - subBits)) & (nSub - 1));
+    }
+    // smallest value in bucket 'b'
+    static uint64_t lowest(int b) {
+        int g = b / nSub, s = b % nSub;
+        if (g == 0) {
+            return s;
+        }
+        int e = g + subBits - 1;
+        return (uint64_t(1) << e) | (uint64_t(s) << (e - subBits));
+    }
+
+    void record(uint64_t v) {
+        auto& c = cnt[bucket(v)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (const auto& c : cnt) {
+            n += c.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+    // add another histogram's counts to 'n' (for summing across threads)
+    void addTo(uint64_t* n) const {
+        for (int i = 0; i < nBuckets; i++) {
+            n[i] += cnt[i].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// value at quantile 'q' of bucket counts 'n' (the bucket's lower bound)
+static inline uint64_t histQuantile(const uint64_t* n, double q)
+{
+    uint64_t tot = 0;
+    for (int i = 0; i < latHist::nBuckets; i++) {
+        tot += n[i];
+    }
+    if (tot == 0) {
+        return 0;
+    }
+    uint64_t rank = uint64_t(q * double(tot - 1)), seen = 0;
+    for (int i = 0; i < latHist::nBuckets; i++) {
+        seen += n[i];
+        if (seen > rank) {
+            return latHist::lowest(i);
+        }
+    }
+    return latHist::lowest(latHist::nBuckets - 1);
+}
+
+// lap timer: STATS_START(t) then each STATS_LAP(hist, t) records the
+// cycles since the previous start/lap
+#define STATS_START(t) uint64_t t = cycles()
+#define STATS_LAP(h, t) do {                                \
+        uint64_t now_ = cycles();                           \
+        (h).record(now_ - (t));                             \
+        (t) = now_;                                         \
+    } while (0)
+#define STATS_ONLY(...) __VA_ARGS__
+
+#else
+
+#define STATS_START(t)
+#define STATS_LAP(h, t)
+#define STATS_ONLY(...)
+
+#endif // DLYLOC_STATS
+
+#endif // STATS_HPP
@@ -0,0 +1,187 @@
+/*
+ * tDigest: mergeable streaming quantile sketch (Dunning's merging t-digest)
+ *
+ * Samples are buffered and periodically merged into a sorted list of
+ * centroids (mean, weight) whose sizes are bounded by the k1 (arcsine)
+ * scale function, so centroids are small near the tails and quantiles
+ * like p99 stay accurate. 'compression' bounds the number of centroids
+ * (roughly compression/2 after a merge). Two digests merge by feeding
+ * one's centroids into the other, so per-flow digests can be rolled up
+ * into per-prefix ones without keeping the samples.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef TDIGEST_HPP
+#define TDIGEST_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct tDigest {
+    tDigest() = default;
+    explicit tDigest(double compression) : _delta{compression} {}
+
+    void add(double x, double w = 1.) {
+        if (_n == 0.) {
+            _min = _max = x;
+        } else {
+            _min = std::min(_min, x);
+            _max = std::max(_max, x);
+        }
+        _buf.push_back({x, w});
+        _n += w;
+        if (_buf.size() >= size_t(_delta)) {
+            compress();
+        }
+    }
+
+    void merge(const tDigest& o) {
+        if (o._n == 0.) {
+            return;
+        }
+        if (_n == 0.) {
+            _min = o._min;
+            _max = o._max;
+        } else {
+            _min = std::min(_min, o._min);
+            _max = std::max(_max, o._max);
+        }
+        _buf.insert(_buf.end(), o._cent.begin(), o._cent.end());
+        _buf.insert(_buf.end(), o._buf.begin(), o._buf.end());
+        _n += o._n;
+        if (_buf.size() >= size_t(_delta)) {
+            compress();
+        }
+    }
+
+    double count() const { return _n; }
+    double min() const { return _min; }
+    double max() const { return _max; }
+    bool empty() const { return _n == 0.; }
+
+    // estimate of the value at quantile 'q' (0..1); NaN if empty
+    double quantile(double q) {
+        compress();
+        if (_cent.empty()) {
+            return NAN;
+        }
+        if (_cent.size() == 1) {
+            return _cent[0].m;
+        }
+        double idx = q * _n;
+        if (idx < 1.) {
+            return _min;
+        }
+        if (idx > _n - 1.) {
+            return _max;
+        }
+        // tails: interpolate between the extreme value and the first/last centroid
+        const auto& f = _cent.front();
+        if (f.w > 2. && idx < f.w / 2.) {
+            return _min + (idx - 1.) / (f.w / 2. - 1.) * (f.m - _min);
+        }
+        const auto& l = _cent.back();
+        if (l.w > 2. && _n - idx <= l.w / 2.) {
+            return _max - (_n - idx - 1.) / (l.w / 2. - 1.) * (_max - l.m);
+        }
+        // otherwise interpolate between the centers of adjacent centroids
+        double soFar = f.w / 2.;
+        for (size_t i = 0; i + 1 < _cent.size(); i++) {
+            double dw = (_cent[i].w + _cent[i + 1].w) / 2.;
+            if (soFar + dw > idx) {
+                double z1 = idx - soFar, z2 = soFar + dw - idx;
+                return (_cent[i].m * z2 + _cent[i + 1].m * z1) / dw;
+            }
+            soFar += dw;
+        }
+        return l.m;
+    }
+
+    void clear() {
+        _cent.clear();
+        _buf.clear();
+        _n = 0.;
+    }
+
+  private:
+    struct centroid {
+        double m, w;    // mean, weight
+    };
+    double _delta{100.};
+    double _n{};        // total weight
+    double _min{}, _max{};
+    std::vector<centroid> _cent;    // merged, sorted by mean
+    std::vector<centroid> _buf;     // not yet merged
+
+    // k1 scale function and its inverse
+    double kOfQ(double q) const { return _delta / (2. * M_PI) * asin(2. * q - 1.); }
+    double qOfK(double k) const {
+        double a = std::min(k * 2. * M_PI / _delta, M_PI / 2.);
+        return (sin(a) + 1.) / 2.;
+    }
+
+    // merge the buffered samples into the centroids
+    void compress() {
+        if (_buf.empty()) {
+            return;
+        }
+        _buf.insert(_buf.end(), _cent.begin(), _cent.end());
+        std::sort(_buf.begin(), _buf.end(),
+                  [](const centroid& a, const centroid& b) { return a.m < b.m; });
+        _cent.clear();
+        double soFar = 0.;
+        double limit = _n * qOfK(kOfQ(0.) + 1.);
+        centroid cur = _buf[0];
+        for (size_t i = 1; i < _buf.size(); i++) {
+            const auto& x = _buf[i];
+            if (soFar + cur.w + x.w <= limit) {
+                cur.w += x.w;
+                cur.m += (x.m - cur.m) * x.w / cur.w;
+            } else {
+                soFar += cur.w;
+                _cent.push_back(cur);
+                limit = _n * qOfK(kOfQ(soFar / _n) + 1.);
+                cur = x;
+            }
+        }
+        _cent.push_back(cur);
+        _buf.clear();
+    }
+};
+
+#endif // TDIGEST_HPP
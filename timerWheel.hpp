@@ -0,0 +1,142 @@
+/*
+ * timerWheel: hierarchical timer wheel keyed on capture time
+ *
+ * Four levels of 64 slots. Level 0 slots are one tick wide, each higher
+ * level's slots are 64 times wider, and entries cascade down a level as
+ * their slot comes up, so adding an entry is O(1) and advancing costs
+ * O(entries that come due) plus one step per tick. Entries further out
+ * than the wheel spans (64^4 ticks) sit in the last slot and come due
+ * early; an entry is only a reminder to look at something and the
+ * callback decides what to do (e.g., re-add it for a later time).
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+template <typename E>
+struct timerWheel {
+    static constexpr int levels = 4;
+    static constexpr int slotBits = 6;
+    static constexpr int64_t slots = 1 << slotBits;
+    static constexpr int64_t slotMask = slots - 1;
+
+    explicit timerWheel(double tick = 1. / 16) : _tick{tick} {}
+
+    // the wheel's current time is 'now' (nothing will be due before it)
+    void start(double now) { _now = ticks(now); }
+
+    // call back with 'e' once the wheel advances past time 'when'
+    void add(double when, const E& e) {
+        int64_t t = ticks(when);
+        if (t <= _now) {
+            t = _now + 1;
+        }
+        put(t, e);
+        _size++;
+    }
+
+    /*
+     * Advance the wheel to time 'now' calling f(entry) for each entry that
+     * has come due. f may add new entries.
+     */
+    template <typename F>
+    void advance(double now, F&& f) {
+        int64_t end = ticks(now);
+        if (_size == 0) {
+            if (end > _now) {
+                _now = end;
+            }
+            return;
+        }
+        while (_now < end) {
+            _now++;
+            // bring the next higher level slot down whenever a level wraps
+            for (int l = 1; l < levels && ((_now >> (slotBits * (l - 1))) & slotMask) == 0; l++) {
+                auto& s = _wheel[l][(_now >> (slotBits * l)) & slotMask];
+                std::vector<std::pair<int64_t, E>> v;
+                v.swap(s);
+                for (auto& [t, e] : v) {
+                    put(t, e);
+                }
+            }
+            auto& s = _wheel[0][_now & slotMask];
+            if (s.empty()) {
+                continue;
+            }
+            std::vector<std::pair<int64_t, E>> due;
+            due.swap(s);
+            _size -= due.size();
+            for (auto& [t, e] : due) {
+                f(e);
+            }
+            if (s.empty()) {
+                due.clear();
+                s.swap(due);    // (keep the slot's allocation)
+            }
+        }
+    }
+
+    size_t size() const { return _size; }
+
+  private:
+    double _tick;
+    int64_t _now{};
+    size_t _size{};
+    std::vector<std::pair<int64_t, E>> _wheel[levels][slots];
+
+    int64_t ticks(double t) const { return int64_t(floor(t / _tick)); }
+
+    void put(int64_t t, const E& e) {
+        int64_t d = t - _now;
+        int l = 0;
+        while (l < levels - 1 && d >= (int64_t(1) << (slotBits * (l + 1)))) {
+            l++;
+        }
+        if (d >= (int64_t(1) << (slotBits * levels))) {
+            t = _now + (int64_t(1) << (slotBits * levels)) - 1;     // (comes due early)
+        }
+        _wheel[l][(t >> (slotBits * l)) & slotMask].emplace_back(t, e);
+    }
+};
+
+#endif // TIMERWHEEL_HPP
@@ -0,0 +1,271 @@
+/*
+ * topkWriter: periodic ranking of the flows with the most queueing delay
+ *
+ * On a busy link even --digest keeps state for every flow seen in an
+ * interval. This keeps a fixed number of counters instead: each flow's
+ * queueing delay samples (its rtt less its min rtt, and dv1) are summed in
+ * a space-saving summary (Metwally et al.) of 4*K entries (at least 64)
+ * and every interval the K largest sums are printed, worst first, e.g.
+ *
+ *   machine: <interval end> <metric> <rank> <n> <mean> <max> <sum> <err> <flow or prefixes>
+ *   human:   <interval end> <metric> #<rank> n <n> mean <v> max <v> sum <v> err <v> <flow or prefixes>
+ *
+ * A flow not in the table takes the place of the smallest entry and
+ * inherits its sum as 'err', so 'sum' over-estimates by at most 'err'
+ * (and by at most total/entries). n, mean and max are exact for the
+ * samples since the flow entered the table. Src/dst prefix pairs go into
+ * tables of their own so they're ranked with the same bound.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef TOPK_HPP
+#define TOPK_HPP
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <vector>
+#include "./outWriter.hpp"
+
+// fixed size space-saving summary: a min-heap on sum plus a key index
+struct spaceSaving {
+    struct entry {
+        flowKey key;
+        double sum;         // estimated total (at most 'err' too large)
+        double err;         // sum of the entry this one replaced
+        double max;         // largest sample since entering
+        uint32_t n;         // samples since entering
+    };
+
+    void setCap(size_t cap) {
+        _cap = std::max<size_t>(cap, 1);
+        _h.reserve(_cap);
+        _idx.reserve(_cap);
+    }
+
+    void add(const flowKey& k, double v) {
+        if (auto it = _idx.find(k); it != _idx.end()) {
+            auto& e = _h[it->second];
+            e.sum += v;
+            e.max = std::max(e.max, v);
+            e.n++;
+            down(it->second);
+            return;
+        }
+        if (_h.size() < _cap) {
+            _h.push_back({k, v, 0., v, 1});
+            _idx.emplace(k, uint32_t(_h.size() - 1));
+            up(_h.size() - 1);
+            return;
+        }
+        if (v <= 0.) {
+            return;         // (couldn't rank above what it replaces)
+        }
+        auto& e = _h[0];
+        _idx.erase(e.key);
+        e = {k, e.sum + v, e.sum, v, 1};
+        _idx.emplace(k, 0u);
+        down(0);
+    }
+
+    // the 'k' largest entries, largest first
+    const std::vector<entry>& top(size_t k) {
+        _rank.assign(_h.begin(), _h.end());
+        k = std::min(k, _rank.size());
+        std::partial_sort(_rank.begin(), _rank.begin() + k, _rank.end(),
+                          [](const entry& a, const entry& b) { return a.sum > b.sum; });
+        _rank.resize(k);
+        return _rank;
+    }
+
+    bool empty() const { return _h.empty(); }
+    void clear() {
+        _h.clear();
+        _idx.clear();
+    }
+
+  private:
+    size_t _cap{1};
+    std::vector<entry> _h;
+    std::unordered_map<flowKey, uint32_t, flowKeyHash> _idx;    // key -> heap slot
+    std::vector<entry> _rank;
+
+    void swap(size_t i, size_t j) {
+        std::swap(_h[i], _h[j]);
+        _idx[_h[i].key] = uint32_t(i);
+        _idx[_h[j].key] = uint32_t(j);
+    }
+    void up(size_t i) {
+        while (i > 0 && _h[i].sum < _h[(i - 1) / 2].sum) {
+            swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    void down(size_t i) {
+        for (size_t c; (c = 2 * i + 1) < _h.size(); i = c) {
+            if (c + 1 < _h.size() && _h[c + 1].sum < _h[c].sum) {
+                c++;
+            }
+            if (!(_h[c].sum < _h[i].sum)) {
+                break;
+            }
+            swap(i, c);
+        }
+    }
+};
+
+struct topkWriter {
+    static constexpr int nMetrics = 2;      // queueing delay (rtt - min rtt), dv1
+
+    topkWriter(outWriter& o, double interval, int k) : _out{o}, _clk{interval}, _k{size_t(std::max(k, 1))} {
+        size_t cap = std::max<size_t>(4 * _k, 64);
+        for (int m = 0; m < nMetrics; m++) {
+            _flows[m].setCap(cap);
+            _pfx[m].setCap(cap);
+        }
+    }
+
+    void byFlow(bool b) { _byFlow = b; }
+    void byPrefix(int v4len, int v6len) {
+        _byPfx = true;
+        _v4len = std::clamp(v4len, 0, 32);
+        _v6len = std::clamp(v6len, 0, 128);
+    }
+
+    // add an output record. 'offTm' is the offset of o.tm (as for outWriter)
+    void add(const outRec& o, int64_t offTm) {
+        _clk.tick(o.tm, [&] { flush(offTm); });
+        _offTm = offTm;
+        double v[nMetrics] = {o.rtt >= 0. ? std::max(0., o.rtt - o.minPP) : -1., o.dv[1]};
+        flowKey pk{};
+        if (_byPfx) {
+            pk.src = o.fk.src.masked(_v4len, _v6len);
+            pk.dst = o.fk.dst.masked(_v4len, _v6len);
+        }
+        for (int m = 0; m < nMetrics; m++) {
+            if (v[m] < 0.) {
+                continue;
+            }
+            if (_byFlow) {
+                _flows[m].add(o.fk, v[m]);
+            }
+            if (_byPfx) {
+                _pfx[m].add(pk, v[m]);
+            }
+        }
+    }
+
+    // write the rankings of the current interval then start a new one
+    void flush(int64_t offTm) {
+        double tm = _clk.stamp();
+        for (int m = 0; m < nMetrics; m++) {
+            if (!_flows[m].empty()) {
+                lines(tm, offTm, m, false, _flows[m].top(_k));
+                _flows[m].clear();
+            }
+            if (!_pfx[m].empty()) {
+                lines(tm, offTm, m, true, _pfx[m].top(_k));
+                _pfx[m].clear();
+            }
+        }
+    }
+
+    // end of input: rank the partial interval
+    void close() { flush(_offTm); }
+
+  private:
+    outWriter& _out;
+    sumClock _clk;          // report intervals
+    size_t _k;
+    int64_t _offTm{};
+    bool _byFlow{true};
+    bool _byPfx{};
+    int _v4len{24}, _v6len{48};
+    std::array<spaceSaving, nMetrics> _flows, _pfx;
+
+    void lines(double tm, int64_t offTm, int m, bool pfx, const std::vector<spaceSaving::entry>& r) {
+        static const char* const names[nMetrics] = {"qdly", "dv1"};
+        bool human = _out.format() != outFmt::machine;
+        char tmStr[32];
+        size_t tmLen = fmtSumTm(tmStr, tm, offTm, human) - tmStr;
+        for (size_t i = 0; i < r.size(); i++) {
+            const auto& e = r[i];
+            char buf[outWriter::maxRec];
+            char* p = buf;
+            memcpy(p, tmStr, tmLen);
+            p += tmLen;
+            *p++ = ' ';
+            p = fmtStr(p, names[m]);
+            *p++ = ' ';
+            if (human) {
+                *p++ = '#';
+            }
+            p = fmtUInt(p, i + 1);
+            *p++ = ' ';
+            if (human) {
+                p = fmtStr(p, "n ");
+            }
+            p = fmtUInt(p, e.n);
+            *p++ = ' ';
+            if (human) {
+                p = fmtStr(p, "mean ");
+            }
+            p = fmtSumVal(p, (e.sum - e.err) / e.n, human);
+            *p++ = ' ';
+            if (human) {
+                p = fmtStr(p, "max ");
+            }
+            p = fmtSumVal(p, e.max, human);
+            *p++ = ' ';
+            if (human) {
+                p = fmtStr(p, "sum ");
+            }
+            p = fmtSumVal(p, e.sum, human);
+            *p++ = ' ';
+            if (human) {
+                p = fmtStr(p, "err ");
+            }
+            p = fmtSumVal(p, e.err, human);
+            *p++ = ' ';
+            p = pfx ? fmtPrefixes(p, e.key, _v4len, _v6len) : fmtFlow(p, e.key);
+            *p++ = '\n';
+            _out.text(buf, p - buf);
+        }
+    }
+};
+
+#endif // TOPK_HPP
@@ -0,0 +1,347 @@
+/*
+ * tsvalTable: flat open-addressed table of TSval capture times
+ *
+ * Keyed by (flow id, TSval). Entries are 16 bytes so four share a cache
+ * line and a lookup is normally a single line access. Linear probing
+ * with backward-shift deletion keeps probe chains short without
+ * tombstones. The 'used' marker (entry already matched by an ECR) is the
+ * top bit of the flow id rather than a sign flip of the time.
+ *
+ * Expiry uses a moving threshold: capture time is divided into buckets
+ * of width maxAge/(nBkts-1) and when capture time enters a new bucket
+ * the threshold moves to the start of the bucket nBkts-1 back, so an
+ * entry lives at least maxAge. Moving it is O(1) (dead entries are
+ * recognized by their time on lookup) and the slots of dead entries are
+ * reclaimed a few at a time on each insert by a sweep cursor that cycles
+ * through the table.
+ *
+ * Nothing is ever done to the whole table at once. When it gets 3/4
+ * full the sweep first speeds up for one pass through the table (under
+ * churn most of those slots are dead). Only if it's still 3/4 full
+ * after that does it double: the new table is zeroed a few slots per add
+ * and then live entries are moved to it from the old a few slots per add
+ * or lookup, with both tables searched until the move is done. The table can be put in a hugeArena.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef TSVALTABLE_HPP
+#define TSVALTABLE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "./hugeArena.hpp"
+
+struct tsvalTable {
+    static constexpr uint32_t usedBit = 0x80000000u;   // entry already matched
+    static constexpr uint32_t idMask = ~usedBit;       // flow ids are 31 bits, 0 is empty
+    static constexpr int nBkts = 8;                     // time buckets per maxAge
+    static constexpr int sweepStep = 4;                 // slots reclaimed per insert
+    static constexpr int boostStep = 16;                // ... while the table is 3/4 full
+    static constexpr int moveStep = 8;                  // old table slots moved per operation
+    static constexpr int zeroStep = 64;                 // new table slots zeroed per insert
+
+    struct entry {
+        uint32_t fid;       // flow id | usedBit, 0 if slot is empty
+        uint32_t tsv;       // TSval
+        double tm;          // capture time of first packet with this TSval
+    };
+
+    explicit tsvalTable(size_t initSize = 1 << 16, double maxAge = 10., hugeArena* a = nullptr)
+        : _tbl(arenaAlloc<entry>(a)), _next(arenaAlloc<entry>(a)), _old(arenaAlloc<entry>(a)) {
+        size_t n = 16;
+        while (n < initSize) n <<= 1;
+        _tbl.assign(n, entry{0, 0, 0.});
+        _mask = n - 1;
+        setMaxAge(maxAge);
+    }
+
+    void setMaxAge(double maxAge) {
+        _bktWidth = (maxAge > 0. ? maxAge : 1e-3) / (nBkts - 1);
+        _curBkt = 0;
+        _expTm = -1e30;
+        _nxtBkt = _bktWidth;
+    }
+
+    // advance the expiry threshold to capture time 'now' (called per packet, O(1))
+    void advance(double now) {
+        if (now < _nxtBkt) {
+            return;
+        }
+        _curBkt = int64_t(now / _bktWidth);
+        _nxtBkt = double(_curBkt + 1) * _bktWidth;
+        // entries from before the bucket nBkts-1 back are dead
+        _expTm = double(_curBkt - nBkts + 1) * _bktWidth;
+    }
+
+    // save capture time of (flow, TSval) if not already present
+    void add(uint32_t fid, uint32_t tsv, double tm) {
+        if (!_old.empty()) {
+            move();
+        } else if (_nextSize != 0) {
+            prepare();
+        } else {
+            checkLoad();
+        }
+        sweep(_pass ? boostStep : sweepStep);
+        size_t dead = SIZE_MAX;
+        for (size_t i = home(fid, tsv); ; i = (i + 1) & _mask) {
+            entry& e = _tbl[i];
+            if (e.fid == 0) {
+                if (entry* o = findOld(fid, tsv)) {
+                    if (o->tm < _expTm) {
+                        *o = entry{fid, tsv, tm};   // expired incarnation not yet moved
+                    }
+                    return;
+                }
+                if (dead == SIZE_MAX) {
+                    e = entry{fid, tsv, tm};
+                    _cnt++;
+                } else {
+                    _tbl[dead] = entry{fid, tsv, tm};   // reuse a dead slot on the chain
+                }
+                return;
+            }
+            if ((e.fid & idMask) == fid && e.tsv == tsv) {
+                if (e.tm < _expTm) {
+                    e = entry{fid, tsv, tm};     // expired incarnation of this TSval
+                }
+                return;                          // retain first (oldest) appearance
+            }
+            if (dead == SIZE_MAX && e.tm < _expTm) {
+                dead = i;
+            }
+        }
+    }
+
+    // return the saved capture time of (flow, TSval) and mark it used so
+    // it can't be matched again. Returns -1 if not present, already used
+    // or expired.
+    double getUnused(uint32_t fid, uint32_t tsv) {
+        if (!_old.empty()) {
+            move();
+        }
+        entry* e = nullptr;
+        for (size_t i = home(fid, tsv); ; i = (i + 1) & _mask) {
+            if (_tbl[i].fid == 0) {
+                e = findOld(fid, tsv);
+                break;
+            }
+            if ((_tbl[i].fid & idMask) == fid && _tbl[i].tsv == tsv) {
+                e = &_tbl[i];
+                break;
+            }
+        }
+        if (!e || (e->fid & usedBit) || e->tm < _expTm) {
+            return -1.;
+        }
+        e->fid |= usedBit;
+        return e->tm;
+    }
+
+    size_t size() const { return _cnt + _oldCnt; }
+    size_t capacity() const { return _tbl.size() + _old.size(); }
+
+    // call f(fid, tsv, tm, used) for each live entry
+    template <typename F>
+    void forEach(F&& f) const {
+        auto each = [&](const entry& e) {
+            if (e.fid != 0 && e.tm >= _expTm) {
+                f(e.fid & idMask, e.tsv, e.tm, (e.fid & usedBit) != 0);
+            }
+        };
+        for (const auto& e : _tbl) {
+            each(e);
+        }
+        for (size_t i = _moved; i < _old.size(); i++) {
+            each(_old[i]);
+        }
+    }
+    // put back an entry saved by forEach
+    void restore(uint32_t fid, uint32_t tsv, double tm, bool used) {
+        add(fid, tsv, tm);
+        if (used) {
+            getUnused(fid, tsv);
+        }
+    }
+
+  private:
+    std::vector<entry, arenaAlloc<entry>> _tbl;
+    size_t _mask;
+    size_t _cnt{};          // occupied slots (live and not yet reclaimed)
+    size_t _cursor{};       // sweep position
+    size_t _pass{};         // slots left in a faster sweep pass (0 = not in one)
+    bool _swept{};          // a faster pass was started at this load
+    // while doubling, the table being zeroed then the previous table. Its slots before _moved have
+    // been moved (they're left in place so its probe chains stay intact)
+    std::vector<entry, arenaAlloc<entry>> _next;
+    size_t _nextSize{};     // size of _next when zeroed (0 = not doubling)
+    std::vector<entry, arenaAlloc<entry>> _old;
+    size_t _oldMask{};
+    size_t _moved{};
+    size_t _oldCnt{};       // occupied slots of _old not yet moved
+    double _bktWidth;       // seconds per time bucket
+    int64_t _curBkt;        // bucket of current capture time
+    double _nxtBkt;         // start time of the next bucket
+    double _expTm;          // entries with capture time before this are dead
+
+    static uint64_t hash(uint32_t fid, uint32_t tsv) {
+        uint64_t h = (uint64_t(fid & idMask) << 32) | tsv;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+    size_t home(uint32_t fid, uint32_t tsv) const { return hash(fid, tsv) & _mask; }
+
+    // backward-shift delete of slot i: move later entries of the probe
+    // chain that can legally occupy the hole back into it
+    void erase(size_t i) {
+        for (size_t j = i; ; ) {
+            j = (j + 1) & _mask;
+            if (_tbl[j].fid == 0) {
+                break;
+            }
+            size_t h = home(_tbl[j].fid, _tbl[j].tsv);
+            // entry j can fill hole i unless its home lies cyclically in (i, j]
+            bool stay = (i <= j) ? (i < h && h <= j) : (i < h || h <= j);
+            if (!stay) {
+                _tbl[i] = _tbl[j];
+                i = j;
+            }
+        }
+        _tbl[i].fid = 0;
+        _cnt--;
+    }
+
+    // reclaim dead slots at the cursor
+    void sweep(int step) {
+        for (int n = 0; n < step; n++) {
+            entry& e = _tbl[_cursor];
+            if (e.fid != 0 && e.tm < _expTm) {
+                erase(_cursor);     // re-examine this slot; something may have shifted into it
+            } else {
+                _cursor = (_cursor + 1) & _mask;
+                _pass -= _pass != 0;
+            }
+        }
+    }
+
+    // at 3/4 full start a faster sweep pass. If the table is still 3/4 full
+    // when it's done (or gets 7/8 full first) the entries are live: double
+    void checkLoad() {
+        size_t n = _tbl.size();
+        if (_cnt < (n >> 1) + (n >> 2)) {
+            _pass = 0;
+            _swept = false;
+        } else if (!_swept) {
+            _pass = n;
+            _swept = true;
+        } else if (_pass == 0 || _cnt >= n - (n >> 3)) {
+            grow();
+        }
+    }
+
+    // start doubling: reserve the new table for prepare() to zero
+    void grow() {
+        _pass = 0;
+        _swept = false;
+        _nextSize = 2 * _tbl.size();
+        _next.reserve(_nextSize);
+    }
+
+    // zero the next few slots of the new table. Once it's all zeroed it
+    // replaces the current table, which becomes _old for move()
+    void prepare() {
+        // (up to _nextSize, not _next.capacity(): reserve() may round up and _mask needs a power of 2)
+        _next.resize(std::min(_next.size() + zeroStep, _nextSize), entry{0, 0, 0.});
+        if (_next.size() < _nextSize) {
+            return;
+        }
+        _nextSize = 0;
+        _old.swap(_tbl);
+        _tbl.swap(_next);
+        _oldMask = _mask;
+        _oldCnt = _cnt;
+        _moved = 0;
+        _mask = _tbl.size() - 1;
+        _cnt = 0;
+        _cursor = 0;
+    }
+
+    // move the next few slots of _old, dropping dead entries
+    void move() {
+        for (int n = 0; n < moveStep && _moved < _old.size(); n++, _moved++) {
+            const entry& e = _old[_moved];
+            if (e.fid == 0) {
+                continue;
+            }
+            _oldCnt--;
+            if (e.tm < _expTm) {
+                continue;
+            }
+            size_t i = home(e.fid, e.tsv);
+            while (_tbl[i].fid != 0) {
+                i = (i + 1) & _mask;
+            }
+            _tbl[i] = e;
+            _cnt++;
+        }
+        if (_moved == _old.size()) {
+            decltype(_old)(_old.get_allocator()).swap(_old);   // (frees it)
+        }
+    }
+
+    // (flow, TSval) in the part of _old not yet moved
+    entry* findOld(uint32_t fid, uint32_t tsv) {
+        if (_old.empty()) {
+            return nullptr;
+        }
+        for (size_t i = hash(fid, tsv) & _oldMask; ; i = (i + 1) & _oldMask) {
+            entry& e = _old[i];
+            if (e.fid == 0) {
+                return nullptr;
+            }
+            if ((e.fid & idMask) == fid && e.tsv == tsv) {
+                return i >= _moved ? &e : nullptr;
+            }
+        }
+    }
+};
+
+#endif // TSVALTABLE_HPP
@@ -0,0 +1,189 @@
+/*
+ * xdpCapture: userspace side of the XDP pre-filter (see dlyloc.bpf.c)
+ *
+ * Loads the XDP program, attaches it to the interface and reads the
+ * xdpRecs it pushes through the BPF ring buffer. Only built when libbpf
+ * is available (make XDP=1 defines HAVE_LIBBPF).
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef XDPCAPTURE_HPP
+#define XDPCAPTURE_HPP
+
+#ifdef HAVE_LIBBPF
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "./xdpRec.h"
+
+#ifndef XDP_OBJ
+#define XDP_OBJ "./dlyloc.bpf.o"    // compiled XDP program
+#endif
+
+struct xdpCapture {
+    using handler = bool (*)(const xdpRec&);   // returns false to stop
+
+    bpf_object* _obj{};
+    ring_buffer* _rb{};
+    int _ifindex{};
+    int _statsFd{-1};
+    uint32_t _xdpFlags{XDP_FLAGS_UPDATE_IF_NOEXIST};
+    int64_t _monoOff{};         // realtime - monotonic (ns)
+    handler _hndlr{};
+    bool _stop{};
+    std::string _err;
+
+    ~xdpCapture() { close(); }
+
+    bool open(const std::string& ifname, handler h, const char* objPath = XDP_OBJ) {
+        _hndlr = h;
+        _ifindex = if_nametoindex(ifname.c_str());
+        if (_ifindex == 0) {
+            return fail("if_nametoindex");
+        }
+        _obj = bpf_object__open_file(objPath, nullptr);
+        if (_obj == nullptr) {
+            return fail(objPath);
+        }
+        if (bpf_object__load(_obj) != 0) {
+            return fail("bpf_object__load");
+        }
+        bpf_program* prog = bpf_object__find_program_by_name(_obj, "dlyloc_xdp");
+        int rbFd = bpf_object__find_map_fd_by_name(_obj, "records");
+        _statsFd = bpf_object__find_map_fd_by_name(_obj, "stats");
+        if (prog == nullptr || rbFd < 0 || _statsFd < 0) {
+            _err = std::string(objPath) + ": not a dlyloc XDP program";
+            return false;
+        }
+        // try native (driver) mode first, fall back to generic
+        if (bpf_xdp_attach(_ifindex, bpf_program__fd(prog), _xdpFlags | XDP_FLAGS_DRV_MODE, nullptr) == 0) {
+            _xdpFlags |= XDP_FLAGS_DRV_MODE;
+        } else if (bpf_xdp_attach(_ifindex, bpf_program__fd(prog), _xdpFlags | XDP_FLAGS_SKB_MODE, nullptr) == 0) {
+            _xdpFlags |= XDP_FLAGS_SKB_MODE;
+        } else {
+            _ifindex = 0;
+            return fail("bpf_xdp_attach");
+        }
+        _rb = ring_buffer__new(rbFd, sample, this, nullptr);
+        if (_rb == nullptr) {
+            return fail("ring_buffer__new");
+        }
+        struct timespec rt, mono;
+        clock_gettime(CLOCK_REALTIME, &rt);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        _monoOff = (int64_t(rt.tv_sec) - mono.tv_sec) * 1000000000 + (rt.tv_nsec - mono.tv_nsec);
+        return true;
+    }
+
+    // wait up to 'tmo' ms for records and hand them to the handler.
+    // Returns false when the handler asked to stop or on error.
+    bool poll(int tmo = 250) {
+        int n = ring_buffer__poll(_rb, tmo);
+        if (_stop) {
+            return false;
+        }
+        if (n < 0 && n != -EINTR) {
+            _err = std::string("ring_buffer__poll: ") + strerror(-n);
+            return false;
+        }
+        return true;
+    }
+
+    // kernel side counters (summed over cpus), indexed by xdpStat*
+    void stats(uint64_t out[xdpStatCnt]) {
+        int ncpu = libbpf_num_possible_cpus();
+        std::vector<uint64_t> v(ncpu > 0 ? ncpu : 1);
+        for (uint32_t i = 0; i < xdpStatCnt; i++) {
+            out[i] = 0;
+            if (bpf_map_lookup_elem(_statsFd, &i, v.data()) == 0) {
+                for (auto c : v) {
+                    out[i] += c;
+                }
+            }
+        }
+    }
+
+    // convert a record's monotonic timestamp to realtime sec & usec
+    void realTime(const xdpRec& r, int64_t& sec, int64_t& usec) const {
+        int64_t ns = int64_t(r.tstamp) + _monoOff;
+        sec = ns / 1000000000;
+        usec = (ns % 1000000000) / 1000;
+    }
+
+    void close() {
+        if (_rb) {
+            ring_buffer__free(_rb);
+            _rb = nullptr;
+        }
+        if (_ifindex) {
+            bpf_xdp_detach(_ifindex, _xdpFlags & (XDP_FLAGS_DRV_MODE | XDP_FLAGS_SKB_MODE), nullptr);
+            _ifindex = 0;
+        }
+        if (_obj) {
+            bpf_object__close(_obj);
+            _obj = nullptr;
+        }
+    }
+
+  private:
+    static int sample(void* ctx, void* data, size_t sz) {
+        auto* x = (xdpCapture*)ctx;
+        if (sz < sizeof(xdpRec) || x->_stop) {
+            return 0;
+        }
+        if (!x->_hndlr(*(const xdpRec*)data)) {
+            x->_stop = true;
+            return -1;      // ends this ring_buffer__poll
+        }
+        return 0;
+    }
+    bool fail(const char* what) {
+        _err = std::string(what) + ": " + strerror(errno);
+        return false;
+    }
+};
+
+#endif // HAVE_LIBBPF
+#endif // XDPCAPTURE_HPP
@@ -0,0 +1,79 @@
+/*
+ * xdpRec: record format shared by the dlyloc XDP program (dlyloc.bpf.c)
+ * and its userspace reader (xdpCapture.hpp). Plain C so both sides can
+ * include it.
+ */
+
+/* Copyright (C) 2022 Pollere LLC
+ * All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of a BSD-style License. You should have received a 
+ *  copy of the License along with this program. 
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  This program is distributed in the hope that it will be useful.
+ *  You may contact Pollere LLC at info@pollere.net.
+ *
+ */
+
+#ifndef XDPREC_H
+#define XDPREC_H
+
+#include <linux/types.h>
+
+/*
+ * One record per TCP packet that carries a TSval/ECR pair not already
+ * seen on its flow. Packets that repeat the previous pair are folded into
+ * the next record's 'len' and 'pkts' so byte and packet counts stay exact.
+ */
+struct xdpRec {
+    __u64 tstamp;           // bpf_ktime_get_ns() (CLOCK_MONOTONIC) at arrival
+    __u8 src[16];           // addresses in v6 or v4-mapped v6 form
+    __u8 dst[16];
+    __u16 sport, dport;     // host byte order
+    __u32 tsval, ecr;
+    __u32 len;              // frame bytes, including any folded packets
+    __u16 pkts;             // packets this record stands for (>= 1)
+    __u8 flags;             // tcp flags byte
+    __u8 pad;
+};
+
+// per-flow dedup state (key is the first 36 bytes of an xdpRec's addresses + ports)
+struct xdpFlowKey {
+    __u8 src[16];
+    __u8 dst[16];
+    __u16 sport, dport;
+};
+struct xdpFlowVal {
+    __u32 tsval, ecr;       // last pair sent to userspace
+    __u32 len;              // bytes of folded packets since then
+    __u32 pkts;
+};
+
+// indices of the per-cpu stats array
+enum { xdpStatPkts, xdpStatNotTCP, xdpStatNoTS, xdpStatDups, xdpStatRbFull, xdpStatCnt };
+
+#endif // XDPREC_H